@@ -18,6 +18,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <sched.h>
 #include "utils.h"
 #include "conffile_reader.h"
 
@@ -34,6 +35,25 @@ int conf_operation_mode = 0;
 int conf_modbus_delay_ms = 0;
 int conf_kbus_priority = 0;
 int conf_kbus_cycle_ms = 0;
+int conf_modbus_worker_threads = 0;
+int conf_modbus_output_queue_bytes = 0;
+char conf_modbus_udp_address[CONF_MAX_STRING_LENGTH];
+int conf_modbus_udp_batch = 0;
+int conf_modbus_io_engine = 0;
+int conf_modbus_idle_timeout_s = 0;
+int conf_modbus_connection_policy = 0;
+int conf_modbus_request_quota = 0;
+int conf_modbus_latency_profile = 0;
+int conf_modbus_busy_poll_us = 0;
+int conf_modbus_cpu = -1;
+int conf_kbus_image_shm = 0;
+int conf_modbus_subscription_lease_s = 0;
+conf_deadband_t conf_kbus_deadband[CONF_MAX_DEADBANDS];
+int conf_kbus_deadband_count = 0;
+int conf_modbus_hole_policy = 0;
+int conf_modbus_map_default = 0;
+conf_map_region_t conf_modbus_map_region[CONF_MAX_MAP_REGIONS];
+int conf_modbus_map_region_count = 0;
 
 /**
  * @brief Config file available parameters
@@ -45,9 +65,107 @@ const char *options[] = {
     "operation_mode",
     "modbus_delay_ms",
     "kbus_priority",
-    "kbus_cycle_ms"
+    "kbus_cycle_ms",
+    "modbus_worker_threads",
+    "modbus_output_queue_bytes",
+    "modbus_udp_address",
+    "modbus_udp_batch",
+    "modbus_io_engine",
+    "modbus_idle_timeout_s",
+    "modbus_connection_policy",
+    "modbus_request_quota",
+    "modbus_latency_profile",
+    "modbus_busy_poll_us",
+    "modbus_cpu",
+    "kbus_image_shm",
+    "modbus_subscription_lease_s",
+    "kbus_deadband",
+    "modbus_hole_policy",
+    "modbus_map_default",
+    "modbus_map_region"
 };
 
+/**
+ * @brief Names of the storages of modbus_map_region, see conf_mapStorage_t
+ */
+static const char *conf_mapStorages[CONF_MAP_STORAGE_COUNT] = {
+    "in1",
+    "out1",
+    "in2",
+    "out2",
+    "din1",
+    "dout1",
+    "din2",
+    "dout2",
+    "watchdog",
+    "kbusinfo",
+    "mac",
+    "subscribe",
+    "deadband",
+    "const",
+    "shortdescription",
+    "config"
+};
+
+/**
+ * @brief Parse an entry of the register map
+ * <space>:<first>:<last>:<access>:<storage>[:<offset>]
+ * @param[in] value Entry
+ * @param[out] region Region
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+static int conf_parseMapRegion(const char *value, conf_map_region_t *region)
+{
+    char space[8];
+    char access[4];
+    char storage[24];
+    char rest;
+    int n;
+    int i;
+
+    region->offset = 0;
+    n = sscanf(value, "%7[a-z]:%i:%i:%3[rw]:%23[a-z0-9]:%i%c", space, &region->first, &region->last,
+               access, storage, &region->offset, &rest);
+    if ((n != 5) && (n != 6))
+    {
+        return -1;
+    }
+
+    if (strcmp(space, "reg") == 0)
+    {
+        region->coils = FALSE;
+    }
+    else if (strcmp(space, "coil") == 0)
+    {
+        region->coils = TRUE;
+    }
+    else
+    {
+        return -1;
+    }
+
+    region->access = 0;
+    for (i = 0; access[i] != '\0'; i++)
+    {
+        region->access |= (access[i] == 'r') ? CONF_MAP_ACCESS_READ : CONF_MAP_ACCESS_WRITE;
+    }
+
+    for (i = 0; i < CONF_MAP_STORAGE_COUNT; i++)
+    {
+        if (strcmp(storage, conf_mapStorages[i]) == 0)
+        {
+            break;
+        }
+    }
+    if (i == CONF_MAP_STORAGE_COUNT)
+    {
+        return -1;
+    }
+    region->storage = i;
+    return 0;
+}
+
 /**
  * @brief Config
  */
@@ -68,6 +186,12 @@ static int conf_setParameter(const char *parameter, char *value)
     {
         if (str2int(&conf_max_tcp_connections, value, 10) != STR2INT_SUCCESS)
             return -1;
+
+        if (conf_max_tcp_connections < 1)
+        {
+            fprintf(stderr, "INVALID PARAMETER: Maximum TCP connections must be at least 1\n");
+            return -1;
+        }
     }
     else if (strcmp(parameter, options[3]) == 0)
     {
@@ -107,12 +231,245 @@ static int conf_setParameter(const char *parameter, char *value)
             return -1;
         }
     }
+    else if (strcmp(parameter, options[7]) == 0)
+    {
+        if (str2int(&conf_modbus_worker_threads, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        //checking range
+        if ((conf_modbus_worker_threads < 1) || (conf_modbus_worker_threads > 16))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus worker threads must be in the range of 1-16\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[8]) == 0)
+    {
+        if (str2int(&conf_modbus_output_queue_bytes, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        //checking range
+        if ((conf_modbus_output_queue_bytes < 1024) || (conf_modbus_output_queue_bytes > 1048576))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus output queue must be in the range of 1024-1048576 bytes\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[9]) == 0)
+    {
+        if ((value == NULL) || (strlen(value) >= sizeof(conf_modbus_udp_address)))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus UDP address list must be shorter than %d characters\n",
+                    CONF_MAX_STRING_LENGTH);
+            return -1;
+        }
+        strcpy(conf_modbus_udp_address, value);
+    }
+    else if (strcmp(parameter, options[10]) == 0)
+    {
+        if (str2int(&conf_modbus_udp_batch, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        //checking range
+        if ((conf_modbus_udp_batch < 1) || (conf_modbus_udp_batch > 64))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus UDP batch must be in the range of 1-64\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[11]) == 0)
+    {
+        if (str2int(&conf_modbus_io_engine, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        if ((conf_modbus_io_engine != CONF_IO_ENGINE_EPOLL) && (conf_modbus_io_engine != CONF_IO_ENGINE_URING))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus I/O engine must be 0 (epoll) or 1 (io_uring)\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[12]) == 0)
+    {
+        if (str2int(&conf_modbus_idle_timeout_s, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        //checking range, 0 disables the timeout
+        if ((conf_modbus_idle_timeout_s < 0) || (conf_modbus_idle_timeout_s > 86400))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus idle timeout must be in the range of 0-86400 s\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[13]) == 0)
+    {
+        if (str2int(&conf_modbus_connection_policy, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        if ((conf_modbus_connection_policy != CONF_CONNECTION_POLICY_REFUSE) &&
+            (conf_modbus_connection_policy != CONF_CONNECTION_POLICY_EVICT_LRU))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus connection policy must be 0 (refuse) or 1 (evict LRU)\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[14]) == 0)
+    {
+        if (str2int(&conf_modbus_request_quota, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        //checking range
+        if ((conf_modbus_request_quota < 1) || (conf_modbus_request_quota > 1000))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus request quota must be in the range of 1-1000\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[15]) == 0)
+    {
+        if (str2int(&conf_modbus_latency_profile, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        if ((conf_modbus_latency_profile != CONF_LATENCY_PROFILE_DEFAULT) &&
+            (conf_modbus_latency_profile != CONF_LATENCY_PROFILE_LOW))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus latency profile must be 0 (default) or 1 (low latency)\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[16]) == 0)
+    {
+        if (str2int(&conf_modbus_busy_poll_us, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        //checking range
+        if ((conf_modbus_busy_poll_us < 0) || (conf_modbus_busy_poll_us > 10000))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus busy poll time must be in the range of 0-10000 us\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[17]) == 0)
+    {
+        if (str2int(&conf_modbus_cpu, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        //checking range
+        if ((conf_modbus_cpu < -1) || (conf_modbus_cpu >= CPU_SETSIZE))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus CPU must be -1 (not pinned) or in the range of 0-%d\n", CPU_SETSIZE - 1);
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[18]) == 0)
+    {
+        if (str2int(&conf_kbus_image_shm, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        if ((conf_kbus_image_shm != 0) && (conf_kbus_image_shm != 1))
+        {
+            fprintf(stderr, "INVALID PARAMETER: KBUS image shared memory must be 0 (off) or 1 (on)\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[19]) == 0)
+    {
+        if (str2int(&conf_modbus_subscription_lease_s, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        //checking range
+        if ((conf_modbus_subscription_lease_s < 0) || (conf_modbus_subscription_lease_s > 86400))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus subscription lease must be in the range of 0-86400 s\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[20]) == 0)
+    {
+        conf_deadband_t *deadband = &conf_kbus_deadband[conf_kbus_deadband_count];
+        char rest;
+
+        //Entry may be given more than once: <position>:<channel>:<absolute>:<percent>
+        if (conf_kbus_deadband_count >= CONF_MAX_DEADBANDS)
+        {
+            fprintf(stderr, "INVALID PARAMETER: KBUS deadband may be given at most %d times\n", CONF_MAX_DEADBANDS);
+            return -1;
+        }
+        if ((value == NULL) ||
+            (sscanf(value, "%d:%d:%d:%d%c", &deadband->position, &deadband->channel,
+                    &deadband->absolute, &deadband->percent, &rest) != 4))
+        {
+            fprintf(stderr, "INVALID PARAMETER: KBUS deadband must be given as <position>:<channel>:<absolute>:<percent>\n");
+            return -1;
+        }
+
+        //checking range
+        if ((deadband->position < 0) || (deadband->position > 255) || (deadband->channel < 0) || (deadband->channel > 255) ||
+            (deadband->absolute < 0) || (deadband->absolute > 32767) || (deadband->percent < 0) || (deadband->percent > 10000))
+        {
+            fprintf(stderr, "INVALID PARAMETER: KBUS deadband position and channel must be in the range of 0-255, "
+                    "absolute deadband 0-32767 and percentage deadband 0-10000 (0.01 %%)\n");
+            return -1;
+        }
+        conf_kbus_deadband_count++;
+    }
+    else if (strcmp(parameter, options[21]) == 0)
+    {
+        if (str2int(&conf_modbus_hole_policy, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        if ((conf_modbus_hole_policy != CONF_HOLE_POLICY_REJECT) &&
+            (conf_modbus_hole_policy != CONF_HOLE_POLICY_ZERO))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus hole policy must be 0 (reject) or 1 (zero)\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[22]) == 0)
+    {
+        if (str2int(&conf_modbus_map_default, value, 10) != STR2INT_SUCCESS)
+            return -1;
+
+        if ((conf_modbus_map_default != 0) && (conf_modbus_map_default != 1))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus default map must be 0 (off) or 1 (on)\n");
+            return -1;
+        }
+    }
+    else if (strcmp(parameter, options[23]) == 0)
+    {
+        conf_map_region_t *region = &conf_modbus_map_region[conf_modbus_map_region_count];
+
+        //Entry may be given more than once: <space>:<first>:<last>:<access>:<storage>[:<offset>]
+        if (conf_modbus_map_region_count >= CONF_MAX_MAP_REGIONS)
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus map region may be given at most %d times\n", CONF_MAX_MAP_REGIONS);
+            return -1;
+        }
+        if ((value == NULL) || (conf_parseMapRegion(value, region) < 0))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus map region must be given as "
+                    "<reg|coil>:<first>:<last>:<r|w|rw>:<storage>[:<offset>]\n");
+            return -1;
+        }
+
+        //checking range
+        if ((region->first < 0) || (region->last > 0xFFFF) || (region->first > region->last) ||
+            (region->offset < 0) || (region->offset > 0xFFFF))
+        {
+            fprintf(stderr, "INVALID PARAMETER: Modbus map region addresses must be in the range of 0-0xFFFF, "
+                    "first <= last, offset 0-0xFFFF\n");
+            return -1;
+        }
+        conf_modbus_map_region_count++;
+    }
 
     return 0;
 }
 
 static void conf_printConfiguration(void)
 {
+    int i;
+
     fprintf(stdout, "\n======= CONFIGURATION =======\n");
     fprintf(stdout, "ORDER NUMBER: %d\n", conf_order_number);
     fprintf(stdout, "PORT: %d\n", conf_modbus_port);
@@ -121,6 +478,34 @@ static void conf_printConfiguration(void)
     fprintf(stdout, "MODBUS DELAY MS: %u\n", conf_modbus_delay_ms);
     fprintf(stdout, "KBUS CYCLE TIME MS: %d\n", conf_kbus_cycle_ms);
     fprintf(stdout, "KBUS PRIORITY: %d\n", conf_kbus_priority);
+    fprintf(stdout, "MODBUS WORKER THREADS: %d\n", conf_modbus_worker_threads);
+    fprintf(stdout, "MODBUS OUTPUT QUEUE BYTES: %d\n", conf_modbus_output_queue_bytes);
+    fprintf(stdout, "MODBUS UDP ADDRESS: %s\n", conf_modbus_udp_address);
+    fprintf(stdout, "MODBUS UDP BATCH: %d\n", conf_modbus_udp_batch);
+    fprintf(stdout, "MODBUS IO ENGINE: %d\n", conf_modbus_io_engine);
+    fprintf(stdout, "MODBUS IDLE TIMEOUT S: %d\n", conf_modbus_idle_timeout_s);
+    fprintf(stdout, "MODBUS CONNECTION POLICY: %d\n", conf_modbus_connection_policy);
+    fprintf(stdout, "MODBUS REQUEST QUOTA: %d\n", conf_modbus_request_quota);
+    fprintf(stdout, "MODBUS LATENCY PROFILE: %d\n", conf_modbus_latency_profile);
+    fprintf(stdout, "MODBUS BUSY POLL US: %d\n", conf_modbus_busy_poll_us);
+    fprintf(stdout, "MODBUS CPU: %d\n", conf_modbus_cpu);
+    fprintf(stdout, "KBUS IMAGE SHM: %d\n", conf_kbus_image_shm);
+    fprintf(stdout, "MODBUS SUBSCRIPTION LEASE S: %d\n", conf_modbus_subscription_lease_s);
+    for (i = 0; i < conf_kbus_deadband_count; i++)
+    {
+        fprintf(stdout, "KBUS DEADBAND: %d:%d:%d:%d\n", conf_kbus_deadband[i].position, conf_kbus_deadband[i].channel,
+                conf_kbus_deadband[i].absolute, conf_kbus_deadband[i].percent);
+    }
+    fprintf(stdout, "MODBUS HOLE POLICY: %d\n", conf_modbus_hole_policy);
+    fprintf(stdout, "MODBUS MAP DEFAULT: %d\n", conf_modbus_map_default);
+    for (i = 0; i < conf_modbus_map_region_count; i++)
+    {
+        conf_map_region_t *region = &conf_modbus_map_region[i];
+
+        fprintf(stdout, "MODBUS MAP REGION: %s:0x%04X:0x%04X:%s%s:%s:%d\n", region->coils ? "coil" : "reg",
+                region->first, region->last, (region->access & CONF_MAP_ACCESS_READ) ? "r" : "",
+                (region->access & CONF_MAP_ACCESS_WRITE) ? "w" : "", conf_mapStorages[region->storage], region->offset);
+    }
     fprintf(stdout, "==============================\n");
 }
 
@@ -141,6 +526,34 @@ int conf_init(void)
     conf_modbus_delay_ms = DEFAULT_CONFIG_MODBUS_DELAY_MS;
     //-------- KBUS Priority ------
     conf_kbus_priority = DEFAULT_CONFIG_KBUS_PRIORITY;
+    //-------- Modbus Worker Threads ------
+    conf_modbus_worker_threads = DEFAULT_CONFIG_MODBUS_WORKER_THREADS;
+    //-------- Modbus Output Queue ------
+    conf_modbus_output_queue_bytes = DEFAULT_CONFIG_MODBUS_OUTPUT_QUEUE_BYTES;
+    //-------- Modbus UDP ------
+    strcpy(conf_modbus_udp_address, DEFAULT_CONFIG_MODBUS_UDP_ADDRESS);
+    conf_modbus_udp_batch = DEFAULT_CONFIG_MODBUS_UDP_BATCH;
+    //-------- Modbus I/O Engine ------
+    conf_modbus_io_engine = DEFAULT_CONFIG_MODBUS_IO_ENGINE;
+    //-------- Modbus Connection Handling ------
+    conf_modbus_idle_timeout_s = DEFAULT_CONFIG_MODBUS_IDLE_TIMEOUT_S;
+    conf_modbus_connection_policy = DEFAULT_CONFIG_MODBUS_CONNECTION_POLICY;
+    conf_modbus_request_quota = DEFAULT_CONFIG_MODBUS_REQUEST_QUOTA;
+    //-------- Modbus Latency Profile ------
+    conf_modbus_latency_profile = DEFAULT_CONFIG_MODBUS_LATENCY_PROFILE;
+    conf_modbus_busy_poll_us = DEFAULT_CONFIG_MODBUS_BUSY_POLL_US;
+    conf_modbus_cpu = DEFAULT_CONFIG_MODBUS_CPU;
+    //-------- KBUS Image Shared Memory ------
+    conf_kbus_image_shm = DEFAULT_CONFIG_KBUS_IMAGE_SHM;
+    //-------- Modbus Subscriptions ------
+    conf_modbus_subscription_lease_s = DEFAULT_CONFIG_MODBUS_SUBSCRIPTION_LEASE_S;
+    //-------- KBUS Deadbands ------
+    conf_kbus_deadband_count = 0;
+    //-------- Modbus Hole Policy ------
+    conf_modbus_hole_policy = DEFAULT_CONFIG_MODBUS_HOLE_POLICY;
+    //-------- Modbus Register Map ------
+    conf_modbus_map_default = DEFAULT_CONFIG_MODBUS_MAP_DEFAULT;
+    conf_modbus_map_region_count = 0;
     return 0;
 }
 
@@ -14,6 +14,88 @@
 #define DEFAULT_CONFIG_MODBUS_DELAY_MS      0
 #define DEFAULT_CONFIG_KBUS_PRIORITY        60
 #define DEFAULT_CONFIG_KBUS_CYCLE_MS        50
+#define DEFAULT_CONFIG_MODBUS_WORKER_THREADS 1
+#define DEFAULT_CONFIG_MODBUS_OUTPUT_QUEUE_BYTES 65536
+#define DEFAULT_CONFIG_MODBUS_UDP_ADDRESS   "127.0.0.1"
+#define DEFAULT_CONFIG_MODBUS_UDP_BATCH     16
+#define DEFAULT_CONFIG_MODBUS_IO_ENGINE     CONF_IO_ENGINE_EPOLL
+#define DEFAULT_CONFIG_MODBUS_IDLE_TIMEOUT_S 0
+#define DEFAULT_CONFIG_MODBUS_CONNECTION_POLICY CONF_CONNECTION_POLICY_REFUSE
+#define DEFAULT_CONFIG_MODBUS_REQUEST_QUOTA 8
+#define DEFAULT_CONFIG_MODBUS_LATENCY_PROFILE CONF_LATENCY_PROFILE_DEFAULT
+#define DEFAULT_CONFIG_MODBUS_BUSY_POLL_US  50
+#define DEFAULT_CONFIG_MODBUS_CPU           -1
+#define DEFAULT_CONFIG_KBUS_IMAGE_SHM       1
+#define DEFAULT_CONFIG_MODBUS_SUBSCRIPTION_LEASE_S 60
+#define DEFAULT_CONFIG_MODBUS_HOLE_POLICY   CONF_HOLE_POLICY_REJECT
+#define DEFAULT_CONFIG_MODBUS_MAP_DEFAULT   1
+
+#define CONF_MAX_STRING_LENGTH 128 /**< @brief Maximum length of string parameters incl. termination */
+#define CONF_MAX_DEADBANDS 64 /**< @brief Maximum number of kbus_deadband entries */
+#define CONF_MAX_MAP_REGIONS 48 /**< @brief Maximum number of modbus_map_region entries */
+
+#define CONF_IO_ENGINE_EPOLL 0 /**< @brief Modbus TCP uses epoll and non-blocking socket calls */
+#define CONF_IO_ENGINE_URING 1 /**< @brief Modbus TCP uses io_uring, falls back to epoll if not available */
+
+#define CONF_CONNECTION_POLICY_REFUSE 0     /**< @brief New connections are refused if max_tcp_connections is reached */
+#define CONF_CONNECTION_POLICY_EVICT_LRU 1  /**< @brief The least recently used connection is closed for a new one */
+
+#define CONF_LATENCY_PROFILE_DEFAULT 0  /**< @brief Modbus threads block while idle, Nagle and delayed ACKs stay enabled */
+#define CONF_LATENCY_PROFILE_LOW 1      /**< @brief Modbus threads busy poll, replies leave without delay */
+
+#define CONF_HOLE_POLICY_REJECT 0   /**< @brief Requests spanning unmapped addresses are answered with an exception */
+#define CONF_HOLE_POLICY_ZERO 1     /**< @brief Unmapped addresses within a request read as 0, writes to them are discarded */
+
+/**
+ * @brief Deadband of analog input channels, entry kbus_deadband
+ */
+typedef struct
+{
+    int position;   /**< @brief Module position starting with 1, 0 for all modules */
+    int channel;    /**< @brief Channel of the module starting with 1, 0 for all channels */
+    int absolute;   /**< @brief Absolute deadband in LSB */
+    int percent;    /**< @brief Deadband in 0.01 % of the full scale value 0x7FFF */
+} conf_deadband_t;
+
+#define CONF_MAP_ACCESS_READ  0x01 /**< @brief Region of the register map may be read */
+#define CONF_MAP_ACCESS_WRITE 0x02 /**< @brief Region of the register map may be written */
+
+/**
+ * @brief Storage backing a region of the register map
+ */
+typedef enum
+{
+    CONF_MAP_STORAGE_IN1 = 0,           /**< @brief Reads input area 1, writes output area 1 */
+    CONF_MAP_STORAGE_OUT1,              /**< @brief Output area 1 */
+    CONF_MAP_STORAGE_IN2,               /**< @brief Reads input area 2, writes output area 2 */
+    CONF_MAP_STORAGE_OUT2,              /**< @brief Output area 2 */
+    CONF_MAP_STORAGE_DIN1,              /**< @brief Reads digital inputs 1-512, writes digital outputs 1-512 */
+    CONF_MAP_STORAGE_DOUT1,             /**< @brief Digital outputs 1-512 */
+    CONF_MAP_STORAGE_DIN2,              /**< @brief Reads digital inputs 513-2040, writes digital outputs 513-2040 */
+    CONF_MAP_STORAGE_DOUT2,             /**< @brief Digital outputs 513-2040 */
+    CONF_MAP_STORAGE_WATCHDOG,          /**< @brief Watchdog registers 0x1000-0x100B */
+    CONF_MAP_STORAGE_KBUSINFO,          /**< @brief Process image information 0x1022-0x1025 */
+    CONF_MAP_STORAGE_MAC,               /**< @brief MAC-ID 0x1031-0x1033 */
+    CONF_MAP_STORAGE_SUBSCRIBE,         /**< @brief Change-of-state subscriptions 0x1040-0x1047 */
+    CONF_MAP_STORAGE_DEADBAND,          /**< @brief Deadbands of analog inputs 0x1048-0x104C */
+    CONF_MAP_STORAGE_CONST,             /**< @brief Constants 0x2000-0x2008 */
+    CONF_MAP_STORAGE_SHORTDESCRIPTION,  /**< @brief Short description 0x2020 */
+    CONF_MAP_STORAGE_CONFIG,            /**< @brief I/O modules 0x2030-0x2033 */
+    CONF_MAP_STORAGE_COUNT
+} conf_mapStorage_t;
+
+/**
+ * @brief Region of the register map, entry modbus_map_region
+ */
+typedef struct
+{
+    int coils;      /**< @brief TRUE for the bit address space, FALSE for registers */
+    int first;      /**< @brief First address of the region */
+    int last;       /**< @brief Last address of the region */
+    int access;     /**< @brief CONF_MAP_ACCESS_READ and CONF_MAP_ACCESS_WRITE */
+    int storage;    /**< @brief Backing storage, see conf_mapStorage_t */
+    int offset;     /**< @brief Entry of the storage served by the first address */
+} conf_map_region_t;
 
 int conf_init(void);
 int conf_getConfig(void);
@@ -26,5 +108,24 @@ extern int conf_operation_mode;
 extern int conf_modbus_delay_ms;
 extern int conf_kbus_priority;
 extern int conf_kbus_cycle_ms;
+extern int conf_modbus_worker_threads;
+extern int conf_modbus_output_queue_bytes;
+extern char conf_modbus_udp_address[CONF_MAX_STRING_LENGTH];
+extern int conf_modbus_udp_batch;
+extern int conf_modbus_io_engine;
+extern int conf_modbus_idle_timeout_s;
+extern int conf_modbus_connection_policy;
+extern int conf_modbus_request_quota;
+extern int conf_modbus_latency_profile;
+extern int conf_modbus_busy_poll_us;
+extern int conf_modbus_cpu;
+extern int conf_kbus_image_shm;
+extern int conf_modbus_subscription_lease_s;
+extern conf_deadband_t conf_kbus_deadband[CONF_MAX_DEADBANDS];
+extern int conf_kbus_deadband_count;
+extern int conf_modbus_hole_policy;
+extern int conf_modbus_map_default;
+extern conf_map_region_t conf_modbus_map_region[CONF_MAX_MAP_REGIONS];
+extern int conf_modbus_map_region_count;
 
 #endif /* __CONFFILE_READER_H__ */
@@ -20,6 +20,10 @@
 #include <string.h>
 #include <pthread.h>
 #include "kbus.h"
+#include "kbus_image.h"
+#include "kbus_deadband.h"
+#include "kbus_channel.h"
+#include "modbus_subscribe.h"
 #include "modbus.h"
 #include "utils.h"
 #include "proc.h"
@@ -565,6 +569,8 @@ static int kbus_setup(void)
         return -5;
 
     kbus_initialized = TRUE;
+    kbusDeadband_setup(terminalDescription, modules, terminalCount);
+    kbusChannel_setup(terminalDescription, modules, terminalCount);
     //Create /proc "/tmp" entry
     proc_createEntry(terminalCount, modules, terminalDescription);
 
@@ -670,8 +676,13 @@ static void kbus_update(void)
         if (retval == DAL_SUCCESS)
         {
 
+            const uint16_t *filtered;
+
             adi->WatchdogTrigger();
 
+            //Take over outputs staged by local clients
+            kbusImage_applyStaged(modbus_write_register_out);
+
             //Get Modbus write data copy it to KBUS
             int ret= modbus_copy_register_out(pd_out, sizeof(pd_out));
             if (ret < 0)
@@ -695,6 +706,16 @@ static void kbus_update(void)
        {
                 dprintf(VERBOSE_DEBUG, "[KBUS] Mapping read failed: %d\n", ret);
             }
+
+            //Push changes of subscribed input registers, analog inputs filtered by their deadband
+            filtered = kbusDeadband_filter((uint16_t *)pd_in, kbus_mapBitCountToWordRegister(kbus_getBitCount_Input()));
+            if (filtered != NULL)
+            {
+                modbusSubscribe_update(filtered, kbus_mapBitCountToWordRegister(kbus_getBitCount_Input()));
+            }
+
+            //Publish both images of this cycle for local clients
+            kbusImage_publish(pd_in, bytesToRead, pd_out, bytesToWrite);
         }
     }
 exit:
@@ -752,6 +773,10 @@ int kbus_start(void)
     }
 
     pthread_mutex_init(&kbus_update_mutex, NULL);
+    if (kbusImage_init() < 0)
+    {
+        dprintf(VERBOSE_STD, "KbusImage: Init failed, no shared memory process image\n");
+    }
     modbus_registerMsgReceivedCallback(kbus_forceUpdate);
     kbus_setRTPriority(conf_kbus_priority);
     if (kbus_timerSetup(&kbus_timerID, conf_kbus_cycle_ms) < 0)
@@ -767,6 +792,7 @@ int kbus_start(void)
 void kbus_stop(void)
 {
     kbus_timerDelete(kbus_timerID);
+    kbusImage_deInit();
     kbus_close(); // ignore return-value
     pthread_mutex_destroy(&kbus_update_mutex);
     kbus_initialized = FALSE;
@@ -822,6 +848,24 @@ unsigned int kbus_getBytesToRead(void)
     return bytesToRead;
 }
 
+/**
+ * @brief Returns the process data length to write in registers
+ * @return Number of registers
+ */
+unsigned int kbus_getRegistersToWrite(void)
+{
+    return kbus_mapBitCountToWordRegister(kbus_getBitCount_Output());
+}
+
+/**
+ * @brief Returns the process data length to read in registers
+ * @return Number of registers
+ */
+unsigned int kbus_getRegistersToRead(void)
+{
+    return kbus_mapBitCountToWordRegister(kbus_getBitCount_Input());
+}
+
 /**
  * @brief Copy terminal information to given pointer
  * @param[out] *cnt - pointer for terminal count
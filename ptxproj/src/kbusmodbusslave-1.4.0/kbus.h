@@ -31,6 +31,8 @@ unsigned int kbus_getDigitalByteOffsetInput(void);
 
 unsigned int kbus_getBytesToWrite(void);
 unsigned int kbus_getBytesToRead(void);
+unsigned int kbus_getRegistersToWrite(void);
+unsigned int kbus_getRegistersToRead(void);
 
 unsigned char kbus_getIsInitialized(void);
 
@@ -0,0 +1,151 @@
+//------------------------------------------------------------------------------
+/// Copyright (c) WAGO Kontakttechnik GmbH & Co. KG
+///
+/// PROPRIETARY RIGHTS are involved in the subject matter of this material.
+/// All manufacturing, reproduction, use and sales rights pertaining to this
+/// subject matter are governed by the license agreement. The recipient of this
+/// software implicitly accepts the terms of the license.
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+///
+///  \file     kbus_channel.c
+///
+///  \brief    Channels of the I/O modules, taken from the terminal
+///            description. The process data of a module is divided into its
+///            channels if every channel has the same width of up to 16 bits,
+///            otherwise it is served as whole words. Rebuilt on every KBUS
+///            setup, see modbus_channel.c for the register view.
+///
+///  \author   <BrT> : WAGO Kontakttechnik GmbH & Co. KG
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "kbus_channel.h"
+#include "utils.h"
+
+static pthread_mutex_t kbusChannel_mutex = PTHREAD_MUTEX_INITIALIZER; /**< @brief Guards the module table */
+static kbusChannel_module_t kbusChannel_modules[KBUSCHANNEL_MAX_MODULES];
+static int kbusChannel_count = 0;   /**< @brief Number of modules in the table */
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Get the width of the channels of one direction
+ * @param[in] size Process data of the direction in bits
+ * @param[in] channels Number of channels of the module
+ * @return Width of a channel
+ * @retval 0 if the process data is not divided into channels
+ */
+static int kbusChannel_getWidth(int size, int channels)
+{
+    if ((size == 0) || (channels == 0) || (channels > KBUSCHANNEL_MAX_CHANNELS) ||
+        (size % channels) || ((size / channels) > KBUSCHANNEL_MAX_BITS))
+    {
+        return 0;
+    }
+    return size / channels;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Build the module table from the terminal description
+ * @param[in] terminals Terminal description
+ * @param[in] modules Module types
+ * @param[in] count Number of modules
+ * @return Number of modules in the table
+ */
+int kbusChannel_setup(const tldkc_KbusInfo_TerminalInfo *terminals, const module_desc_t *modules, size_t count)
+{
+    size_t i;
+    int n;
+
+    if (count > KBUSCHANNEL_MAX_MODULES)
+    {
+        dprintf(VERBOSE_STD, "Channel: only the first %d of %u modules are served\n",
+                KBUSCHANNEL_MAX_MODULES, (unsigned int)count);
+        count = KBUSCHANNEL_MAX_MODULES;
+    }
+
+    pthread_mutex_lock(&kbusChannel_mutex);
+    memset(kbusChannel_modules, 0, sizeof(kbusChannel_modules));
+    for (i = 0; i < count; i++)
+    {
+        const tldkc_KbusInfo_TerminalInfo *terminal = &terminals[i];
+        kbusChannel_module_t *module = &kbusChannel_modules[i];
+        int channels = terminal->AdditionalInfo.ChannelCount;
+        int inBits = kbusChannel_getWidth(terminal->SizeInput_bits, channels);
+        int outBits = kbusChannel_getWidth(terminal->SizeOutput_bits, channels);
+
+        module->type = modules[i].value;
+        module->flags = (modules[i].value & 0x8000) ? KBUSCHANNEL_FLAG_DIGITAL : 0;
+        module->inOffset = terminal->OffsetInput_bits;
+        module->outOffset = terminal->OffsetOutput_bits;
+
+        if (((terminal->SizeInput_bits > 0) && (inBits == 0)) ||
+            ((terminal->SizeOutput_bits > 0) && (outBits == 0)))
+        {
+            //Complex module, e.g. counter or serial interface, served by whole words
+            module->flags |= KBUSCHANNEL_FLAG_WORDS;
+            module->inChannels = terminal->SizeInput_bits / KBUSCHANNEL_MAX_BITS;
+            module->outChannels = terminal->SizeOutput_bits / KBUSCHANNEL_MAX_BITS;
+            module->inBits = (module->inChannels > 0) ? KBUSCHANNEL_MAX_BITS : 0;
+            module->outBits = (module->outChannels > 0) ? KBUSCHANNEL_MAX_BITS : 0;
+            if (module->inChannels > KBUSCHANNEL_MAX_CHANNELS)
+            {
+                module->inChannels = KBUSCHANNEL_MAX_CHANNELS;
+            }
+            if (module->outChannels > KBUSCHANNEL_MAX_CHANNELS)
+            {
+                module->outChannels = KBUSCHANNEL_MAX_CHANNELS;
+            }
+            continue;
+        }
+        module->inChannels = (inBits > 0) ? channels : 0;
+        module->inBits = inBits;
+        module->outChannels = (outBits > 0) ? channels : 0;
+        module->outBits = outBits;
+    }
+    kbusChannel_count = count;
+    n = kbusChannel_count;
+    pthread_mutex_unlock(&kbusChannel_mutex);
+
+    dprintf(VERBOSE_STD, "Channel: %d modules\n", n);
+    return n;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Get the number of modules
+ * @return Number of modules
+ */
+int kbusChannel_getModuleCount(void)
+{
+    return kbusChannel_count;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Get the channels of a module
+ * @param[in] position Module position starting with 1
+ * @param[out] module Channels of the module
+ * @retval 0 on success
+ * @retval <0 if there is no module at this position
+ */
+int kbusChannel_getModule(int position, kbusChannel_module_t *module)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&kbusChannel_mutex);
+    if ((position >= 1) && (position <= kbusChannel_count))
+    {
+        *module = kbusChannel_modules[position - 1];
+        ret = 0;
+    }
+    pthread_mutex_unlock(&kbusChannel_mutex);
+    return ret;
+}
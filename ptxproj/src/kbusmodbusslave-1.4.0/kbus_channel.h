@@ -0,0 +1,35 @@
+#ifndef __KBUS_CHANNEL_H__
+#define __KBUS_CHANNEL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ldkc_kbus_information.h>
+#include "kbus.h"
+
+#define KBUSCHANNEL_MAX_MODULES 64    /**< @brief Modules served by the channel view */
+#define KBUSCHANNEL_MAX_CHANNELS 16   /**< @brief Channels of a module per direction */
+#define KBUSCHANNEL_MAX_BITS 16       /**< @brief Maximum width of a channel */
+
+#define KBUSCHANNEL_FLAG_DIGITAL 0x0001 /**< @brief Digital module */
+#define KBUSCHANNEL_FLAG_WORDS   0x0002 /**< @brief Data not divided into channels, served word by word */
+
+/**
+ * @brief Channels of one module
+ */
+typedef struct
+{
+    uint16_t type;          /**< @brief Module type as given by the terminal list */
+    uint16_t flags;         /**< @brief KBUSCHANNEL_FLAG_* */
+    uint16_t inChannels;    /**< @brief Number of input channels */
+    uint16_t inBits;        /**< @brief Width of an input channel */
+    uint16_t outChannels;   /**< @brief Number of output channels */
+    uint16_t outBits;       /**< @brief Width of an output channel */
+    uint16_t inOffset;      /**< @brief Bit offset of the first input channel in the input image */
+    uint16_t outOffset;     /**< @brief Bit offset of the first output channel in the output image */
+} kbusChannel_module_t;
+
+int kbusChannel_setup(const tldkc_KbusInfo_TerminalInfo *terminals, const module_desc_t *modules, size_t count);
+int kbusChannel_getModuleCount(void);
+int kbusChannel_getModule(int position, kbusChannel_module_t *module);
+
+#endif /* __KBUS_CHANNEL_H__ */
@@ -0,0 +1,323 @@
+//------------------------------------------------------------------------------
+/// Copyright (c) WAGO Kontakttechnik GmbH & Co. KG
+///
+/// PROPRIETARY RIGHTS are involved in the subject matter of this material.
+/// All manufacturing, reproduction, use and sales rights pertaining to this
+/// subject matter are governed by the license agreement. The recipient of this
+/// software implicitly accepts the terms of the license.
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+///
+///  \file     kbus_deadband.c
+///
+///  \brief    Deadband of analog input channels. The channels are taken from
+///            the terminal description: every 16 bit input channel of a non
+///            digital module. Once per KBUS cycle each channel with a
+///            deadband keeps its last reported value until the input leaves
+///            the deadband around it. Change detection works on the filtered
+///            image, the Modbus registers keep the unfiltered values.
+///
+///  \author   <BrT> : WAGO Kontakttechnik GmbH & Co. KG
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "kbus_deadband.h"
+#include "modbus_stats.h"
+#include "utils.h"
+#include "conffile_reader.h"
+
+#define KBUSDEADBAND_IMAGE_WORDS 1020       /**< @brief Input registers of area 1 and area 2 */
+#define KBUSDEADBAND_MAX_CHANNELS KBUSDEADBAND_IMAGE_WORDS /**< @brief Each channel takes one word */
+#define KBUSDEADBAND_CHANNEL_BITS 16        /**< @brief Only channels of this width get a deadband */
+#define KBUSDEADBAND_FULL_SCALE 0x7FFF      /**< @brief Reference of the percentage deadband */
+#define KBUSDEADBAND_PERCENT_SCALE 10000    /**< @brief Percentage deadband is given in 0.01 % */
+
+/**
+ * @brief One analog input channel
+ */
+typedef struct
+{
+    uint8_t position;   /**< @brief Module position starting with 1 */
+    uint8_t channel;    /**< @brief Channel of the module starting with 1 */
+    uint16_t word;      /**< @brief Index of the channel in the input image */
+    uint16_t absolute;  /**< @brief Absolute deadband in LSB */
+    uint16_t percent;   /**< @brief Deadband in 0.01 % of the full scale value */
+    uint16_t band;      /**< @brief Effective deadband, the larger one of both */
+    uint16_t reported;  /**< @brief Last value leaving the deadband */
+    char valid;         /**< @brief reported holds a value */
+} kbusDeadband_channel_t;
+
+static pthread_mutex_t kbusDeadband_mutex = PTHREAD_MUTEX_INITIALIZER; /**< @brief Guards the channel table */
+static kbusDeadband_channel_t kbusDeadband_channels[KBUSDEADBAND_MAX_CHANNELS];
+static int kbusDeadband_count = 0;                  /**< @brief Number of analog input channels */
+static volatile int kbusDeadband_active = 0;        /**< @brief Channels with a deadband */
+static uint16_t kbusDeadband_image[KBUSDEADBAND_IMAGE_WORDS]; /**< @brief Filtered input image */
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Set the deadband of a channel. The next KBUS cycle takes its input
+ * as reported value.
+ * @param[in] ch Channel
+ * @param[in] absolute Absolute deadband in LSB
+ * @param[in] percent Deadband in 0.01 % of the full scale value
+ */
+static void kbusDeadband_apply(kbusDeadband_channel_t *ch, uint16_t absolute, uint16_t percent)
+{
+    uint32_t band = ((uint32_t)percent * KBUSDEADBAND_FULL_SCALE) / KBUSDEADBAND_PERCENT_SCALE;
+
+    if (band < absolute)
+    {
+        band = absolute;
+    }
+    if ((ch->band == 0) && (band > 0))
+    {
+        kbusDeadband_active++;
+    }
+    else if ((ch->band > 0) && (band == 0))
+    {
+        kbusDeadband_active--;
+    }
+    ch->absolute = absolute;
+    ch->percent = percent;
+    ch->band = band;
+    ch->valid = FALSE;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Check if a channel is selected
+ * @param[in] ch Channel
+ * @param[in] position Module position, 0 for all modules
+ * @param[in] channel Channel of the module, 0 for all channels
+ * @return TRUE if selected
+ */
+static char kbusDeadband_isSelected(const kbusDeadband_channel_t *ch, int position, int channel)
+{
+    return ((position == 0) || (ch->position == position)) && ((channel == 0) || (ch->channel == channel));
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Build the channel table from the terminal description. Channels
+ * keep their deadband over a KBUS reset, new channels get the deadband of
+ * the configuration file.
+ * @param[in] terminals Terminal description
+ * @param[in] modules Module types
+ * @param[in] count Number of modules
+ * @return Number of analog input channels
+ */
+int kbusDeadband_setup(const tldkc_KbusInfo_TerminalInfo *terminals, const module_desc_t *modules, size_t count)
+{
+    static kbusDeadband_channel_t previous[KBUSDEADBAND_MAX_CHANNELS];
+    int previousCount;
+    size_t i;
+    int n;
+    int k;
+
+    pthread_mutex_lock(&kbusDeadband_mutex);
+    previousCount = kbusDeadband_count;
+    memcpy(previous, kbusDeadband_channels, previousCount * sizeof(kbusDeadband_channel_t));
+    memset(kbusDeadband_channels, 0, sizeof(kbusDeadband_channels));
+    kbusDeadband_count = 0;
+    kbusDeadband_active = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        const tldkc_KbusInfo_TerminalInfo *terminal = &terminals[i];
+        int channels = terminal->AdditionalInfo.ChannelCount;
+
+        if ((modules[i].value & 0x8000) || (channels == 0) ||
+            (terminal->SizeInput_bits != (channels * KBUSDEADBAND_CHANNEL_BITS)) ||
+            (terminal->OffsetInput_bits % KBUSDEADBAND_CHANNEL_BITS))
+        {
+            //Digital module or no plain 16 bit input channels
+            continue;
+        }
+        for (n = 0; n < channels; n++)
+        {
+            kbusDeadband_channel_t *ch = &kbusDeadband_channels[kbusDeadband_count];
+            int word = (terminal->OffsetInput_bits / KBUSDEADBAND_CHANNEL_BITS) + n;
+
+            if ((kbusDeadband_count >= KBUSDEADBAND_MAX_CHANNELS) || (word >= KBUSDEADBAND_IMAGE_WORDS))
+            {
+                break;
+            }
+            ch->position = i + 1;
+            ch->channel = n + 1;
+            ch->word = word;
+            kbusDeadband_count++;
+
+            for (k = 0; k < previousCount; k++)
+            {
+                if ((previous[k].position == ch->position) && (previous[k].channel == ch->channel))
+                {
+                    break;
+                }
+            }
+            if (k < previousCount)
+            {
+                kbusDeadband_apply(ch, previous[k].absolute, previous[k].percent);
+                continue;
+            }
+            for (k = 0; k < conf_kbus_deadband_count; k++)
+            {
+                if (kbusDeadband_isSelected(ch, conf_kbus_deadband[k].position, conf_kbus_deadband[k].channel))
+                {
+                    kbusDeadband_apply(ch, conf_kbus_deadband[k].absolute, conf_kbus_deadband[k].percent);
+                }
+            }
+        }
+    }
+    n = kbusDeadband_count;
+    pthread_mutex_unlock(&kbusDeadband_mutex);
+
+    dprintf(VERBOSE_STD, "Deadband: %d analog input channels, %d with deadband\n", n, kbusDeadband_active);
+    return n;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Filter the input image of a KBUS cycle. Called by the KBUS cycle,
+ * it never waits for the lock.
+ * @param[in] image Input registers of area 1 followed by area 2
+ * @param[in] n Number of valid registers
+ * @return Filtered image, image itself if no channel has a deadband
+ * @retval NULL if the channel table is just changed, try next cycle
+ */
+const uint16_t *kbusDeadband_filter(const uint16_t *image, size_t n)
+{
+    uint32_t suppressed = 0;
+    int i;
+
+    if (kbusDeadband_active == 0)
+    {
+        return image;
+    }
+    if (n > KBUSDEADBAND_IMAGE_WORDS)
+    {
+        n = KBUSDEADBAND_IMAGE_WORDS;
+    }
+    if (pthread_mutex_trylock(&kbusDeadband_mutex) != 0)
+    {
+        return NULL;
+    }
+
+    memcpy(kbusDeadband_image, image, n * sizeof(uint16_t));
+    for (i = 0; i < kbusDeadband_count; i++)
+    {
+        kbusDeadband_channel_t *ch = &kbusDeadband_channels[i];
+        int diff;
+
+        if ((ch->band == 0) || (ch->word >= n))
+        {
+            continue;
+        }
+        diff = (int16_t)image[ch->word] - (int16_t)ch->reported;
+        if (!ch->valid || (diff > ch->band) || (diff < -ch->band))
+        {
+            ch->reported = image[ch->word];
+            ch->valid = TRUE;
+        }
+        else if (diff != 0)
+        {
+            suppressed++;
+        }
+        kbusDeadband_image[ch->word] = ch->reported;
+    }
+    pthread_mutex_unlock(&kbusDeadband_mutex);
+
+    if (suppressed > 0)
+    {
+        modbusStats_add(MODBUSSTATS_DEADBAND_SUPPRESSED, suppressed);
+    }
+    return kbusDeadband_image;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Get the number of analog input channels
+ * @return Number of channels
+ */
+int kbusDeadband_getChannelCount(void)
+{
+    return kbusDeadband_count;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Get the deadband of a channel
+ * @param[in] position Module position starting with 1
+ * @param[in] channel Channel of the module starting with 1
+ * @param[out] absolute Absolute deadband in LSB
+ * @param[out] percent Deadband in 0.01 % of the full scale value
+ * @retval 0 on success
+ * @retval <0 if there is no such analog input channel
+ */
+int kbusDeadband_get(int position, int channel, uint16_t *absolute, uint16_t *percent)
+{
+    int ret = -1;
+    int i;
+
+    pthread_mutex_lock(&kbusDeadband_mutex);
+    for (i = 0; i < kbusDeadband_count; i++)
+    {
+        if ((kbusDeadband_channels[i].position == position) && (kbusDeadband_channels[i].channel == channel))
+        {
+            *absolute = kbusDeadband_channels[i].absolute;
+            *percent = kbusDeadband_channels[i].percent;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&kbusDeadband_mutex);
+    return ret;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Set the deadband of channels
+ * @param[in] position Module position starting with 1, 0 for all modules
+ * @param[in] channel Channel of the module starting with 1, 0 for all channels
+ * @param[in] absolute Absolute deadband in LSB
+ * @param[in] percent Deadband in 0.01 % of the full scale value
+ * @return Number of channels set
+ * @retval <0 if no analog input channel is selected or a value is out of range
+ */
+int kbusDeadband_set(int position, int channel, uint16_t absolute, uint16_t percent)
+{
+    int n = 0;
+    int i;
+
+    if ((absolute > KBUSDEADBAND_FULL_SCALE) || (percent > KBUSDEADBAND_PERCENT_SCALE))
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&kbusDeadband_mutex);
+    for (i = 0; i < kbusDeadband_count; i++)
+    {
+        if (kbusDeadband_isSelected(&kbusDeadband_channels[i], position, channel))
+        {
+            kbusDeadband_apply(&kbusDeadband_channels[i], absolute, percent);
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&kbusDeadband_mutex);
+
+    if (n == 0)
+    {
+        return -2;
+    }
+    dprintf(VERBOSE_STD, "Deadband %d:%d set to %u LSB / %u.%02u %% (%d channels)\n", position, channel, absolute,
+            percent / 100, percent % 100, n);
+    return n;
+}
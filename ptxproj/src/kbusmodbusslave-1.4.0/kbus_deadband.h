@@ -0,0 +1,15 @@
+#ifndef __KBUS_DEADBAND_H__
+#define __KBUS_DEADBAND_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ldkc_kbus_information.h>
+#include "kbus.h"
+
+int kbusDeadband_setup(const tldkc_KbusInfo_TerminalInfo *terminals, const module_desc_t *modules, size_t count);
+const uint16_t *kbusDeadband_filter(const uint16_t *image, size_t n);
+int kbusDeadband_getChannelCount(void);
+int kbusDeadband_get(int position, int channel, uint16_t *absolute, uint16_t *percent);
+int kbusDeadband_set(int position, int channel, uint16_t absolute, uint16_t percent);
+
+#endif /* __KBUS_DEADBAND_H__ */
@@ -0,0 +1,209 @@
+//------------------------------------------------------------------------------
+/// Copyright (c) WAGO Kontakttechnik GmbH & Co. KG
+///
+/// PROPRIETARY RIGHTS are involved in the subject matter of this material.
+/// All manufacturing, reproduction, use and sales rights pertaining to this
+/// subject matter are governed by the license agreement. The recipient of this
+/// software implicitly accepts the terms of the license.
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+///
+///  \file     kbus_image.c
+///
+///  \brief    Publishes the KBUS process images in POSIX shared memory for
+///            local clients, see kbus_image_client.h. The KBUS cycle is the
+///            only writer of the images, it never blocks on a client: the
+///            images are guarded by a sequence lock and staged outputs are
+///            skipped for one cycle while a client holds the staging lock.
+///
+///  \author   <BrT> : WAGO Kontakttechnik GmbH & Co. KG
+//------------------------------------------------------------------------------
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kbus_image.h"
+#include "kbus_image_client.h"
+#include "kbus.h"
+#include "utils.h"
+#include "conffile_reader.h"
+
+static kbusImage_shm_t *kbusImage_shm = NULL; /**< @brief Mapped shared memory segment */
+
+/**
+ * @brief Create the shared memory segment. Any local user may read the images
+ * and stage outputs, like any local user may send Modbus requests to the
+ * loopback interface.
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+int kbusImage_init(void)
+{
+    mode_t mask;
+    int fd;
+
+    if (!conf_kbus_image_shm)
+    {
+        return 0;
+    }
+
+    //Clients of a previous run keep their old mapping, they have to reopen
+    shm_unlink(KBUSIMAGE_SHM_NAME);
+    mask = umask(0);
+    fd = shm_open(KBUSIMAGE_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0666);
+    umask(mask);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Unable to create process image %s: %s\n", KBUSIMAGE_SHM_NAME, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(kbusImage_shm_t)) == -1)
+    {
+        fprintf(stderr, "Unable to size process image: %s\n", strerror(errno));
+        close(fd);
+        shm_unlink(KBUSIMAGE_SHM_NAME);
+        return -2;
+    }
+    kbusImage_shm = mmap(NULL, sizeof(kbusImage_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (kbusImage_shm == MAP_FAILED)
+    {
+        kbusImage_shm = NULL;
+        shm_unlink(KBUSIMAGE_SHM_NAME);
+        return -3;
+    }
+
+    kbusImage_shm->version = KBUSIMAGE_VERSION;
+    kbusImage_shm->digital_input_offset = kbus_getDigitalByteOffsetInput();
+    kbusImage_shm->digital_output_offset = kbus_getDigitalByteOffsetOutput();
+    __atomic_store_n(&kbusImage_shm->magic, KBUSIMAGE_MAGIC, __ATOMIC_RELEASE);
+
+    dprintf(VERBOSE_STD, "KbusImage: process image published in %s\n", KBUSIMAGE_SHM_NAME);
+    return 0;
+}
+
+/**
+ * @brief Remove the shared memory segment
+ */
+void kbusImage_deInit(void)
+{
+    if (kbusImage_shm == NULL)
+    {
+        return;
+    }
+    __atomic_store_n(&kbusImage_shm->magic, 0, __ATOMIC_RELEASE);
+    munmap(kbusImage_shm, sizeof(kbusImage_shm_t));
+    kbusImage_shm = NULL;
+    shm_unlink(KBUSIMAGE_SHM_NAME);
+}
+
+/**
+ * @brief Publish the images of a KBUS cycle. Has to be called by the KBUS
+ * cycle only, there must be no concurrent writer.
+ * @param[in] input Input image read from the KBUS
+ * @param[in] input_bytes Valid bytes of the input image
+ * @param[in] output Output image written to the KBUS
+ * @param[in] output_bytes Valid bytes of the output image
+ */
+void kbusImage_publish(const uint8_t *input, size_t input_bytes, const uint8_t *output, size_t output_bytes)
+{
+    kbusImage_shm_t *shm = kbusImage_shm;
+    uint32_t seq;
+
+    if (shm == NULL)
+    {
+        return;
+    }
+    if (input_bytes > KBUSIMAGE_SIZE)
+    {
+        input_bytes = KBUSIMAGE_SIZE;
+    }
+    if (output_bytes > KBUSIMAGE_SIZE)
+    {
+        output_bytes = KBUSIMAGE_SIZE;
+    }
+
+    //Odd sequence tells readers to retry
+    seq = shm->seq;
+    __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(shm->input, input, input_bytes);
+    memcpy(shm->output, output, output_bytes);
+    shm->input_bytes = input_bytes;
+    shm->output_bytes = output_bytes;
+    shm->cycle++;
+
+    __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Hand the outputs staged by clients over to the output registers.
+ * Staged bytes are passed as runs of consecutive bytes. If a client holds
+ * the staging lock right now, the outputs are taken over in the next cycle.
+ * @param[in] apply Function writing a run of staged bytes to the outputs
+ * @return Number of staged bytes taken over
+ * @retval <0 on failure
+ */
+int kbusImage_applyStaged(int (*apply)(const uint8_t *source, size_t offset, size_t n))
+{
+    kbusImage_shm_t *shm = kbusImage_shm;
+    uint32_t pid = (uint32_t)getpid();
+    uint32_t owner = 0;
+    size_t begin;
+    size_t end;
+    size_t i;
+    int count = 0;
+
+    if ((shm == NULL) || (__atomic_load_n(&shm->stage_end, __ATOMIC_RELAXED) == 0))
+    {
+        return 0;
+    }
+
+    if (!__atomic_compare_exchange_n(&shm->stage_lock, &owner, pid, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        //Release the lock of a client which died while staging
+        if ((kill((pid_t)owner, 0) == -1) && (errno == ESRCH))
+        {
+            __atomic_compare_exchange_n(&shm->stage_lock, &owner, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+        return 0;
+    }
+
+    begin = shm->stage_begin;
+    end = (shm->stage_end < KBUSIMAGE_SIZE) ? shm->stage_end : KBUSIMAGE_SIZE;
+    i = begin;
+    while (i < end)
+    {
+        size_t run;
+
+        if (!(shm->stage_dirty[i / 8] & (1U << (i % 8))))
+        {
+            i++;
+            continue;
+        }
+        for (run = i; (run < end) && (shm->stage_dirty[run / 8] & (1U << (run % 8))); run++)
+        {
+            shm->stage_dirty[run / 8] &= (uint8_t)~(1U << (run % 8));
+        }
+        if (apply(&shm->stage[i], i, run - i) < 0)
+        {
+            count = -1;
+        }
+        else if (count >= 0)
+        {
+            count += run - i;
+        }
+        i = run;
+    }
+    shm->stage_begin = 0;
+    shm->stage_end = 0;
+
+    __atomic_store_n(&shm->stage_lock, 0, __ATOMIC_RELEASE);
+    return count;
+}
@@ -0,0 +1,12 @@
+#ifndef __KBUS_IMAGE_H__
+#define __KBUS_IMAGE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+int kbusImage_init(void);
+void kbusImage_deInit(void);
+void kbusImage_publish(const uint8_t *input, size_t input_bytes, const uint8_t *output, size_t output_bytes);
+int kbusImage_applyStaged(int (*apply)(const uint8_t *source, size_t offset, size_t n));
+
+#endif /* __KBUS_IMAGE_H__ */
@@ -0,0 +1,238 @@
+//------------------------------------------------------------------------------
+/// Copyright (c) WAGO Kontakttechnik GmbH & Co. KG
+///
+/// PROPRIETARY RIGHTS are involved in the subject matter of this material.
+/// All manufacturing, reproduction, use and sales rights pertaining to this
+/// subject matter are governed by the license agreement. The recipient of this
+/// software implicitly accepts the terms of the license.
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+///
+///  \file     kbus_image_client.h
+///
+///  \brief    Client API of the shared memory process image. kbusmodbusslave
+///            publishes the KBUS input and output images after every KBUS
+///            cycle. Local processes on the same controller read them
+///            without any system call and stage outputs which are taken
+///            over in the next KBUS cycle, like a Modbus write.
+///
+///            Reading is guarded by a sequence lock: the reader copies the
+///            image and repeats the copy if the KBUS cycle changed it in
+///            the meantime. Staging takes a small lock shared with other
+///            clients, the KBUS cycle never waits for it.
+///
+///            Usage:
+///            \code
+///            kbusImage_shm_t *image = kbusImageClient_open();
+///            uint8_t in[16];
+///            kbusImageClient_readInput(image, 0, in, sizeof(in));
+///            kbusImageClient_stageOutput(image, 0, in, 2);
+///            kbusImageClient_close(image);
+///            \endcode
+///            Link with -lrt.
+///
+///  \author   <BrT> : WAGO Kontakttechnik GmbH & Co. KG
+//------------------------------------------------------------------------------
+#ifndef __KBUS_IMAGE_CLIENT_H__
+#define __KBUS_IMAGE_CLIENT_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define KBUSIMAGE_SHM_NAME "/kbusmodbusslave.image" /**< @brief Name of the POSIX shared memory segment */
+#define KBUSIMAGE_MAGIC 0x4B42494DU                 /**< @brief "KBIM", segment is initialized */
+#define KBUSIMAGE_VERSION 1                         /**< @brief Layout version of kbusImage_shm_t */
+#define KBUSIMAGE_SIZE 4096                         /**< @brief Size of each process image in bytes */
+
+/**
+ * @brief Layout of the shared memory segment
+ */
+typedef struct
+{
+    uint32_t magic;             /**< @brief KBUSIMAGE_MAGIC as soon as the segment is valid */
+    uint32_t version;           /**< @brief KBUSIMAGE_VERSION */
+    uint32_t seq;               /**< @brief Sequence lock of the images, odd while they are written */
+    uint32_t input_bytes;       /**< @brief Valid bytes of the input image */
+    uint32_t output_bytes;      /**< @brief Valid bytes of the output image */
+    uint32_t digital_input_offset;  /**< @brief Offset of the digital inputs in the input image */
+    uint32_t digital_output_offset; /**< @brief Offset of the digital outputs in the output image */
+    uint32_t reserved;
+    uint64_t cycle;             /**< @brief Number of the KBUS cycle the images belong to */
+    uint8_t input[KBUSIMAGE_SIZE];  /**< @brief Input process image as read from the KBUS */
+    uint8_t output[KBUSIMAGE_SIZE]; /**< @brief Output process image as written to the KBUS */
+    uint32_t stage_lock;        /**< @brief PID of the process staging outputs, 0 if unlocked */
+    uint32_t stage_begin;       /**< @brief First staged byte */
+    uint32_t stage_end;         /**< @brief Behind the last staged byte, 0 if nothing is staged */
+    uint32_t reserved2;
+    uint8_t stage[KBUSIMAGE_SIZE];  /**< @brief Outputs staged for the next KBUS cycle */
+    uint8_t stage_dirty[KBUSIMAGE_SIZE / 8]; /**< @brief One bit per staged byte of stage */
+} kbusImage_shm_t;
+
+/**
+ * @brief Map the process image of kbusmodbusslave
+ * @return Process image
+ * @retval NULL if kbusmodbusslave is not running or the layout differs
+ */
+static inline kbusImage_shm_t *kbusImageClient_open(void)
+{
+    kbusImage_shm_t *image;
+    int fd;
+
+    fd = shm_open(KBUSIMAGE_SHM_NAME, O_RDWR, 0);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    image = mmap(NULL, sizeof(kbusImage_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+    {
+        return NULL;
+    }
+    if ((__atomic_load_n(&image->magic, __ATOMIC_ACQUIRE) != KBUSIMAGE_MAGIC) || (image->version != KBUSIMAGE_VERSION))
+    {
+        munmap(image, sizeof(kbusImage_shm_t));
+        errno = EPROTO;
+        return NULL;
+    }
+    return image;
+}
+
+/**
+ * @brief Unmap the process image
+ * @param[in] image Process image of kbusImageClient_open()
+ */
+static inline void kbusImageClient_close(kbusImage_shm_t *image)
+{
+    if (image != NULL)
+    {
+        munmap(image, sizeof(kbusImage_shm_t));
+    }
+}
+
+/**
+ * @brief Copy a consistent part of one of the images
+ * @param[in] image Process image
+ * @param[in] source input or output of the image
+ * @param[in] offset First byte
+ * @param[out] dest Destination
+ * @param[in] len Number of bytes
+ * @return KBUS cycle the data belong to
+ */
+static inline uint64_t kbusImageClient_read(const kbusImage_shm_t *image, const uint8_t *source, size_t offset,
+                                            void *dest, size_t len)
+{
+    uint32_t seq;
+    uint64_t cycle;
+
+    if ((offset >= KBUSIMAGE_SIZE) || (len > (KBUSIMAGE_SIZE - offset)))
+    {
+        return 0;
+    }
+    for (;;)
+    {
+        seq = __atomic_load_n(&image->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            //KBUS cycle is writing the images right now
+            sched_yield();
+            continue;
+        }
+        memcpy(dest, &source[offset], len);
+        cycle = image->cycle;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&image->seq, __ATOMIC_RELAXED) == seq)
+        {
+            return cycle;
+        }
+    }
+}
+
+/**
+ * @brief Read a consistent part of the input image
+ * @param[in] image Process image
+ * @param[in] offset First byte
+ * @param[out] dest Destination
+ * @param[in] len Number of bytes
+ * @return KBUS cycle the inputs belong to
+ */
+static inline uint64_t kbusImageClient_readInput(const kbusImage_shm_t *image, size_t offset, void *dest, size_t len)
+{
+    return kbusImageClient_read(image, image->input, offset, dest, len);
+}
+
+/**
+ * @brief Read a consistent part of the output image as written to the KBUS
+ * @param[in] image Process image
+ * @param[in] offset First byte
+ * @param[out] dest Destination
+ * @param[in] len Number of bytes
+ * @return KBUS cycle the outputs belong to
+ */
+static inline uint64_t kbusImageClient_readOutput(const kbusImage_shm_t *image, size_t offset, void *dest, size_t len)
+{
+    return kbusImageClient_read(image, image->output, offset, dest, len);
+}
+
+/**
+ * @brief Stage outputs for the next KBUS cycle. Staged bytes overwrite the
+ * Modbus output registers at the same offset, so the following KBUS cycles
+ * and Modbus masters see them.
+ * @param[in] image Process image
+ * @param[in] offset First byte in the output image
+ * @param[in] src Output data
+ * @param[in] len Number of bytes
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+static inline int kbusImageClient_stageOutput(kbusImage_shm_t *image, size_t offset, const void *src, size_t len)
+{
+    uint32_t pid = (uint32_t)getpid();
+    uint32_t owner;
+    size_t i;
+
+    if ((offset >= KBUSIMAGE_SIZE) || (len == 0) || (len > (KBUSIMAGE_SIZE - offset)))
+    {
+        return -1;
+    }
+
+    for (;;)
+    {
+        owner = 0;
+        if (__atomic_compare_exchange_n(&image->stage_lock, &owner, pid, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+        //Take over the lock of a client which died while staging
+        if ((kill((pid_t)owner, 0) == -1) && (errno == ESRCH))
+        {
+            __atomic_compare_exchange_n(&image->stage_lock, &owner, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+        sched_yield();
+    }
+
+    memcpy(&image->stage[offset], src, len);
+    for (i = offset; i < (offset + len); i++)
+    {
+        image->stage_dirty[i / 8] |= (uint8_t)(1U << (i % 8));
+    }
+    if ((image->stage_end == 0) || (offset < image->stage_begin))
+    {
+        image->stage_begin = offset;
+    }
+    if ((offset + len) > image->stage_end)
+    {
+        image->stage_end = offset + len;
+    }
+
+    __atomic_store_n(&image->stage_lock, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#endif /* __KBUS_IMAGE_CLIENT_H__ */
@@ -25,6 +25,7 @@
 
 #include "kbus.h"
 #include "modbus.h"
+#include "modbus_stats.h"
 #include "utils.h"
 #include "conffile_reader.h"
 #include "oms_led.h"
@@ -110,6 +111,9 @@ void signal_handler(int sig)
 
 int main_startUpModules(void)
 {
+    //Reset throughput counters
+    modbusStats_init();
+
     //Start Modbus-Thread
     if (modbus_start() < 0)
     {
@@ -139,6 +143,7 @@ void main_shutdownModules(void)
     oms_led_stop();
     kbus_stop();
     modbus_stop();
+    modbusStats_deInit();
 }
 
 /**
@@ -218,6 +223,7 @@ int main(int argc, char *argv[])
     {
         //sleep 1000ms
         usleep(1000*1000);
+        modbusStats_write();
     }
 
     main_shutdownModules();
@@ -34,6 +34,13 @@
 #include "modbus_const.h"
 #include "modbus_reply.h"
 #include "modbus_shortDescription.h"
+#include "modbus_subscribe.h"
+#include "modbus_deadband.h"
+#include "modbus_channel.h"
+#include "modbus_map.h"
+#include "modbus_tcp.h"
+#include "modbus_udp.h"
+#include "modbus_stats.h"
 #include "kbus.h"
 #include "utils.h"
 #include "conffile_reader.h"
@@ -52,6 +59,7 @@ static modbus_mapping_t *mb_digital_2_in;    /**< @brief Modbus coil storage - A
 static modbus_mapping_t *mb_digital_2_write; /**< @brief Modbus coil storage - Area 2*/
 
 static pthread_mutex_t write_mapping_mutex=PTHREAD_MUTEX_INITIALIZER; /**< @brief Mutex for write mapping*/
+static pthread_mutex_t worker_write_mutex=PTHREAD_MUTEX_INITIALIZER;  /**< @brief Serializes write requests of all modbus threads*/
 
 static unsigned char modbus_initialized = FALSE; /**< @brief Flag for modbus initialized ready*/
 static void (*modbus_receivedCallback)() = NULL; /**< @brief Callback after message is received*/
@@ -69,6 +77,25 @@ static uint8_t modbus_ApplicationState;
 #define MODBUS_BIT_1_COUNT 512  /**< @brief Maximum modbus bits for single coil input*/
 #define MODBUS_BIT_2_COUNT 1528 /**< @brief Maximum modbus bits for single coil input 2*/
 
+#define MODBUS_SHADOW_GENERATIONS 3 /**< @brief Shadows of the input areas, a pinned one is never overwritten */
+
+/**
+ * @brief Input areas of one KBUS cycle in network byte order
+ */
+typedef struct
+{
+    uint8_t in[MODBUS_INREGISTER_COUNT * sizeof(uint16_t)];     /**< @brief Input area 1 */
+    uint8_t in_2[MODBUS_INREGISTER_2_COUNT * sizeof(uint16_t)]; /**< @brief Input area 2 */
+    int users;                                                  /**< @brief Replies reading this generation */
+} modbus_shadow_t;
+
+static modbus_shadow_t modbus_shadows[MODBUS_SHADOW_GENERATIONS];
+static int modbus_shadowCurrent = 0;   /**< @brief Generation of the last KBUS cycle */
+static pthread_mutex_t modbus_shadow_mutex = PTHREAD_MUTEX_INITIALIZER; /**< @brief Serializes the publishers of generations */
+
+#define MODBUS_TCP_POLL_TIMEOUT_MS 1000 /**< @brief Maximum wait time for TCP events, checks modbus_running afterwards */
+#define MODBUS_UDP_POLL_TIMEOUT_MS 1000 /**< @brief Maximum wait time for UDP requests, checks modbus_running afterwards */
+
 /**
  * @brief Map write coils to register/process data.
  * It will directy modify the mb_mapping_write.
@@ -139,6 +166,43 @@ static void modbus_clearMapping(modbus_mapping_t *mapping)
     }
 }
 
+/**
+ * @brief Swap the input areas into a generation of the shadow which is not
+ * read by any reply and make it the current one. If all other generations
+ * are still pinned, the current generation is kept for this cycle.
+ */
+static void modbus_publishShadow(void)
+{
+    modbus_shadow_t *shadow;
+    int current;
+    int next = 0;
+    int i;
+
+    if ((mb_mapping_in == NULL) || (mb_mapping_2_in == NULL))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&modbus_shadow_mutex);
+    current = __atomic_load_n(&modbus_shadowCurrent, __ATOMIC_RELAXED);
+    for (i = 1; i < MODBUS_SHADOW_GENERATIONS; i++)
+    {
+        next = (current + i) % MODBUS_SHADOW_GENERATIONS;
+        if (__atomic_load_n(&modbus_shadows[next].users, __ATOMIC_SEQ_CST) == 0)
+        {
+            break;
+        }
+    }
+    if (i < MODBUS_SHADOW_GENERATIONS)
+    {
+        shadow = &modbus_shadows[next];
+        utils_copyWordsBE(shadow->in, mb_mapping_in->tab_registers, MODBUS_INREGISTER_COUNT);
+        utils_copyWordsBE(shadow->in_2, mb_mapping_2_in->tab_registers, MODBUS_INREGISTER_2_COUNT);
+        __atomic_store_n(&modbus_shadowCurrent, next, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&modbus_shadow_mutex);
+}
+
 /**
  * @brief Clear all modbus register.
  */
@@ -155,6 +219,7 @@ void modbus_clearAllMappings(void)
     modbus_clearMapping(mb_mapping_2_in);
     modbus_clearMapping(mb_digital_1_in);
     modbus_clearMapping(mb_digital_2_in);
+    modbus_publishShadow();
 }
 
 /**
@@ -173,189 +238,347 @@ static void modbusWatchdog_expiredTask(void)
     }
 }
 
-static void modbus_worker_read(modbus_t *ctx, uint8_t *query, int rc)
+/**
+ * @brief Answer a single write to an unmapped address with
+ * modbus_hole_policy 1. The value is discarded, the request is echoed.
+ * @param[in] ctx - Modbus environment
+ * @param[in] query - Modbus message
+ * @param[in] rc - Modbus message length
+ * @param[in] address - Address of the write
+ */
+static void modbus_discardWrite(modbus_t *ctx, uint8_t *query, int rc, uint16_t address)
+{
+    uint16_t scratch = 0;
+    modbus_mapping_t mapping;
+
+    //The reply checks and writes the value as usual, but into a scratch mapping
+    memset(&mapping, 0, sizeof(mapping));
+    mapping.tab_bits = &scratch;
+    mapping.nb_bits = 1;
+    mapping.tab_registers = &scratch;
+    mapping.nb_registers = 1;
+    modbus_reply_offset(ctx, query, rc, &mapping, address);
+}
+
+/**
+ * @brief Dispatch a request to the region serving its start address
+ * @param[in] ctx - Modbus environment
+ * @param[in] query - Modbus message
+ * @param[in] rc - Modbus message length
+ * @param[in] space - Address space of the function code
+ * @param[in] access - MODBUSMAP_ACCESS_READ or MODBUSMAP_ACCESS_WRITE
+ */
+static void modbus_dispatch(modbus_t *ctx, uint8_t *query, int rc, modbusMap_space_t space, uint8_t access)
 {
-    //calculate the address to switch between mappings
     int offset = modbus_get_header_length(ctx);
+    uint16_t address = (query[offset + 1] << 8) + query[offset + 2];
+    const modbusMap_region_t *region = modbusMap_lookup(space, address);
     int function = query[offset];
+    char gather = FALSE;
+    uint32_t last = address;
+
     dprintf(VERBOSE_INFO, "Function :%d\n", function);
-    uint16_t address = (query[offset + 1] << 8) + query[offset + 2];
+    //Only these function codes are assembled from several regions
+    switch (function)
+    {
+        case _FC_READ_COILS:
+        case _FC_READ_DISCRETE_INPUTS:
+        case _FC_READ_HOLDING_REGISTERS:
+        case _FC_READ_INPUT_REGISTERS:
+        case _FC_WRITE_MULTIPLE_COILS:
+        case _FC_WRITE_MULTIPLE_REGISTERS:
+            last += ((query[offset + 3] << 8) + query[offset + 4]) - 1;
+            gather = TRUE;
+            break;
+    }
+
+    //Requests leaving their region are assembled from all regions they span
+    if (gather && ((region->access == 0) ? (conf_modbus_hole_policy == CONF_HOLE_POLICY_ZERO) :
+                   (((region->access & access) != 0) && (last > region->last))))
+    {
+        modbus_reply_gather(ctx, query, rc, space);
+    }
+    else if ((region->access == 0) && (conf_modbus_hole_policy == CONF_HOLE_POLICY_ZERO) &&
+             ((function == _FC_WRITE_SINGLE_COIL) || (function == _FC_WRITE_SINGLE_REGISTER)))
+    {
+        modbus_discardWrite(ctx, query, rc, address);
+    }
+    else if ((region->access & access) == 0)
+    {
+        modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS );
+    }
+    else if (region->handler != NULL)
+    {
+        dprintf(VERBOSE_DEBUG, "Config Dataset\n");
+        region->handler(ctx, query, rc);
+    }
+    else if (access == MODBUSMAP_ACCESS_WRITE)
+    {
+        modbus_reply_offset(ctx, query, rc, region->write_mapping, region->base);
+    }
+    else
+    {
+        modbus_reply_offset(ctx, query, rc, region->read_mapping, region->base);
+    }
+}
+
+static void modbus_worker_read(modbus_t *ctx, uint8_t *query, int rc)
+{
+    int offset = modbus_get_header_length(ctx);
+    int function = query[offset];
 
     switch (function)
     {
         case _FC_READ_COILS:
             modbus_mapReadCoils();
-            //Read digital inputs
-            if (address <=511)
-            {
-                modbus_reply(ctx, query, rc, mb_digital_1_in);
-            }
-            //Read digital outputs
-            else if ((address >= 512) && (address <=1023))
-            {
-                modbus_reply_offset(ctx, query, rc, mb_digital_1_write, 512);
-            }
-            else if ((address >=0x8000) && (address <= 0x85F7)) //Digital Input-Area 2 (Bit 513 - 2039)
-            {
-                modbus_reply_offset(ctx, query, rc, mb_digital_2_in, 0x8000);
-            }
-            else if ((address >=0x9000) && (address <= 0x95F7)) //Digital Output-Area 2 (Bit 513 - 2093)
-            {
-                modbus_reply_offset(ctx, query, rc, mb_digital_2_write, 0x9000);
-            }
-            else
-            {
-                modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS );
-            }
+            modbus_dispatch(ctx, query, rc, MODBUSMAP_COILS, MODBUSMAP_ACCESS_READ);
             break;
         case _FC_READ_DISCRETE_INPUTS:
         case _FC_READ_HOLDING_REGISTERS:
         case _FC_READ_INPUT_REGISTERS:
-        case _FC_WRITE_AND_READ_REGISTERS:
-            //Address check
-            if (address <= 255)
-            {
-                //rc is the query size
-                modbus_reply(ctx, query, rc, mb_mapping_in);
-            }
-            else if ((address >= 512) && (address <= 767))
-            {
-                modbus_reply_offset(ctx, query, rc, mb_mapping_write, 512);
-            }
-            // Handle configuration registers
-            else if ((address >=0x1000) && (address <=0x2043))
-            {
-                dprintf(VERBOSE_DEBUG, "Config Dataset\n");
-                //Watchdog
-                if ((address >= 0x1000) && (address <=0x100B))
-                {
-                    modbusWatchdog_parseModbusCommand(ctx, query, rc);
-                }
-                //Processdata-Information
-                else if ((address >= 0x1022) && (address <=0x1025))
-                {
-                    modbusKBUSInfo_parseModbusCommand(ctx, query, rc);
-                }
-                //MAC-Address
-                else if ((address >= 0x1031) && (address <= 0x1033))
-                {
-                    modbusConfigMac_parseModbusCommand(ctx, query, rc);
-                }
-                //Const
-                else if ((address >= 0x2000) && (address <= 0x2008))
-                {
-                    modbusConfigConst_parseModbusCommand(ctx, query, rc);
-                }
-                // TODO FW Information
-                //Short description
-                else if (address == 0x2020)
-                {
-                    modbusShortDescription_parseModbusCommand(ctx,query,rc);
-                }
-                //Knot-assembly 1-4
-                else if ((address >= 0x2030) && (address <= 0x2033))
-                {
-                    modbusConfig_parseModbusCommand(ctx, query, rc);
-                }
-                else
-                {
-                    modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS );
-                }
-            }
-            //In-Area 2
-            else if ((address >= 0x6000) && (address <= 0x62FB))
-            {
-                modbus_reply_offset(ctx, query, rc, mb_mapping_2_in, 0x6000);
-            }
-            else if  ((address >= 0x7000) && (address <= 0x72FB))
-            {
-                modbus_reply_offset(ctx, query, rc, mb_mapping_2_write, 0x7000);
-            }
-            else
-            {
-                modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS );
-            }
-
+        case _FC_READ_INPUT_REGISTERS_XL:
+            modbus_dispatch(ctx, query, rc, MODBUSMAP_REGISTERS, MODBUSMAP_ACCESS_READ);
+            break;
+        case _FC_READ_REGISTERS_SCATTER:
+            //Every range is resolved by the address map
+            modbus_reply_scatter(ctx, query, rc);
             break;
     }
 }
 
 static void modbus_worker_write(modbus_t *ctx, uint8_t *query, int rc)
 {
-    //calculate the address to switch between mappings
     int offset = modbus_get_header_length(ctx);
     int function = query[offset];
-    dprintf(VERBOSE_INFO, "Function :%d\n", function);
-    uint16_t address = (query[offset + 1] << 8) + query[offset + 2];
 
     switch (function)
     {
         case _FC_WRITE_SINGLE_COIL:
         case _FC_WRITE_MULTIPLE_COILS:
             modbus_mapReadCoils();
-            if (address <=511)//Output Area 1
-            {
-                modbus_reply(ctx, query, rc, mb_digital_1_write);
-            }
-            else if ((address >= 512) && (address <= 1023)) //Output Area 1-Mirror
-            {
-                modbus_reply_offset(ctx, query, rc, mb_digital_1_write, 512);
-            }
-            else if ((address >=0x8000) && (address <= 0x85F7)) //Digital Output-Area 2 (Bit 513 - 2039)
-            {
-                modbus_reply_offset(ctx, query, rc, mb_digital_2_write, 0x8000);
-            }
-            else if ((address >=0x9000) && (address <= 0x95F7)) //Digital Output-Area 2 (Bit 513 - 2093) - Mirror
-            {
-                modbus_reply_offset(ctx, query, rc, mb_digital_2_write, 0x9000);
-            }
-            else
-            {
-                modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS );
-            }
+            modbus_dispatch(ctx, query, rc, MODBUSMAP_COILS, MODBUSMAP_ACCESS_WRITE);
             //Map Coilbits to Register.
             modbus_mapWriteCoilsToRegister();
             break;
 
         case _FC_WRITE_SINGLE_REGISTER:
         case _FC_WRITE_MULTIPLE_REGISTERS:
+        case _FC_WRITE_MULTIPLE_REGISTERS_XL:
         case _FC_WRITE_AND_READ_REGISTERS:
-            if (address <=255)
-            {
-                modbus_reply_offset(ctx, query, rc, mb_mapping_write, 0);
-            }
-            else if ((address >=512) && (address <=767))
-            {
-                modbus_reply_offset(ctx, query, rc, mb_mapping_write, 512);
-            }
-            //Configuration
-            else if ((address >=0x1000) && (address <=0x2043))
-            {
-                //Watchdog
-                if ((address >= 0x1000) && (address <=0x100B))
-                {
-                    modbusWatchdog_parseModbusCommand(ctx, query, rc);
-                }
-            }
-            //In-Area 2
-            else if ((address >= 0x6000) && (address <= 0x62FB))
+            //FC23 is dispatched by its read address
+            modbus_dispatch(ctx, query, rc, MODBUSMAP_REGISTERS, MODBUSMAP_ACCESS_WRITE);
+            break;
+    }
+}
+
+/**
+ * @brief Add a region of the register map given in the configuration file
+ * @param[in] entry Entry modbus_map_region
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+static int modbus_addConfiguredRegion(const conf_map_region_t *entry)
+{
+    const struct
+    {
+        char coils;                     /**< @brief Storage belongs to the bit address space */
+        modbus_mapping_t *read_mapping; /**< @brief Storage read by requests */
+        modbus_mapping_t *write_mapping;/**< @brief Storage written by requests */
+        int size;                       /**< @brief Number of registers or bits of the mappings */
+        void (*handler)(modbus_t *ctx, uint8_t *query, int rc); /**< @brief Parser of configuration registers */
+        uint16_t first;                 /**< @brief First address of configuration registers */
+        uint16_t last;                  /**< @brief Last address of configuration registers */
+    } storages[CONF_MAP_STORAGE_COUNT] =
+    {
+        [CONF_MAP_STORAGE_IN1]   = { FALSE, mb_mapping_in, mb_mapping_write, MODBUS_INREGISTER_COUNT, NULL, 0, 0 },
+        [CONF_MAP_STORAGE_OUT1]  = { FALSE, mb_mapping_write, mb_mapping_write, MODBUS_OUTREGISTER_COUNT, NULL, 0, 0 },
+        [CONF_MAP_STORAGE_IN2]   = { FALSE, mb_mapping_2_in, mb_mapping_2_write, MODBUS_INREGISTER_2_COUNT, NULL, 0, 0 },
+        [CONF_MAP_STORAGE_OUT2]  = { FALSE, mb_mapping_2_write, mb_mapping_2_write, MODBUS_OUTREGISTER_2_COUNT, NULL, 0, 0 },
+        [CONF_MAP_STORAGE_DIN1]  = { TRUE, mb_digital_1_in, mb_digital_1_write, MODBUS_BIT_1_COUNT, NULL, 0, 0 },
+        [CONF_MAP_STORAGE_DOUT1] = { TRUE, mb_digital_1_write, mb_digital_1_write, MODBUS_BIT_1_COUNT, NULL, 0, 0 },
+        [CONF_MAP_STORAGE_DIN2]  = { TRUE, mb_digital_2_in, mb_digital_2_write, MODBUS_BIT_2_COUNT, NULL, 0, 0 },
+        [CONF_MAP_STORAGE_DOUT2] = { TRUE, mb_digital_2_write, mb_digital_2_write, MODBUS_BIT_2_COUNT, NULL, 0, 0 },
+        [CONF_MAP_STORAGE_WATCHDOG]  = { FALSE, NULL, NULL, 0, modbusWatchdog_parseModbusCommand, 0x1000, 0x100B },
+        [CONF_MAP_STORAGE_KBUSINFO]  = { FALSE, NULL, NULL, 0, modbusKBUSInfo_parseModbusCommand, 0x1022, 0x1025 },
+        [CONF_MAP_STORAGE_MAC]       = { FALSE, NULL, NULL, 0, modbusConfigMac_parseModbusCommand, 0x1031, 0x1033 },
+        [CONF_MAP_STORAGE_SUBSCRIBE] = { FALSE, NULL, NULL, 0, modbusSubscribe_parseModbusCommand,
+                                         MODBUSSUBSCRIBE_REGISTER_START_ADDRESS, MODBUSSUBSCRIBE_REGISTER_END_ADDRESS },
+        [CONF_MAP_STORAGE_DEADBAND]  = { FALSE, NULL, NULL, 0, modbusDeadband_parseModbusCommand,
+                                         MODBUSDEADBAND_REGISTER_START_ADDRESS, MODBUSDEADBAND_REGISTER_END_ADDRESS },
+        [CONF_MAP_STORAGE_CONST]     = { FALSE, NULL, NULL, 0, modbusConfigConst_parseModbusCommand, 0x2000, 0x2008 },
+        [CONF_MAP_STORAGE_SHORTDESCRIPTION] = { FALSE, NULL, NULL, 0, modbusShortDescription_parseModbusCommand, 0x2020, 0x2020 },
+        [CONF_MAP_STORAGE_CONFIG]    = { FALSE, NULL, NULL, 0, modbusConfig_parseModbusCommand, 0x2030, 0x2033 },
+    };
+    modbusMap_region_t region;
+
+    if (entry->coils != storages[entry->storage].coils)
+    {
+        fprintf(stderr, "Modbus map: storage of region 0x%04X-0x%04X belongs to the %s address space\n",
+                entry->first, entry->last, storages[entry->storage].coils ? "coil" : "register");
+        return -1;
+    }
+
+    region.first = entry->first;
+    region.last = entry->last;
+    region.access = ((entry->access & CONF_MAP_ACCESS_READ) ? MODBUSMAP_ACCESS_READ : 0) |
+                    ((entry->access & CONF_MAP_ACCESS_WRITE) ? MODBUSMAP_ACCESS_WRITE : 0);
+    region.handler = storages[entry->storage].handler;
+    region.read_mapping = storages[entry->storage].read_mapping;
+    region.write_mapping = storages[entry->storage].write_mapping;
+    if (region.handler != NULL)
+    {
+        //Configuration registers are parsed at their own addresses
+        if ((entry->first < storages[entry->storage].first) || (entry->last > storages[entry->storage].last) ||
+            (entry->offset != 0))
+        {
+            fprintf(stderr, "Modbus map: configuration registers 0x%04X-0x%04X can't be moved\n",
+                    storages[entry->storage].first, storages[entry->storage].last);
+            return -1;
+        }
+        region.lane = MODBUS_LANE_PRIORITY;
+        region.base = 0;
+    }
+    else
+    {
+        if ((entry->offset + (entry->last - entry->first + 1)) > storages[entry->storage].size)
+        {
+            fprintf(stderr, "Modbus map: region 0x%04X-0x%04X exceeds its storage of %d entries\n",
+                    entry->first, entry->last, storages[entry->storage].size);
+            return -1;
+        }
+        region.lane = MODBUS_LANE_PROCESS;
+        //Wraps around if the region starts below its entry of the storage
+        region.base = entry->first - entry->offset;
+    }
+
+    return modbusMap_add(entry->coils ? MODBUSMAP_COILS : MODBUSMAP_REGISTERS, &region);
+}
+
+/**
+ * @brief Build the address map of the process data and configuration
+ * registers from the default layout and the regions of the configuration
+ * file. Called once at init after all mappings are allocated.
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+static int modbus_buildMap(void)
+{
+    const modbusMap_region_t registers[] =
+    {
+        //Process data area 1 and its output mirror
+        { 0x0000, 0x00FF, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE, MODBUS_LANE_PROCESS, NULL, mb_mapping_in, mb_mapping_write, 0x0000 },
+        { 0x0200, 0x02FF, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE, MODBUS_LANE_PROCESS, NULL, mb_mapping_write, mb_mapping_write, 0x0200 },
+        //Watchdog
+        { 0x1000, 0x100B, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE, MODBUS_LANE_PRIORITY, modbusWatchdog_parseModbusCommand, NULL, NULL, 0 },
+        //Processdata-Information
+        { 0x1022, 0x1025, MODBUSMAP_ACCESS_READ, MODBUS_LANE_PRIORITY, modbusKBUSInfo_parseModbusCommand, NULL, NULL, 0 },
+        //MAC-Address
+        { 0x1031, 0x1033, MODBUSMAP_ACCESS_READ, MODBUS_LANE_PRIORITY, modbusConfigMac_parseModbusCommand, NULL, NULL, 0 },
+        //Change-of-state subscriptions
+        { MODBUSSUBSCRIBE_REGISTER_START_ADDRESS, MODBUSSUBSCRIBE_REGISTER_END_ADDRESS, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE,
+          MODBUS_LANE_PRIORITY, modbusSubscribe_parseModbusCommand, NULL, NULL, 0 },
+        //Deadbands of analog inputs
+        { MODBUSDEADBAND_REGISTER_START_ADDRESS, MODBUSDEADBAND_REGISTER_END_ADDRESS, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE,
+          MODBUS_LANE_PRIORITY, modbusDeadband_parseModbusCommand, NULL, NULL, 0 },
+        //Const
+        { 0x2000, 0x2008, MODBUSMAP_ACCESS_READ, MODBUS_LANE_PRIORITY, modbusConfigConst_parseModbusCommand, NULL, NULL, 0 },
+        // TODO FW Information
+        //Short description
+        { 0x2020, 0x2020, MODBUSMAP_ACCESS_READ, MODBUS_LANE_PRIORITY, modbusShortDescription_parseModbusCommand, NULL, NULL, 0 },
+        //Knot-assembly 1-4
+        { 0x2030, 0x2033, MODBUSMAP_ACCESS_READ, MODBUS_LANE_PRIORITY, modbusConfig_parseModbusCommand, NULL, NULL, 0 },
+        //Process data area 2 and its output mirror
+        { 0x6000, 0x62FB, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE, MODBUS_LANE_PROCESS, NULL, mb_mapping_2_in, mb_mapping_2_write, 0x6000 },
+        { 0x7000, 0x72FB, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE, MODBUS_LANE_PROCESS, NULL, mb_mapping_2_write, mb_mapping_2_write, 0x7000 },
+        //Channel view of the process data and its index
+        { MODBUSCHANNEL_VIEW_START_ADDRESS, MODBUSCHANNEL_VIEW_END_ADDRESS, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE,
+          MODBUS_LANE_PROCESS, modbusChannel_parseModbusCommand, NULL, NULL, 0 },
+        { MODBUSCHANNEL_INDEX_START_ADDRESS, MODBUSCHANNEL_INDEX_END_ADDRESS, MODBUSMAP_ACCESS_READ,
+          MODBUS_LANE_PRIORITY, modbusChannel_parseModbusCommand, NULL, NULL, 0 },
+    };
+    const modbusMap_region_t coils[] =
+    {
+        //Digital area 1 (Bit 0 - 511) and its output mirror
+        { 0x0000, 0x01FF, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE, MODBUS_LANE_PROCESS, NULL, mb_digital_1_in, mb_digital_1_write, 0x0000 },
+        { 0x0200, 0x03FF, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE, MODBUS_LANE_PROCESS, NULL, mb_digital_1_write, mb_digital_1_write, 0x0200 },
+        //Digital area 2 (Bit 513 - 2039) and its output mirror
+        { 0x8000, 0x85F7, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE, MODBUS_LANE_PROCESS, NULL, mb_digital_2_in, mb_digital_2_write, 0x8000 },
+        { 0x9000, 0x95F7, MODBUSMAP_ACCESS_READ | MODBUSMAP_ACCESS_WRITE, MODBUS_LANE_PROCESS, NULL, mb_digital_2_write, mb_digital_2_write, 0x9000 },
+    };
+    unsigned int i;
+
+    int n;
+
+    modbusMap_init();
+    if (conf_modbus_map_default)
+    {
+        for (i = 0; i < (sizeof(registers) / sizeof(registers[0])); i++)
+        {
+            if (modbusMap_add(MODBUSMAP_REGISTERS, &registers[i]) < 0)
             {
-                modbus_reply_offset(ctx, query, rc, mb_mapping_2_write, 0x6000);
+                return -1;
             }
-            else if ((address >= 0x7000) && (address <= 0x72FB))
+        }
+        for (i = 0; i < (sizeof(coils) / sizeof(coils[0])); i++)
+        {
+            if (modbusMap_add(MODBUSMAP_COILS, &coils[i]) < 0)
             {
-                modbus_reply_offset(ctx, query, rc, mb_mapping_2_write, 0x7000);
+                return -1;
             }
-            else
+        }
+    }
+    for (n = 0; n < conf_modbus_map_region_count; n++)
+    {
+        if (modbus_addConfiguredRegion(&conf_modbus_map_region[n]) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Classify a request on arrival, before it is queued by the
+ * transport. Watchdog and configuration requests are small and must not
+ * wait behind bulk process data requests, otherwise the watchdog may expire
+ * under load. The lane is given by the region of the address map.
+ * @param[in] pdu Function code and data of the request
+ * @param[in] length Length of the PDU
+ * @return Lane of the request
+ */
+int modbus_classify(const uint8_t *pdu, int length)
+{
+    uint16_t address;
+    int lane;
+
+    if (length < 3)
+    {
+        return MODBUS_LANE_PROCESS;
+    }
+    address = (pdu[1] << 8) + pdu[2];
+
+    switch (pdu[0])
+    {
+        case _FC_READ_HOLDING_REGISTERS:
+        case _FC_READ_INPUT_REGISTERS:
+        case _FC_WRITE_SINGLE_REGISTER:
+        case _FC_WRITE_MULTIPLE_REGISTERS:
+            return modbusMap_lookup(MODBUSMAP_REGISTERS, address)->lane;
+        case _FC_WRITE_AND_READ_REGISTERS:
+            //Write address follows read address and quantity
+            lane = modbusMap_lookup(MODBUSMAP_REGISTERS, address)->lane;
+            if ((lane == MODBUS_LANE_PROCESS) && (length >= 7))
             {
-                modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS );
+                lane = modbusMap_lookup(MODBUSMAP_REGISTERS, (pdu[5] << 8) + pdu[6])->lane;
             }
-            break;
+            return lane;
     }
+    return MODBUS_LANE_PROCESS;
 }
 
 /**
  * @brief Modbus worker for all incomming modbus messages.
+ * Called by the UDP thread and all TCP reactors, write requests are serialized.
  * @param[in] ctx - Modbus environment
  * @param[in] query - Modbus message
  * @param[in] rc - Modbus message length
@@ -367,6 +590,7 @@ static void modbus_worker(modbus_t *ctx, uint8_t *query, int rc)
     int function = query[offset];
     uint8_t function_found = FALSE;
 
+    modbusStats_beginRequest(function);
     if (modbus_ApplicationState == APPLICATION_STOP)
     {
         modbus_reply_exception(ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY);
@@ -384,11 +608,16 @@ static void modbus_worker(modbus_t *ctx, uint8_t *query, int rc)
         case _FC_WRITE_MULTIPLE_COILS:
         case _FC_WRITE_SINGLE_REGISTER:
         case _FC_WRITE_MULTIPLE_REGISTERS:
+        case _FC_WRITE_MULTIPLE_REGISTERS_XL:
+            pthread_mutex_lock(&worker_write_mutex);
             modbus_worker_write(ctx, query, rc);
+            pthread_mutex_unlock(&worker_write_mutex);
             function_found = TRUE;
             break;
         case _FC_WRITE_AND_READ_REGISTERS:
+            pthread_mutex_lock(&worker_write_mutex);
             modbus_worker_write(ctx, query, rc);
+            pthread_mutex_unlock(&worker_write_mutex);
             //All done we can go back!
             return;
             break;
@@ -403,6 +632,8 @@ static void modbus_worker(modbus_t *ctx, uint8_t *query, int rc)
         case _FC_READ_DISCRETE_INPUTS:
         case _FC_READ_HOLDING_REGISTERS:
         case _FC_READ_INPUT_REGISTERS:
+        case _FC_READ_INPUT_REGISTERS_XL:
+        case _FC_READ_REGISTERS_SCATTER:
             modbus_worker_read(ctx, query, rc);
             function_found = TRUE;
             break;
@@ -414,44 +645,29 @@ static void modbus_worker(modbus_t *ctx, uint8_t *query, int rc)
     }
 }
 
+/**
+ * @brief Modbus UDP thread task
+ */
 static void *modbus_udp_task(void *none)
 {
     none=none; //-Wunused-parameter
-    modbus_t *ctx_udp=NULL;
 
-    ctx_udp = modbus_new_udp("127.0.0.1", conf_modbus_port);
-    int udp_socket = modbus_udp_bind(ctx_udp);
-    uint8_t udp_query[MODBUS_TCP_MAX_ADU_LENGTH];
-
-    if (ctx_udp == NULL) 
+    if (modbusUdp_init(modbus_worker, modbus_classify) < 0)
     {
-        fprintf(stderr, "Unable to allocate libmodbus UDP context\n");
+        dprintf(VERBOSE_STD, "ModbusUdp: Init failed\n");
+        modbusUdp_deInit();
         return NULL;
     }
 
-    struct pollfd fds[] = {{udp_socket, POLLIN, 0}};
-
     while (modbus_running)
     {
-        if (poll(fds, 1, 1000) == 0)
-        {
-            //dprintf(VERBOSE_STD, "TIMEOUT UDP\n");
-        }
-        else
+        if (modbusUdp_poll(MODBUS_UDP_POLL_TIMEOUT_MS) < 0)
         {
-            if (fds[0].revents & POLLIN)
-            {
-                int rc = modbus_receive(ctx_udp, udp_query, sizeof(udp_query));
-                if (rc >= 0)
-                {
-                    modbus_worker(ctx_udp, udp_query, rc);
-                }
-            }
+            continue;
         }
     }
 
-    modbus_close(ctx_udp);
-    modbus_free(ctx_udp);
+    modbusUdp_deInit();
     return NULL;
 }
 
@@ -461,16 +677,6 @@ static void *modbus_udp_task(void *none)
 static void *modbus_task(void *none)
 {
     none=none; //-Wunused-parameter
-    int master_socket;
-    int server_socket=0;
-    int rc;
-    int fdmax=0; //Maximum file descriptor number
-    fd_set refset;
-    fd_set rdset;
-    modbus_t *ctx;
-
-    struct timeval modbus_select_timeout;
-    uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
 
     //----- Wait for kbus to be initialized -----
     dprintf(VERBOSE_DEBUG, "Modbus: Wait for KBUS to be initialized\n");
@@ -545,26 +751,9 @@ static void *modbus_task(void *none)
     }
     //-------------------------------------------
 
-    //Initialize TCP-Modbus-Connection:
-    ctx = modbus_new_tcp("127.0.0.1", conf_modbus_port);
-
-    server_socket = modbus_tcp_listen(ctx, conf_max_tcp_connections);
-    //Clear the reference set of socket
-    FD_ZERO(&refset);
-    //Add the server socket
-    FD_SET(server_socket, &refset);
-
-    //Keep track of the max file descriptor
-    fdmax=server_socket;
-
-    if (ctx == NULL) 
-    {
-        fprintf(stderr, "Unable to allocate libmodbus context\n");
-        return NULL;
-    }
-
-    //Set Modbus response delay
-    modbus_set_response_delay(conf_modbus_delay_ms);
+    //Modbus response delay is applied by the TCP and UDP servers without
+    //blocking, libmodbus must not sleep in addition
+    modbus_set_response_delay(0);
 
     if (modbusWatchdog_init(modbusWatchdog_expiredTask) < 0)
     {
@@ -602,6 +791,30 @@ static void *modbus_task(void *none)
         return NULL;
     }
 
+    if (modbusSubscribe_init() < 0)
+    {
+        dprintf(VERBOSE_STD, "ModbusSubscribe: Init failed\n");
+        return NULL;
+    }
+
+    if (modbusDeadband_init() < 0)
+    {
+        dprintf(VERBOSE_STD, "ModbusDeadband: Init failed\n");
+        return NULL;
+    }
+
+    if (modbus_buildMap() < 0)
+    {
+        dprintf(VERBOSE_STD, "ModbusMap: Init failed\n");
+        return NULL;
+    }
+
+    if (modbusTcp_init(modbus_worker, modbus_classify) < 0)
+    {
+        dprintf(VERBOSE_STD, "ModbusTcp: Init failed\n");
+        return NULL;
+    }
+
     modbus_initialized = TRUE;
     dprintf(VERBOSE_STD, "Modbus-Init complete - Ready for take off\n");
     //--- Start Modbus-UDP Thread
@@ -610,79 +823,17 @@ static void *modbus_task(void *none)
         return NULL;
     }
     //--- Modbus-TCP Thread
+    //Pinned after all threads are created, they must not inherit the CPU
+    if ((conf_modbus_latency_profile == CONF_LATENCY_PROFILE_LOW) && (conf_modbus_cpu >= 0))
+    {
+        utils_setCpuAffinity(conf_modbus_cpu);
+    }
     while (modbus_running)
     {
-        rdset = refset;
-        //Reset Timeout
-        //select() may update the timeout argument to  indicate  how  much
-        //time was left.
-        modbus_select_timeout.tv_sec = 1;         /* seconds */
-        modbus_select_timeout.tv_usec = 0;        /* microseconds */
-        if (select(fdmax+1, &rdset, NULL, NULL, &modbus_select_timeout) == -1)
+        if (modbusTcp_poll(MODBUS_TCP_POLL_TIMEOUT_MS) < 0)
         {
-            fprintf(stderr, "Server select() failure.\n");
             continue;
         }
-
-        //Run through the existing connections looking for data to be read
-        for (master_socket = 0; master_socket <= fdmax; master_socket++)
-        {
-            if (FD_ISSET(master_socket, &rdset))
-            {
-                //A client is asking a new connection
-                if (master_socket == server_socket)
-                {
-                    socklen_t addrlen;
-                    struct sockaddr_in clientaddr;
-                    int newfd;
-
-                    //Handle new connection
-                    addrlen = sizeof(clientaddr);
-                    memset(&clientaddr, 0, sizeof(clientaddr));
-                    newfd = accept(server_socket, (struct sockaddr *) &clientaddr, &addrlen);
-                    if (newfd == -1)
-                    {
-                        fprintf(stderr, "Server accept error\n");
-                    }
-                    else
-                    {
-                        FD_SET(newfd, &refset);
-                        if (newfd > fdmax)
-                        {
-                            // Keep track of the maximum file descriptor
-                            fdmax = newfd;
-                        }
-                        dprintf(VERBOSE_STD, "New Modbus connection from %s:%d on socket %d\n", inet_ntoa(clientaddr.sin_addr), clientaddr.sin_port, newfd);
-                    }
-                }
-                else //An already connected master has sent a new query
-                {
-                    modbus_set_socket(ctx, master_socket);
-                    //API-Change made by WAGO:
-                    //int modbus_receive(modbus_t *ctx, uint8_t *req, size_t max_size)
-                    //origin:
-                    //int modbus_receive(modbus_t *ctx, uint8_t *req)
-                    rc = modbus_receive(ctx, query, sizeof(query));
-                    if (rc != -1)
-                    {
-                        modbus_worker(ctx, query, rc);
-                    }
-                    else
-                    {
-                        //Connection closed by the client, end of server
-                        dprintf(VERBOSE_STD, "Connection closed on socket %d\n", master_socket);
-                        close(master_socket);
-                        //Remove from reference set
-                        FD_CLR(master_socket, &refset);
-
-                        if (master_socket == fdmax)
-                        {
-                            fdmax--;
-                        }
-                    }
-                }
-            }
-        }
     }
 
     dprintf(VERBOSE_STD, "Modbus loop exit\n");
@@ -696,8 +847,7 @@ static void *modbus_task(void *none)
     modbus_mapping_free(mb_digital_2_in);
     modbus_mapping_free(mb_digital_2_write);
 
-    modbus_close(ctx);
-    modbus_free(ctx);
+    modbusTcp_deInit();
     return NULL;
 }
 
@@ -710,6 +860,7 @@ int modbus_start(void)
 {
     modbus_running = 1;
     pthread_mutex_init(&write_mapping_mutex, NULL);
+    pthread_mutex_init(&worker_write_mutex, NULL);
     if (pthread_create(&modbus_thread, NULL, &modbus_task, NULL) != 0)
     {
         return -1;
@@ -733,7 +884,10 @@ void modbus_stop(void)
     modbusKBUSInfo_deInit();
     modbusConfigConst_deInit();
     modbusShortDescription_deInit();
+    modbusSubscribe_deInit();
+    modbusDeadband_deInit();
     pthread_mutex_destroy(&write_mapping_mutex);
+    pthread_mutex_destroy(&worker_write_mutex);
 }
 
 /**
@@ -770,10 +924,12 @@ int modbus_copy_register_in(uint16_t *source, size_t n)
 
     if ( secondRegisterBytes > 0 )
     {
-        //calculate source offset for new starting point
-        source += (MODBUS_OUTREGISTER_COUNT * sizeof(uint16_t));
+        //calculate source offset for new starting point, source counts words
+        source += MODBUS_OUTREGISTER_COUNT;
         memcpy(mb_mapping_2_in->tab_registers, source, secondRegisterBytes * sizeof(uint16_t));
     }
+    //Swap once per cycle instead of once per read request
+    modbus_publishShadow();
 
     return n;
 }
@@ -824,6 +980,274 @@ int modbus_copy_register_out(uint8_t *dest, size_t n)
     return n;
 }
 
+/**
+ * @brief Access a byte range of an image stored in two mappings, the
+ * registers of the second one follow the registers of the first one, so
+ * byte 512 of the image is the first byte of the second mapping
+ * @param[in,out] *data bytes read or written
+ * @param[in] first mapping holding the first MODBUS_OUTREGISTER_COUNT registers
+ * @param[in] second mapping holding the following registers
+ * @param[in] offset first byte in the image
+ * @param[in] n number of bytes
+ * @param[in] write TRUE to write data to the image, FALSE to read it
+ */
+static void modbus_accessImage(uint8_t *data, modbus_mapping_t *first, modbus_mapping_t *second,
+                               size_t offset, size_t n, int write)
+{
+    size_t firstRegisterBytes = MODBUS_OUTREGISTER_COUNT * sizeof(uint16_t);
+    size_t firstBytes = 0;
+    uint8_t *image;
+
+    if (offset < firstRegisterBytes)
+    {
+        firstBytes = ((offset + n) > firstRegisterBytes) ? (firstRegisterBytes - offset) : n;
+    }
+    if (firstBytes > 0)
+    {
+        image = (uint8_t *)first->tab_registers + offset;
+        memcpy(write ? image : data, write ? data : image, firstBytes);
+    }
+    if (n > firstBytes)
+    {
+        //calculate the offset in the second register area
+        image = (uint8_t *)second->tab_registers + (offset + firstBytes - firstRegisterBytes);
+        memcpy(write ? image : data + firstBytes, write ? data + firstBytes : image, n - firstBytes);
+    }
+}
+
+/**
+ * @brief Write data to the modbus output registers
+ * @param[in] *source pointer to the source
+ * @param[in] offset first byte in the output registers, same layout as the
+ * destination of modbus_copy_register_out()
+ * @param[in] n number of bytes to be copied from source
+ * @return number of bytes copied from source
+ */
+int modbus_write_register_out(const uint8_t *source, size_t offset, size_t n)
+{
+    size_t totalModbusBytes = (MODBUS_OUTREGISTER_COUNT + MODBUS_OUTREGISTER_2_COUNT) * sizeof(uint16_t);
+
+    if (source == NULL)
+    {
+        return -1;
+    }
+
+    if ((offset >= totalModbusBytes) || (n > (totalModbusBytes - offset)))
+    {
+        return -2;
+    }
+
+    if (modbus_initialized == FALSE)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock( &write_mapping_mutex );
+        modbus_accessImage((uint8_t *)source, mb_mapping_write, mb_mapping_2_write, offset, n, TRUE);
+    pthread_mutex_unlock( &write_mapping_mutex );
+    return n;
+}
+
+/**
+ * @brief Write a bit field of the modbus output registers, the other bits of
+ * the touched bytes are kept
+ * @param[in] value value of the bit field, higher bits are ignored
+ * @param[in] bit_offset first bit in the output registers, same layout as the
+ * destination of modbus_copy_register_out()
+ * @param[in] bits width of the bit field, 1 to 16
+ * @return number of bits written
+ */
+int modbus_write_register_out_bits(uint16_t value, size_t bit_offset, size_t bits)
+{
+    size_t totalModbusBytes = (MODBUS_OUTREGISTER_COUNT + MODBUS_OUTREGISTER_2_COUNT) * sizeof(uint16_t);
+    size_t offset = bit_offset / 8;
+    size_t n = ((bit_offset % 8) + bits + 7) / 8;
+    uint32_t mask = ((1u << bits) - 1) << (bit_offset % 8);
+    uint8_t bytes[sizeof(uint32_t)] = { 0 };
+    uint32_t field;
+    size_t i;
+
+    if ((bits < 1) || (bits > 16))
+    {
+        return -1;
+    }
+
+    if ((offset >= totalModbusBytes) || (n > (totalModbusBytes - offset)))
+    {
+        return -2;
+    }
+
+    if (modbus_initialized == FALSE)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock( &write_mapping_mutex );
+        modbus_accessImage(bytes, mb_mapping_write, mb_mapping_2_write, offset, n, FALSE);
+        field = 0;
+        for (i = 0; i < n; i++)
+        {
+            field |= (uint32_t)bytes[i] << (8 * i);
+        }
+        field = (field & ~mask) | (((uint32_t)value << (bit_offset % 8)) & mask);
+        for (i = 0; i < n; i++)
+        {
+            bytes[i] = field >> (8 * i);
+        }
+        modbus_accessImage(bytes, mb_mapping_write, mb_mapping_2_write, offset, n, TRUE);
+    pthread_mutex_unlock( &write_mapping_mutex );
+    return bits;
+}
+
+/**
+ * @brief Read data of the modbus input registers
+ * @param[out] *dest pointer to the destination
+ * @param[in] offset first byte in the input registers, same layout as the
+ * source of modbus_copy_register_in(): the KBUS input image, area 2 starts
+ * at byte 512 and is served at 0x6000
+ * @param[in] n number of bytes to be copied to dest
+ * @return number of bytes copied to dest
+ */
+int modbus_read_register_in(uint8_t *dest, size_t offset, size_t n)
+{
+    size_t totalModbusBytes = (MODBUS_INREGISTER_COUNT + MODBUS_INREGISTER_2_COUNT) * sizeof(uint16_t);
+
+    if (dest == NULL)
+    {
+        return -1;
+    }
+
+    if ((offset >= totalModbusBytes) || (n > (totalModbusBytes - offset)))
+    {
+        return -2;
+    }
+
+    if (modbus_initialized == FALSE)
+    {
+        memset(dest, 0, n);
+        return 0;
+    }
+
+    modbus_accessImage(dest, mb_mapping_in, mb_mapping_2_in, offset, n, FALSE);
+    return n;
+}
+
+/**
+ * @brief Read data of the modbus output registers
+ * @param[out] *dest pointer to the destination
+ * @param[in] offset first byte in the output registers, same layout as the
+ * destination of modbus_copy_register_out()
+ * @param[in] n number of bytes to be copied to dest
+ * @return number of bytes copied to dest
+ */
+int modbus_read_register_out(uint8_t *dest, size_t offset, size_t n)
+{
+    size_t totalModbusBytes = (MODBUS_OUTREGISTER_COUNT + MODBUS_OUTREGISTER_2_COUNT) * sizeof(uint16_t);
+
+    if (dest == NULL)
+    {
+        return -1;
+    }
+
+    if ((offset >= totalModbusBytes) || (n > (totalModbusBytes - offset)))
+    {
+        return -2;
+    }
+
+    if (modbus_initialized == FALSE)
+    {
+        memset(dest, 0, n);
+        return 0;
+    }
+
+    pthread_mutex_lock( &write_mapping_mutex );
+        modbus_accessImage(dest, mb_mapping_write, mb_mapping_2_write, offset, n, FALSE);
+    pthread_mutex_unlock( &write_mapping_mutex );
+    return n;
+}
+
+/**
+ * @brief Get the number of registers of a mapping which are covered by the
+ * KBUS process image. Area 2 starts behind the registers of area 1.
+ * @param[in] mapping Mapping
+ * @return Number of registers, all registers of a mapping which is no
+ * process data area
+ */
+int modbus_getImageRegisters(const modbus_mapping_t *mapping)
+{
+    int n;
+
+    if ((mapping == mb_mapping_in) || (mapping == mb_mapping_2_in))
+    {
+        n = kbus_getRegistersToRead();
+    }
+    else if ((mapping == mb_mapping_write) || (mapping == mb_mapping_2_write))
+    {
+        n = kbus_getRegistersToWrite();
+    }
+    else
+    {
+        return mapping->nb_registers;
+    }
+
+    if ((mapping == mb_mapping_2_in) || (mapping == mb_mapping_2_write))
+    {
+        n -= MODBUS_OUTREGISTER_COUNT;
+    }
+    if (n < 0)
+    {
+        n = 0;
+    }
+    else if (n > mapping->nb_registers)
+    {
+        n = mapping->nb_registers;
+    }
+    return n;
+}
+
+/**
+ * @brief Pin the shadow of a mapping in network byte order. The registers
+ * of the input areas change once per KBUS cycle only, their shadow is
+ * swapped there so read requests copy or send it as it is. The pinned
+ * generation is not overwritten until it is unpinned.
+ * @param[in] mapping Mapping read by a request
+ * @param[out] generation Generation to be passed to modbus_unpinReadShadow()
+ * @return Registers of the mapping in network byte order
+ * @retval NULL if the mapping has no shadow, nothing is pinned
+ */
+const uint8_t *modbus_pinReadShadow(const modbus_mapping_t *mapping, int *generation)
+{
+    int current;
+
+    if ((mapping == NULL) || ((mapping != mb_mapping_in) && (mapping != mb_mapping_2_in)))
+    {
+        return NULL;
+    }
+    do
+    {
+        //A generation is only valid if it is still the current one once pinned
+        current = __atomic_load_n(&modbus_shadowCurrent, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&modbus_shadows[current].users, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&modbus_shadowCurrent, __ATOMIC_SEQ_CST) == current)
+        {
+            break;
+        }
+        __atomic_sub_fetch(&modbus_shadows[current].users, 1, __ATOMIC_SEQ_CST);
+    } while (1);
+
+    *generation = current;
+    return (mapping == mb_mapping_in) ? modbus_shadows[current].in : modbus_shadows[current].in_2;
+}
+
+/**
+ * @brief Release a generation pinned by modbus_pinReadShadow()
+ * @param[in] generation Generation
+ */
+void modbus_unpinReadShadow(int generation)
+{
+    __atomic_sub_fetch(&modbus_shadows[generation].users, 1, __ATOMIC_SEQ_CST);
+}
+
 /**
  * @brief Register a callback function, that is executed on every
  * message action.
@@ -865,28 +1289,14 @@ void modbus_ApplicationStateRun(void)
  */
 modbus_mapping_t *modbus_getWriteMapping(uint16_t *write_address)
 {
-    uint16_t address = *write_address;
-    if (address <= 255)
-    {
-        return mb_mapping_write;
-    }
-    else if ((address >= 512) && (address <= 767))
-    {
-        *write_address -= 512;
-        return mb_mapping_write;
-    }
-    else if ((address >= 0x6000) && (address <= 0x62FB))
-    {
-        *write_address -= 0x6000;
-        return mb_mapping_2_write;
-    }
-    else if ((address >= 0x7000) && (address <= 0x72FB))
+    const modbusMap_region_t *region = modbusMap_lookup(MODBUSMAP_REGISTERS, *write_address);
+
+    if (((region->access & MODBUSMAP_ACCESS_WRITE) == 0) || (region->write_mapping == NULL))
     {
-        *write_address -= 0x7000;
-        return mb_mapping_2_write;
-    }
-    else
         return NULL;
+    }
+    *write_address -= region->base;
+    return region->write_mapping;
 }
 
 /**
@@ -897,27 +1307,12 @@ modbus_mapping_t *modbus_getWriteMapping(uint16_t *write_address)
  */
 modbus_mapping_t *modbus_getReadMapping(uint16_t *read_address)
 {
-    uint16_t address = *read_address;
+    const modbusMap_region_t *region = modbusMap_lookup(MODBUSMAP_REGISTERS, *read_address);
 
-    if (address <= 255)
-    {
-        return mb_mapping_in;
-    }
-    else if ((address >= 512) && (address <= 767))
-    {
-        *read_address -= 512;
-        return mb_mapping_write;
-    }
-    else if ((address >= 0x6000) && (address <= 0x62FB))
+    if (((region->access & MODBUSMAP_ACCESS_READ) == 0) || (region->read_mapping == NULL))
     {
-        *read_address -= 0x6000;
-        return mb_mapping_2_in;
-    }
-    else if ((address >= 0x7000) && (address <= 0x72FB))
-    {
-        *read_address -= 0x7000;
-        return mb_mapping_2_write;
-    }
-    else
         return NULL;
+    }
+    *read_address -= region->base;
+    return region->read_mapping;
 }
@@ -29,10 +29,24 @@
 #define _FC_WRITE_AND_READ_REGISTERS    0x17 // Internal Registers Or Physical Output Registers
 #define _FC_READ_FIFO_QUEUE             0x18 // Internal Registers Or Physical Output Registers (Unsupported: Not implemented in WAGO Slaves)
 #define _FC_READ_DEVICE_IDENTIFICATION  0x2B // Diagnostics (Unsupported: TODO ?)
+#define _FC_READ_INPUT_REGISTERS_XL     0x42 // WAGO Only
+#define _FC_WRITE_MULTIPLE_REGISTERS_XL 0x43 // Extended write of the output areas
+#define _FC_READ_REGISTERS_SCATTER      0x45 // List of register ranges read at once, 0x44 is the subscription notification
 /**
  * @}
  */
 
+/**
+ * @brief Lanes of the request schedulers. Requests of the priority lane are
+ * served before process data requests.
+ */
+typedef enum
+{
+    MODBUS_LANE_PRIORITY = 0,   /**< @brief Watchdog and configuration registers */
+    MODBUS_LANE_PROCESS,        /**< @brief Process data and everything else */
+    MODBUS_LANE_COUNT
+} modbus_lane_t;
+
 /**
  * @brief Start kbus thread
  * @retval 0 on success
@@ -61,6 +75,74 @@ int modbus_copy_register_in(uint16_t *source, size_t n);
  */
 int modbus_copy_register_out(uint8_t *dest, size_t n);
 
+/**
+ * @brief Write data to the modbus output registers
+ * @param[in] *source pointer to the source
+ * @param[in] offset first byte in the output registers, same layout as the
+ * destination of modbus_copy_register_out()
+ * @param[in] n number of bytes to be copied from source
+ * @return number of bytes copied from source
+ */
+int modbus_write_register_out(const uint8_t *source, size_t offset, size_t n);
+
+/**
+ * @brief Write a bit field of the modbus output registers
+ * @param[in] value value of the bit field, higher bits are ignored
+ * @param[in] bit_offset first bit in the output registers
+ * @param[in] bits width of the bit field, 1 to 16
+ * @return number of bits written
+ */
+int modbus_write_register_out_bits(uint16_t value, size_t bit_offset, size_t bits);
+
+/**
+ * @brief Read data of the modbus input registers
+ * @param[out] *dest pointer to the destination
+ * @param[in] offset first byte in the input registers
+ * @param[in] n number of bytes to be copied to dest
+ * @return number of bytes copied to dest
+ */
+int modbus_read_register_in(uint8_t *dest, size_t offset, size_t n);
+
+/**
+ * @brief Read data of the modbus output registers
+ * @param[out] *dest pointer to the destination
+ * @param[in] offset first byte in the output registers
+ * @param[in] n number of bytes to be copied to dest
+ * @return number of bytes copied to dest
+ */
+int modbus_read_register_out(uint8_t *dest, size_t offset, size_t n);
+
+/**
+ * @brief Get the number of registers of a mapping covered by the KBUS
+ * process image
+ * @param[in] mapping Mapping
+ * @return Number of registers
+ */
+int modbus_getImageRegisters(const modbus_mapping_t *mapping);
+
+/**
+ * @brief Pin the shadow of a mapping in network byte order
+ * @param[in] mapping Mapping read by a request
+ * @param[out] generation Generation to be passed to modbus_unpinReadShadow()
+ * @return Registers of the mapping in network byte order
+ * @retval NULL if the mapping has no shadow, nothing is pinned
+ */
+const uint8_t *modbus_pinReadShadow(const modbus_mapping_t *mapping, int *generation);
+
+/**
+ * @brief Release a generation pinned by modbus_pinReadShadow()
+ * @param[in] generation Generation
+ */
+void modbus_unpinReadShadow(int generation);
+
+/**
+ * @brief Classify a request for the request schedulers
+ * @param[in] pdu Function code and data of the request
+ * @param[in] length Length of the PDU
+ * @return Lane of the request
+ */
+int modbus_classify(const uint8_t *pdu, int length);
+
 void modbus_registerMsgReceivedCallback(void (*funct)());
 void modbus_ApplicationStateStop(void);
 void modbus_ApplicationStateRun(void);
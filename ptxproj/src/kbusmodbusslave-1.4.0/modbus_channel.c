@@ -0,0 +1,337 @@
+//------------------------------------------------------------------------------
+/// Copyright (c) WAGO Kontakttechnik GmbH & Co. KG
+///
+/// PROPRIETARY RIGHTS are involved in the subject matter of this material.
+/// All manufacturing, reproduction, use and sales rights pertaining to this
+/// subject matter are governed by the license agreement. The recipient of this
+/// software implicitly accepts the terms of the license.
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+///
+///  \file     modbus_channel.c
+///
+///  \brief    Channel view of the process data, see kbus_channel.c. Every
+///            module position has a block of 32 registers, one register per
+///            channel, so all channels of a module are read at once without
+///            knowing the layout of the process image.
+///
+///            Registers:
+///            0xA000 + 32 * (N - 1) + C       Input channel C of module N
+///            0xA000 + 32 * (N - 1) + 16 + C  Output channel C of module N
+///            0xA800 + 8 * N                  Index entry of module N, N = 0
+///                                            describes the view itself
+///
+///            C starts with 0. Digital channels read as 0 or 1, writes set
+///            the lower bits of an output channel given by its width.
+///
+///  \author   <BrT> : WAGO Kontakttechnik GmbH & Co. KG
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <modbus/modbus.h>
+#include "modbus_channel.h"
+#include "modbus_reply.h"
+#include "modbus.h"
+#include "kbus_channel.h"
+#include "utils.h"
+
+#define MODBUSCHANNEL_STRIDE 32         /**< @brief Registers of a module in the view */
+#define MODBUSCHANNEL_OUTPUT_SLOT 16    /**< @brief First output channel register of a module */
+#define MODBUSCHANNEL_INDEX_STRIDE 8    /**< @brief Registers of an index entry */
+#define MODBUSCHANNEL_MAX_WINDOW (MAX_RESPONSE_MESSAGE_LENGTH / 2) /**< @brief Registers of one request */
+
+/**
+ * @name Index entry
+ * @brief Offsets of the registers of a module entry, entry 0 gives the
+ * module count and the layout of the view
+ * @{
+ */
+#define MODBUSCHANNEL_INDEX_TYPE 0          /**< @brief Module type / Module count */
+#define MODBUSCHANNEL_INDEX_FLAGS 1         /**< @brief KBUSCHANNEL_FLAG_* / Start address of the view */
+#define MODBUSCHANNEL_INDEX_IN_CHANNELS 2   /**< @brief Input channels / Registers per module */
+#define MODBUSCHANNEL_INDEX_IN_BITS 3       /**< @brief Width of an input channel / Offset of the output channels */
+#define MODBUSCHANNEL_INDEX_OUT_CHANNELS 4  /**< @brief Output channels / Maximum channels per direction */
+#define MODBUSCHANNEL_INDEX_OUT_BITS 5      /**< @brief Width of an output channel / Registers per index entry */
+#define MODBUSCHANNEL_INDEX_IN_OFFSET 6     /**< @brief Bit offset in the input image */
+#define MODBUSCHANNEL_INDEX_OUT_OFFSET 7    /**< @brief Bit offset in the output image */
+/**
+ * @}
+ */
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Read a channel from the process image
+ * @param[in] output TRUE for the output image, FALSE for the input image
+ * @param[in] bit_offset First bit of the channel
+ * @param[in] bits Width of the channel
+ * @return Value of the channel
+ */
+static uint16_t modbusChannel_readBits(int output, size_t bit_offset, size_t bits)
+{
+    uint8_t bytes[sizeof(uint32_t)] = { 0 };
+    size_t n = ((bit_offset % 8) + bits + 7) / 8;
+    uint32_t field = 0;
+    size_t i;
+
+    if (output)
+    {
+        modbus_read_register_out(bytes, bit_offset / 8, n);
+    }
+    else
+    {
+        modbus_read_register_in(bytes, bit_offset / 8, n);
+    }
+    for (i = 0; i < n; i++)
+    {
+        field |= (uint32_t)bytes[i] << (8 * i);
+    }
+    return (field >> (bit_offset % 8)) & ((1u << bits) - 1);
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Get a register of the channel view
+ * @param[in] slot Register of the module block
+ * @param[in] module Channels of the module, NULL if there is no module
+ * @return Value of the register
+ */
+static uint16_t modbusChannel_getView(int slot, const kbusChannel_module_t *module)
+{
+    if (module == NULL)
+    {
+        return 0;
+    }
+    if (slot < MODBUSCHANNEL_OUTPUT_SLOT)
+    {
+        if (slot >= module->inChannels)
+        {
+            return 0;
+        }
+        return modbusChannel_readBits(FALSE, module->inOffset + (slot * module->inBits), module->inBits);
+    }
+    slot -= MODBUSCHANNEL_OUTPUT_SLOT;
+    if (slot >= module->outChannels)
+    {
+        return 0;
+    }
+    return modbusChannel_readBits(TRUE, module->outOffset + (slot * module->outBits), module->outBits);
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Get a register of the channel index
+ * @param[in] slot Register of the index entry
+ * @param[in] module Channels of the module, NULL for entry 0 or if there is
+ * no module
+ * @param[in] entry Index entry
+ * @return Value of the register
+ */
+static uint16_t modbusChannel_getIndex(int slot, const kbusChannel_module_t *module, int entry)
+{
+    if (entry == 0)
+    {
+        switch (slot)
+        {
+            case MODBUSCHANNEL_INDEX_TYPE:
+                return kbusChannel_getModuleCount();
+            case MODBUSCHANNEL_INDEX_FLAGS:
+                return MODBUSCHANNEL_VIEW_START_ADDRESS;
+            case MODBUSCHANNEL_INDEX_IN_CHANNELS:
+                return MODBUSCHANNEL_STRIDE;
+            case MODBUSCHANNEL_INDEX_IN_BITS:
+                return MODBUSCHANNEL_OUTPUT_SLOT;
+            case MODBUSCHANNEL_INDEX_OUT_CHANNELS:
+                return KBUSCHANNEL_MAX_CHANNELS;
+            case MODBUSCHANNEL_INDEX_OUT_BITS:
+                return MODBUSCHANNEL_INDEX_STRIDE;
+        }
+        return 0;
+    }
+    if (module == NULL)
+    {
+        return 0;
+    }
+    switch (slot)
+    {
+        case MODBUSCHANNEL_INDEX_TYPE:
+            return module->type;
+        case MODBUSCHANNEL_INDEX_FLAGS:
+            return module->flags;
+        case MODBUSCHANNEL_INDEX_IN_CHANNELS:
+            return module->inChannels;
+        case MODBUSCHANNEL_INDEX_IN_BITS:
+            return module->inBits;
+        case MODBUSCHANNEL_INDEX_OUT_CHANNELS:
+            return module->outChannels;
+        case MODBUSCHANNEL_INDEX_OUT_BITS:
+            return module->outBits;
+        case MODBUSCHANNEL_INDEX_IN_OFFSET:
+            return module->inOffset;
+        case MODBUSCHANNEL_INDEX_OUT_OFFSET:
+            return module->outOffset;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Fill the registers of a request
+ * @param[in] address First register
+ * @param[out] values Registers
+ * @param[in] nb Number of registers, all in the view or all in the index
+ */
+static void modbusChannel_fill(uint16_t address, uint16_t *values, int nb)
+{
+    kbusChannel_module_t module;
+    int hasModule = FALSE;
+    int position = -1;
+    int i;
+
+    for (i = 0; i < nb; i++)
+    {
+        uint16_t a = address + i;
+        int current;
+        int slot;
+
+        if (a >= MODBUSCHANNEL_INDEX_START_ADDRESS)
+        {
+            current = (a - MODBUSCHANNEL_INDEX_START_ADDRESS) / MODBUSCHANNEL_INDEX_STRIDE;
+            slot = (a - MODBUSCHANNEL_INDEX_START_ADDRESS) % MODBUSCHANNEL_INDEX_STRIDE;
+        }
+        else
+        {
+            current = ((a - MODBUSCHANNEL_VIEW_START_ADDRESS) / MODBUSCHANNEL_STRIDE) + 1;
+            slot = (a - MODBUSCHANNEL_VIEW_START_ADDRESS) % MODBUSCHANNEL_STRIDE;
+        }
+        //The module table is copied once per module
+        if (current != position)
+        {
+            position = current;
+            hasModule = (kbusChannel_getModule(position, &module) == 0);
+        }
+
+        if (a >= MODBUSCHANNEL_INDEX_START_ADDRESS)
+        {
+            values[i] = modbusChannel_getIndex(slot, hasModule ? &module : NULL, position);
+        }
+        else
+        {
+            values[i] = modbusChannel_getView(slot, hasModule ? &module : NULL);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Write output channels
+ * @param[in] address First register
+ * @param[in] values Values in the format of the PDU
+ * @param[in] nb Number of registers
+ * @return Exception code
+ * @retval 0 on success
+ */
+static int modbusChannel_write(uint16_t address, const uint8_t *values, int nb)
+{
+    int position = ((address - MODBUSCHANNEL_VIEW_START_ADDRESS) / MODBUSCHANNEL_STRIDE) + 1;
+    int channel = ((address - MODBUSCHANNEL_VIEW_START_ADDRESS) % MODBUSCHANNEL_STRIDE) - MODBUSCHANNEL_OUTPUT_SLOT;
+    kbusChannel_module_t module;
+    int i;
+
+    //Output channels are followed by the inputs of the next module, so a
+    //write never leaves the output channels of one module
+    if ((address < MODBUSCHANNEL_VIEW_START_ADDRESS) || (channel < 0) ||
+        (kbusChannel_getModule(position, &module) < 0) || ((channel + nb) > module.outChannels))
+    {
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+
+    for (i = 0; i < nb; i++)
+    {
+        uint16_t value = (values[2 * i] << 8) + values[(2 * i) + 1];
+
+        modbus_write_register_out_bits(value, module.outOffset + ((channel + i) * module.outBits), module.outBits);
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------------
+void modbusChannel_parseModbusCommand(modbus_t *ctx, uint8_t *command, int command_len)
+{
+    int offset = modbus_get_header_length(ctx);
+    int function = command[offset];
+    uint16_t address = (command[offset + 1] << 8) + command[offset + 2];
+    uint16_t values[MODBUSCHANNEL_MAX_WINDOW];
+    modbus_mapping_t window;
+    const uint8_t *data;
+    int last;
+    int nb;
+    int exception;
+
+    memset(&window, 0, sizeof(window));
+    window.tab_registers = values;
+    window.tab_input_registers = values;
+    last = (address >= MODBUSCHANNEL_INDEX_START_ADDRESS) ? MODBUSCHANNEL_INDEX_END_ADDRESS : MODBUSCHANNEL_VIEW_END_ADDRESS;
+
+    switch(function)
+    {
+        case _FC_READ_HOLDING_REGISTERS:
+        case _FC_READ_INPUT_REGISTERS:
+        case _FC_READ_INPUT_REGISTERS_XL:
+            //The reply checks the quantity and truncates FC66 at the end of the block
+            nb = (command[offset + 3] << 8) + command[offset + 4];
+            if (nb > (last - address + 1))
+            {
+                nb = last - address + 1;
+            }
+            if (nb > MODBUSCHANNEL_MAX_WINDOW)
+            {
+                nb = MODBUSCHANNEL_MAX_WINDOW;
+            }
+            window.nb_registers = nb;
+            window.nb_input_registers = nb;
+            modbusChannel_fill(address, values, nb);
+            modbus_reply_offset(ctx, command, command_len, &window, address);
+            break;
+        case _FC_WRITE_SINGLE_REGISTER:
+        case _FC_WRITE_MULTIPLE_REGISTERS:
+        case _FC_WRITE_MULTIPLE_REGISTERS_XL:
+            if (function == _FC_WRITE_SINGLE_REGISTER)
+            {
+                nb = 1;
+                data = &command[offset + 3];
+            }
+            else if (function == _FC_WRITE_MULTIPLE_REGISTERS)
+            {
+                nb = (command[offset + 3] << 8) + command[offset + 4];
+                data = &command[offset + 6];
+            }
+            else
+            {
+                nb = (command[offset + 3] << 8) + command[offset + 4];
+                data = &command[offset + 7];
+            }
+            if ((nb == 0) || (nb > MODBUSCHANNEL_MAX_WINDOW) || ((data + (2 * nb)) > (command + command_len)))
+            {
+                modbus_reply_exception(ctx, command, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+                break;
+            }
+            exception = modbusChannel_write(address, data, nb);
+            if (exception != 0)
+            {
+                modbus_reply_exception(ctx, command, exception);
+                break;
+            }
+            //Echo of the request
+            window.nb_registers = nb;
+            modbus_reply_offset(ctx, command, command_len, &window, address);
+            break;
+        default:
+            modbus_reply_exception(ctx, command, MODBUS_EXCEPTION_ILLEGAL_FUNCTION );
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef __MODBUS_CHANNEL_H__
+#define __MODBUS_CHANNEL_H__
+
+#include <modbus/modbus.h>
+
+#define MODBUSCHANNEL_VIEW_START_ADDRESS  0xA000 /**< @brief Start address of the channel view */
+#define MODBUSCHANNEL_VIEW_END_ADDRESS    0xA7FF /**< @brief Last address of the channel view */
+#define MODBUSCHANNEL_INDEX_START_ADDRESS 0xA800 /**< @brief Start address of the channel index */
+#define MODBUSCHANNEL_INDEX_END_ADDRESS   0xAA07 /**< @brief Last address of the channel index */
+
+void modbusChannel_parseModbusCommand(modbus_t *ctx, uint8_t *command, int command_len);
+
+#endif /* __MODBUS_CHANNEL_H__ */
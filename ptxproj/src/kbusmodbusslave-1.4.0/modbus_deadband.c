@@ -0,0 +1,155 @@
+//------------------------------------------------------------------------------
+/// Copyright (c) WAGO Kontakttechnik GmbH & Co. KG
+///
+/// PROPRIETARY RIGHTS are involved in the subject matter of this material.
+/// All manufacturing, reproduction, use and sales rights pertaining to this
+/// subject matter are governed by the license agreement. The recipient of this
+/// software implicitly accepts the terms of the license.
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+///
+///  \file     modbus_deadband.c
+///
+///  \brief    Modbus registers of the analog input deadbands, see
+///            kbus_deadband.c.
+///
+///            Registers:
+///            0x1048  Module position starting with 1, 0 for all modules
+///            0x1049  Channel of the module starting with 1, 0 for all channels
+///            0x104A  Absolute deadband in LSB
+///            0x104B  Deadband in 0.01 % of the full scale value 0x7FFF
+///            0x104C  Number of analog input channels (read only)
+///
+///            Writing 0x1048-0x1049 alone selects a channel and loads its
+///            deadband to 0x104A-0x104B. Writing 0x104A or 0x104B sets the
+///            deadband of the selected channels.
+///
+///  \author   <BrT> : WAGO Kontakttechnik GmbH & Co. KG
+//------------------------------------------------------------------------------
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <modbus/modbus.h>
+#include "modbus_deadband.h"
+#include "modbus_reply.h"
+#include "modbus.h"
+#include "kbus_deadband.h"
+#include "utils.h"
+
+/**
+ * @name Deadband registers
+ * @brief Offsets of the registers from MODBUSDEADBAND_REGISTER_START_ADDRESS
+ * @{
+ */
+#define MODBUSDEADBAND_REG_POSITION 0
+#define MODBUSDEADBAND_REG_CHANNEL 1
+#define MODBUSDEADBAND_REG_ABSOLUTE 2
+#define MODBUSDEADBAND_REG_PERCENT 3
+#define MODBUSDEADBAND_REG_CHANNELS 4
+#define MODBUSDEADBAND_REG_WRITABLE 4   /**< @brief Registers a master may write */
+#define MODBUSDEADBAND_REG_COUNT_ALL 5
+/**
+ * @}
+ */
+
+static modbus_mapping_t *mb_deadband_mapping = NULL; /**< @brief Modbus register storage */
+
+//------------------------------------------------------------------------------------
+void modbusDeadband_parseModbusCommand(modbus_t *ctx, uint8_t *command, int command_len)
+{
+    int offset = modbus_get_header_length(ctx);
+    int function = command[offset];
+    uint16_t address = (command[offset + 1] << 8) + command[offset + 2];
+    uint16_t reg[MODBUSDEADBAND_REG_WRITABLE];
+    const uint8_t *values;
+    int quantity;
+    int i;
+
+    //manipulate address
+    uint16_t fakeAddress = address - MODBUSDEADBAND_REGISTER_START_ADDRESS;
+
+    switch(function)
+    {
+        case _FC_READ_HOLDING_REGISTERS:
+            mb_deadband_mapping->tab_registers[MODBUSDEADBAND_REG_CHANNELS] = kbusDeadband_getChannelCount();
+            modbus_reply_offset(ctx, command, command_len, mb_deadband_mapping, MODBUSDEADBAND_REGISTER_START_ADDRESS);
+            break;
+        case _FC_WRITE_SINGLE_REGISTER:
+        case _FC_WRITE_MULTIPLE_REGISTERS:
+            if (function == _FC_WRITE_SINGLE_REGISTER)
+            {
+                quantity = 1;
+                values = &command[offset + 3];
+            }
+            else
+            {
+                quantity = (command[offset + 3] << 8) + command[offset + 4];
+                values = &command[offset + 6];
+            }
+            if ((quantity == 0) || ((fakeAddress + quantity) > MODBUSDEADBAND_REG_WRITABLE) ||
+                ((values + (2 * quantity)) > (command + command_len)))
+            {
+                modbus_reply_exception(ctx, command, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+                break;
+            }
+
+            //Registers as they are after this write
+            for (i = 0; i < MODBUSDEADBAND_REG_WRITABLE; i++)
+            {
+                reg[i] = mb_deadband_mapping->tab_registers[i];
+            }
+            for (i = 0; i < quantity; i++)
+            {
+                reg[fakeAddress + i] = (values[2 * i] << 8) + values[(2 * i) + 1];
+            }
+
+            if ((fakeAddress + quantity) > MODBUSDEADBAND_REG_ABSOLUTE)
+            {
+                //Set the deadband of the selected channels
+                if (kbusDeadband_set(reg[MODBUSDEADBAND_REG_POSITION], reg[MODBUSDEADBAND_REG_CHANNEL],
+                                     reg[MODBUSDEADBAND_REG_ABSOLUTE], reg[MODBUSDEADBAND_REG_PERCENT]) < 0)
+                {
+                    modbus_reply_exception(ctx, command, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+                    break;
+                }
+            }
+            else if ((reg[MODBUSDEADBAND_REG_POSITION] != 0) && (reg[MODBUSDEADBAND_REG_CHANNEL] != 0))
+            {
+                //Select a channel, its deadband is read afterwards
+                if (kbusDeadband_get(reg[MODBUSDEADBAND_REG_POSITION], reg[MODBUSDEADBAND_REG_CHANNEL],
+                                     &reg[MODBUSDEADBAND_REG_ABSOLUTE], &reg[MODBUSDEADBAND_REG_PERCENT]) < 0)
+                {
+                    modbus_reply_exception(ctx, command, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+                    break;
+                }
+            }
+            modbus_reply_offset(ctx, command, command_len, mb_deadband_mapping, MODBUSDEADBAND_REGISTER_START_ADDRESS);
+            mb_deadband_mapping->tab_registers[MODBUSDEADBAND_REG_ABSOLUTE] = reg[MODBUSDEADBAND_REG_ABSOLUTE];
+            mb_deadband_mapping->tab_registers[MODBUSDEADBAND_REG_PERCENT] = reg[MODBUSDEADBAND_REG_PERCENT];
+            break;
+        default:
+            modbus_reply_exception(ctx, command, MODBUS_EXCEPTION_ILLEGAL_FUNCTION );
+    }
+}
+
+//------------------------------------------------------------------------------------
+int modbusDeadband_init(void)
+{
+    mb_deadband_mapping = modbus_mapping_new(0, 0, MODBUSDEADBAND_REG_COUNT_ALL, 0);
+    if (mb_deadband_mapping == NULL)
+    {
+        fprintf(stderr, "Failed to allocate the mapping: %s\n", modbus_strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------------
+void modbusDeadband_deInit(void)
+{
+    if (mb_deadband_mapping != NULL)
+    {
+        modbus_mapping_free(mb_deadband_mapping);
+        mb_deadband_mapping = NULL;
+    }
+}
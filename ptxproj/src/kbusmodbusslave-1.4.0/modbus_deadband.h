@@ -0,0 +1,13 @@
+#ifndef __MODBUS_DEADBAND_H__
+#define __MODBUS_DEADBAND_H__
+
+#include <modbus/modbus.h>
+
+#define MODBUSDEADBAND_REGISTER_START_ADDRESS 0x1048 /**< @brief Start address of the deadband registers */
+#define MODBUSDEADBAND_REGISTER_END_ADDRESS   0x104C /**< @brief Last address of the deadband registers */
+
+int modbusDeadband_init(void);
+void modbusDeadband_deInit(void);
+void modbusDeadband_parseModbusCommand(modbus_t *ctx, uint8_t *command, int command_len);
+
+#endif /* __MODBUS_DEADBAND_H__ */
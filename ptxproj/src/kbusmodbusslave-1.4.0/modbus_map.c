@@ -0,0 +1,189 @@
+//------------------------------------------------------------------------------
+/// Copyright (c) WAGO Kontakttechnik GmbH & Co. KG
+///
+/// PROPRIETARY RIGHTS are involved in the subject matter of this material.
+/// All manufacturing, reproduction, use and sales rights pertaining to this
+/// subject matter are governed by the license agreement. The recipient of this
+/// software implicitly accepts the terms of the license.
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+///
+///  \file     modbus_map.c
+///
+///  \brief    Address map of the Modbus requests. Each address space is
+///            divided into pages of 8 addresses, a page table gives the
+///            region serving a page. Pages shared by several regions refer
+///            to a second level table giving the region of each address.
+///            A lookup costs at most two table accesses and one range check,
+///            independent of the number of regions.
+///            Regions are added once at init, before any request is served.
+///
+///  \author   <BrT> : WAGO Kontakttechnik GmbH & Co. KG
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "modbus_map.h"
+#include "modbus.h"
+#include "utils.h"
+
+#define MODBUSMAP_PAGE_BITS 3                                /**< @brief 8 addresses per page */
+#define MODBUSMAP_PAGE_COUNT (0x10000 >> MODBUSMAP_PAGE_BITS) /**< @brief Pages of an address space */
+#define MODBUSMAP_PAGE_SIZE (1 << MODBUSMAP_PAGE_BITS)        /**< @brief Addresses per page */
+#define MODBUSMAP_MAX_REGIONS 64                             /**< @brief Maximum number of regions incl. the unmapped one */
+#define MODBUSMAP_SHARED 0x80                                /**< @brief Page entry refers to a shared page */
+#define MODBUSMAP_MAX_SHARED_PAGES 64                        /**< @brief Maximum number of shared pages of all address spaces */
+
+static modbusMap_region_t modbusMap_regions[MODBUSMAP_MAX_REGIONS]; /**< @brief Region 0 serves unmapped addresses */
+static int modbusMap_regionCount = 1;
+static uint8_t modbusMap_pages[MODBUSMAP_SPACE_COUNT][MODBUSMAP_PAGE_COUNT]; /**< @brief Region index of every page or MODBUSMAP_SHARED | shared page */
+static uint8_t modbusMap_shared[MODBUSMAP_MAX_SHARED_PAGES][MODBUSMAP_PAGE_SIZE]; /**< @brief Region index of every address of a shared page */
+static int modbusMap_sharedCount = 0;
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Remove all regions, every address is unmapped afterwards
+ * @retval 0 on success
+ */
+int modbusMap_init(void)
+{
+    memset(modbusMap_regions, 0, sizeof(modbusMap_regions));
+    memset(modbusMap_pages, 0, sizeof(modbusMap_pages));
+    memset(modbusMap_shared, 0, sizeof(modbusMap_shared));
+    modbusMap_regions[0].lane = MODBUS_LANE_PROCESS;
+    modbusMap_regionCount = 1;
+    modbusMap_sharedCount = 0;
+    return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Enter a region into a page it covers only partly
+ * @param[in] space Address space
+ * @param[in] page Page
+ * @param[in] region Region
+ * @param[in] index Index of the region
+ */
+static void modbusMap_sharePage(modbusMap_space_t space, unsigned int page, const modbusMap_region_t *region, int index)
+{
+    uint8_t entry = modbusMap_pages[space][page];
+    unsigned int address = page << MODBUSMAP_PAGE_BITS;
+    unsigned int i;
+
+    if (entry == 0)
+    {
+        //Addresses outside of the region are sorted out by the range check
+        modbusMap_pages[space][page] = index;
+        return;
+    }
+    if ((entry & MODBUSMAP_SHARED) == 0)
+    {
+        //Second region in this page, resolve the page by address
+        const modbusMap_region_t *other = &modbusMap_regions[entry];
+        uint8_t *shared = modbusMap_shared[modbusMap_sharedCount];
+
+        for (i = 0; i < MODBUSMAP_PAGE_SIZE; i++)
+        {
+            shared[i] = (((address + i) >= other->first) && ((address + i) <= other->last)) ? entry : 0;
+        }
+        entry = MODBUSMAP_SHARED | modbusMap_sharedCount++;
+        modbusMap_pages[space][page] = entry;
+    }
+    for (i = 0; i < MODBUSMAP_PAGE_SIZE; i++)
+    {
+        if (((address + i) >= region->first) && ((address + i) <= region->last))
+        {
+            modbusMap_shared[entry & ~MODBUSMAP_SHARED][i] = index;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Add a region to an address space
+ * @param[in] space Address space
+ * @param[in] region Region, copied
+ * @return Index of the region
+ * @retval <0 on failure
+ */
+int modbusMap_add(modbusMap_space_t space, const modbusMap_region_t *region)
+{
+    unsigned int firstPage = region->first >> MODBUSMAP_PAGE_BITS;
+    unsigned int lastPage = region->last >> MODBUSMAP_PAGE_BITS;
+    unsigned int address;
+    unsigned int page;
+    int index = modbusMap_regionCount;
+
+    if ((space >= MODBUSMAP_SPACE_COUNT) || (region->first > region->last))
+    {
+        return -1;
+    }
+    if (modbusMap_regionCount >= MODBUSMAP_MAX_REGIONS)
+    {
+        fprintf(stderr, "Modbus map: more than %d regions\n", MODBUSMAP_MAX_REGIONS - 1);
+        return -2;
+    }
+    //A region shares at most its first and its last page
+    if ((modbusMap_sharedCount + 2) > MODBUSMAP_MAX_SHARED_PAGES)
+    {
+        fprintf(stderr, "Modbus map: more than %d pages shared by regions\n", MODBUSMAP_MAX_SHARED_PAGES);
+        return -2;
+    }
+    for (address = region->first; address <= region->last; address++)
+    {
+        const modbusMap_region_t *other = modbusMap_lookup(space, address);
+
+        if (other != &modbusMap_regions[0])
+        {
+            fprintf(stderr, "Modbus map: region 0x%04X-0x%04X overlaps 0x%04X-0x%04X\n",
+                    region->first, region->last, other->first, other->last);
+            return -3;
+        }
+    }
+
+    modbusMap_regions[index] = *region;
+    for (page = firstPage; page <= lastPage; page++)
+    {
+        if ((region->first <= (page << MODBUSMAP_PAGE_BITS)) &&
+            (region->last >= ((page << MODBUSMAP_PAGE_BITS) + MODBUSMAP_PAGE_SIZE - 1)))
+        {
+            modbusMap_pages[space][page] = index;
+        }
+        else
+        {
+            modbusMap_sharePage(space, page, region, index);
+        }
+    }
+    dprintf(VERBOSE_DEBUG, "Modbus map: %d 0x%04X-0x%04X access %u\n", space, region->first, region->last, region->access);
+    modbusMap_regionCount++;
+    return index;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Get the region serving an address
+ * @param[in] space Address space
+ * @param[in] address Modbus address
+ * @return Region, the unmapped region without any access rights if no region
+ * serves the address
+ */
+const modbusMap_region_t *modbusMap_lookup(modbusMap_space_t space, uint16_t address)
+{
+    uint8_t entry = modbusMap_pages[space][address >> MODBUSMAP_PAGE_BITS];
+    const modbusMap_region_t *region;
+
+    if (entry & MODBUSMAP_SHARED)
+    {
+        entry = modbusMap_shared[entry & ~MODBUSMAP_SHARED][address & (MODBUSMAP_PAGE_SIZE - 1)];
+    }
+    region = &modbusMap_regions[entry];
+    if ((address < region->first) || (address > region->last))
+    {
+        return &modbusMap_regions[0];
+    }
+    return region;
+}
@@ -0,0 +1,40 @@
+#ifndef __MODBUS_MAP_H__
+#define __MODBUS_MAP_H__
+
+#include <stdint.h>
+#include <modbus/modbus.h>
+
+#define MODBUSMAP_ACCESS_READ  0x01 /**< @brief Region may be read */
+#define MODBUSMAP_ACCESS_WRITE 0x02 /**< @brief Region may be written */
+
+/**
+ * @brief Address spaces of the Modbus requests
+ */
+typedef enum
+{
+    MODBUSMAP_REGISTERS = 0,    /**< @brief Register requests, FC2, FC3, FC4, FC6, FC16 and FC23 */
+    MODBUSMAP_COILS,            /**< @brief Bit requests, FC1, FC5 and FC15 */
+    MODBUSMAP_SPACE_COUNT
+} modbusMap_space_t;
+
+/**
+ * @brief Contiguous range of Modbus addresses served the same way.
+ * Either handler or the mappings are set.
+ */
+typedef struct
+{
+    uint16_t first;         /**< @brief First address of the region */
+    uint16_t last;          /**< @brief Last address of the region */
+    uint8_t access;         /**< @brief MODBUSMAP_ACCESS_READ and MODBUSMAP_ACCESS_WRITE */
+    uint8_t lane;           /**< @brief Lane of the request schedulers, see modbus_lane_t */
+    void (*handler)(modbus_t *ctx, uint8_t *query, int rc); /**< @brief Parser of the configuration registers */
+    modbus_mapping_t *read_mapping;     /**< @brief Storage read by requests */
+    modbus_mapping_t *write_mapping;    /**< @brief Storage written by requests */
+    uint16_t base;          /**< @brief Address of the first entry of the mappings */
+} modbusMap_region_t;
+
+int modbusMap_init(void);
+int modbusMap_add(modbusMap_space_t space, const modbusMap_region_t *region);
+const modbusMap_region_t *modbusMap_lookup(modbusMap_space_t space, uint16_t address);
+
+#endif /* __MODBUS_MAP_H__ */
@@ -21,12 +21,17 @@
 #include <errno.h>
 #include <limits.h>
 #include <time.h>
+#include <sys/uio.h>
 #include <modbus/modbus.h>
 #include "modbus.h"
 #include "modbus-private.h"
+#include "modbus_reply.h"
+#include "conffile_reader.h"
+#include "utils.h"
 static void (*modbus_replyCallback)() = NULL; /**< @brief Callback for kbus cycle which is needed for FC23*/
+static int (*modbus_replySendv)(modbus_t *ctx, const struct iovec *iov, int iovcnt, int generation) = NULL; /**< @brief Sends a reply given in parts, TCP only */
 
-#define MAX_RESPONSE_MESSAGE_LENGTH   1450
+#define MODBUS_REPLY_SENDV_MIN_BYTES 128 /**< @brief Smaller register reads are copied into the reply */
 
 //Wrapper for libmodbus reply
 /* Send a response to the received request.
@@ -50,20 +55,8 @@ static int response_exception(modbus_t *ctx, sft_t *sft, int exception_code, uin
     return rsp_length;
 }
 
-static uint32_t _responseDelay = 0;
-static inline void wait_response_delay(void)
-{
-    uint32_t currentResponseDelay = _responseDelay;
-    if (currentResponseDelay > 0) 
-    {
-        /* usleep source code */
-        struct timespec request, remaining;
-        request.tv_sec = 0;
-        request.tv_nsec = currentResponseDelay;
-        while (nanosleep(&request, &remaining) == -1 && errno == EINTR)
-            request = remaining;
-    }
-}
+/* The response delay (modbus_delay_ms) is applied by the TCP and UDP
+   servers, which park the replies instead of sleeping in this thread */
 
 int _sleep_and_flush(modbus_t *ctx)
 {
@@ -79,21 +72,37 @@ int _sleep_and_flush(modbus_t *ctx)
     return modbus_flush(ctx);
 }
 
+/**
+ * @brief Print a message in hex, for debugging only
+ * @param[in] msg Message
+ * @param[in] msg_length Length of the message
+ */
+static void send_msgDump(const uint8_t *msg, int msg_length)
+{
+    int i;
+
+    for (i = 0; i < msg_length; i++)
+        printf("[%.2X]", msg[i]);
+    printf("\n");
+}
+
 /* Sends a request/response */
 static int send_msg(modbus_t *ctx, uint8_t *msg, int msg_length)
 {
     int rc;
-    int i;
 
-    modbus_flush(ctx);
+    /* Only the serial line is flushed. Data behind a request on TCP or UDP
+       are further requests, flushing them costs a system call per reply. */
+    if (_MODBUS_BACKEND_TYPE_RTU == ctx->backend->backend_type)
+    {
+        modbus_flush(ctx);
+    }
 
     msg_length = ctx->backend->send_msg_pre(msg, msg_length);
 
     if (ctx->debug) 
     {
-        for (i = 0; i < msg_length; i++)
-            printf("[%.2X]", msg[i]);
-        printf("\n");
+        send_msgDump(msg, msg_length);
     }
 
     /* In recovery mode, the write command will be issued until to be
@@ -136,6 +145,144 @@ static int send_msg(modbus_t *ctx, uint8_t *msg, int msg_length)
     return rc;
 }
 
+/**
+ * @brief Context of a configuration parser called for a part of a gathered
+ * request. The parser replies to the copy of the requesting context, its
+ * reply is captured instead of being sent.
+ */
+typedef struct
+{
+    modbus_t ctx;               /**< @brief Copy of the requesting context, first member */
+    modbus_backend_t backend;   /**< @brief Backend of the requesting context with send and flush replaced */
+    uint8_t rsp[MAX_RESPONSE_MESSAGE_LENGTH]; /**< @brief Captured reply */
+    int rsp_length;             /**< @brief Length of the captured reply, 0 if none */
+} modbus_capture_t;
+
+/**
+ * @brief Replacement for the send function of the libmodbus backend, stores
+ * the reply in the capture context
+ * @param[in] ctx Modbus context, member of a modbus_capture_t
+ * @param[in] msg Reply
+ * @param[in] msg_length Length of the reply
+ * @return Number of bytes stored
+ * @retval -1 on failure
+ */
+static ssize_t modbus_captureSend(modbus_t *ctx, const uint8_t *msg, int msg_length)
+{
+    modbus_capture_t *capture = (modbus_capture_t *)ctx;
+
+    if ((size_t)msg_length > sizeof(capture->rsp))
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+    memcpy(capture->rsp, msg, msg_length);
+    capture->rsp_length = msg_length;
+    return msg_length;
+}
+
+/**
+ * @brief Copy holding registers of a mapping in network byte order, from
+ * the shadow of the mapping if it has one
+ * @param[out] dest Destination
+ * @param[in] mapping Mapping
+ * @param[in] address First register of the mapping
+ * @param[in] nb Number of registers
+ */
+static void modbus_copyRegisters(uint8_t *dest, const modbus_mapping_t *mapping, int address, int nb)
+{
+    int generation;
+    const uint8_t *shadow = modbus_pinReadShadow(mapping, &generation);
+
+    if (shadow != NULL)
+    {
+        memcpy(dest, &shadow[address << 1], nb << 1);
+        modbus_unpinReadShadow(generation);
+    }
+    else
+    {
+        utils_copyWordsBE(dest, &mapping->tab_registers[address], nb);
+    }
+}
+
+/**
+ * @brief Refer to holding registers of a mapping in its shadow instead of
+ * copying them, if the reply can be sent in parts. The generation of the
+ * shadow stays pinned until the reply is sent or copied.
+ * @param[in] ctx Modbus context
+ * @param[in] mapping Mapping
+ * @param[in] address First register of the mapping
+ * @param[in] nb Number of registers
+ * @param[out] generation Pinned generation of the shadow
+ * @return Registers in network byte order
+ * @retval NULL if the registers have to be copied
+ */
+static const uint8_t *modbus_referRegisters(modbus_t *ctx, const modbus_mapping_t *mapping, int address, int nb, int *generation)
+{
+    const uint8_t *shadow;
+
+    if ((modbus_replySendv == NULL) || ((nb << 1) < MODBUS_REPLY_SENDV_MIN_BYTES) || ctx->debug ||
+        (ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP) || (ctx->backend->send == modbus_captureSend))
+    {
+        return NULL;
+    }
+    shadow = modbus_pinReadShadow(mapping, generation);
+    return (shadow != NULL) ? &shadow[address << 1] : NULL;
+}
+
+/**
+ * @brief Send a reply whose registers are referred to in the shadow. Falls
+ * back to copying them behind the header if the reply can't be sent in parts.
+ * If the reply is taken in parts the pinned generation is unpinned by the
+ * sending function once the registers are sent, otherwise here.
+ * @param[in] ctx Modbus context
+ * @param[in] rsp Header of the reply, room for the registers behind it
+ * @param[in] rsp_length Length of the header
+ * @param[in] payload Registers
+ * @param[in] payload_length Length of the registers
+ * @param[in] generation Pinned generation of the shadow holding payload
+ * @return Number of bytes sent
+ * @retval -1 on failure
+ */
+static int send_msgv(modbus_t *ctx, uint8_t *rsp, int rsp_length, const uint8_t *payload, int payload_length,
+                     int generation)
+{
+    struct iovec iov[2];
+    int msg_length;
+    int rc;
+
+    msg_length = ctx->backend->send_msg_pre(rsp, rsp_length + payload_length);
+    iov[0].iov_base = rsp;
+    iov[0].iov_len = rsp_length;
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = msg_length - rsp_length;
+    rc = modbus_replySendv(ctx, iov, 2, generation);
+    if (rc < 0)
+    {
+        memcpy(&rsp[rsp_length], payload, payload_length);
+        modbus_unpinReadShadow(generation);
+        return send_msg(ctx, rsp, rsp_length + payload_length);
+    }
+    if (rc != msg_length)
+    {
+        errno = EMBBADDATA;
+        return -1;
+    }
+    return rc;
+}
+
+/**
+ * @brief Replacement for the flush function of the libmodbus backend.
+ * Further data in the socket belongs to the next requests.
+ * @param[in] ctx Modbus context
+ * @return Always 0
+ */
+static int modbus_captureFlush(modbus_t *ctx)
+{
+    UNUSED(ctx);
+    return 0;
+}
+
 int modbus_reply_offset(modbus_t *ctx, const uint8_t *req, int req_length, modbus_mapping_t *mb_mapping, uint16_t address_offset)
 {
     int rc;
@@ -145,16 +292,14 @@ int modbus_reply_offset(modbus_t *ctx, const uint8_t *req, int req_length, modbu
     uint16_t address = (req[offset + 1] << 8) + req[offset + 2];
     uint8_t rsp[MAX_RESPONSE_MESSAGE_LENGTH];
     int rsp_length = 0;
+    const uint8_t *payload = NULL; /* Registers sent from the shadow behind rsp */
+    int payload_length = 0;
+    int generation = 0;
     sft_t sft;
     /*Calculate the mapping address - BrT*/
-    int mapping_address = address;
-    mapping_address -= address_offset;
-    if (mapping_address < 0)
-    {
-        //Error not possible to send with negativ address
-        fprintf(stderr, "Illegal data address offset %0X to given address %0X\n", address_offset, address);
-        return -1;
-    }
+    /*Wraps around if a region starts below its entry in the mapping, the
+     *mapping address is checked against the size of the mapping*/
+    uint16_t mapping_address = address - address_offset;
 
     //Only overwrite address if not FC23
     if (function != _FC_WRITE_AND_READ_REGISTERS)
@@ -254,14 +399,17 @@ int modbus_reply_offset(modbus_t *ctx, const uint8_t *req, int req_length, modbu
                 } 
                 else 
                 {
-                    int i;
-
                     rsp_length = ctx->backend->build_response_basis(&sft, rsp);
                     rsp[rsp_length++] = nb << 1;
-                    for (i = address; i < address + nb; i++) 
+                    payload = modbus_referRegisters(ctx, mb_mapping, address, nb, &generation);
+                    if (payload != NULL)
+                    {
+                        payload_length = nb << 1;
+                    }
+                    else
                     {
-                        rsp[rsp_length++] = mb_mapping->tab_registers[i] >> 8;
-                        rsp[rsp_length++] = mb_mapping->tab_registers[i] & 0xFF;
+                        modbus_copyRegisters(&rsp[rsp_length], mb_mapping, address, nb);
+                        rsp_length += nb << 1;
                     }
                 }
             }
@@ -290,15 +438,10 @@ int modbus_reply_offset(modbus_t *ctx, const uint8_t *req, int req_length, modbu
                 } 
                 else 
                 {
-                    int i;
-
                     rsp_length = ctx->backend->build_response_basis(&sft, rsp);
                     rsp[rsp_length++] = nb << 1;
-                    for (i = address; i < address + nb; i++) 
-                    {
-                        rsp[rsp_length++] = mb_mapping->tab_input_registers[i] >> 8;
-                        rsp[rsp_length++] = mb_mapping->tab_input_registers[i] & 0xFF;
-                    }
+                    utils_copyWordsBE(&rsp[rsp_length], &mb_mapping->tab_input_registers[address], nb);
+                    rsp_length += nb << 1;
                 }
             }
             break;
@@ -392,12 +535,8 @@ int modbus_reply_offset(modbus_t *ctx, const uint8_t *req, int req_length, modbu
                 } 
                 else 
                 {
-                    int i, j;
-                    for (i = address, j = 6; i < address + nb; i++, j += 2) 
-                    {
-                        /* 6 and 7 = first value */
-                        mb_mapping->tab_registers[i] = (req[offset + j] << 8) + req[offset + j + 1];
-                    }
+                    /* 6 and 7 = first value */
+                    utils_copyWordsBE(&mb_mapping->tab_registers[address], &req[offset + 6], nb);
 
                     rsp_length = ctx->backend->build_response_basis(&sft, rsp);
                     /* 4 to copy the address (2) and the no. of registers */
@@ -475,23 +614,19 @@ int modbus_reply_offset(modbus_t *ctx, const uint8_t *req, int req_length, modbu
                     /** BrT - Get the correct mapping and write address*/
                     modbus_mapping_t *write_mapping = modbus_getWriteMapping(&address_write);
 
-                    if (write_mapping == NULL)
+                    if ((write_mapping == NULL) || ((address_write + nb_write) > write_mapping->nb_registers))
                     {
                         //Illegal Data address
                         rsp_length = response_exception(ctx, &sft, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
                     }
                     else
                     {
-                        int i, j;
                         rsp_length = ctx->backend->build_response_basis(&sft, rsp);
                         rsp[rsp_length++] = nb << 1;
 
                         /* Write first.
                            10 and 11 are the offset of the first values to write */
-                        for (i = address_write, j = 10; i < address_write + nb_write; i++, j += 2) 
-                        {
-                            write_mapping->tab_registers[i] = (req[offset + j] << 8) + req[offset + j + 1];
-                        }
+                        utils_copyWordsBE(&write_mapping->tab_registers[address_write], &req[offset + 10], nb_write);
 
                         //Here we need a kbus cycle
                         if (modbus_replyCallback != NULL)
@@ -500,18 +635,15 @@ int modbus_reply_offset(modbus_t *ctx, const uint8_t *req, int req_length, modbu
                         /* and read the data for the response */
                         modbus_mapping_t *read_mapping = modbus_getReadMapping(&address);
 
-                        if (read_mapping == NULL)
+                        if ((read_mapping == NULL) || ((address + nb) > read_mapping->nb_registers))
                         {
                             //Illegal Data address
                             rsp_length = response_exception(ctx, &sft, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
                         }
                         else
                         {
-                            for (i = address; i < address + nb; i++) 
-                            {
-                                rsp[rsp_length++] = read_mapping->tab_registers[i] >> 8;
-                                rsp[rsp_length++] = read_mapping->tab_registers[i] & 0xFF;
-                            }
+                            modbus_copyRegisters(&rsp[rsp_length], read_mapping, address, nb);
+                            rsp_length += nb << 1;
                         }
                     }
                 }
@@ -519,49 +651,106 @@ int modbus_reply_offset(modbus_t *ctx, const uint8_t *req, int req_length, modbu
             break;
         case _FC_READ_INPUT_REGISTERS_XL: 
             {
+                /* Reads the registers also read by FC3, up to the end of the
+                 * KBUS image in the area and as many as fit into the reply
+                 * buffer */
                 int nb = (req[offset + 3] << 8) + req[offset + 4];
+                int max_nb = (MAX_RESPONSE_MESSAGE_LENGTH - offset - ctx->backend->checksum_length - 3) >> 1;
+                int nb_image = modbus_getImageRegisters(mb_mapping);
 
-                if (nb < 1 || MODBUS_MAX_READ_REGISTERS_FC66 < nb) 
+                if (max_nb > MODBUS_MAX_READ_REGISTERS_FC66)
+                {
+                    max_nb = MODBUS_MAX_READ_REGISTERS_FC66;
+                }
+                if (nb < 1 || max_nb < nb) 
                 {
                     if (ctx->debug) 
                     {
-                        fprintf(stderr, "Illegal number of values %d in read_input_registers_xl (max %d)\n", nb, MODBUS_MAX_READ_REGISTERS);
+                        fprintf(stderr, "Illegal number of values %d in read_input_registers_xl (max %d)\n", nb, max_nb);
                     }
                     rsp_length = response_exception(ctx, &sft, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, rsp);
                 } 
-                else if ((address + nb) > mb_mapping->nb_input_registers) 
+                else if (address >= nb_image) 
                 {
                     if (ctx->debug) 
                     {
-                        fprintf(stderr, "Illegal data address %0X in read_input_registers_xl\n", address + nb);
+                        fprintf(stderr, "Illegal data address %0X in read_input_registers_xl\n", address);
                     }
                     rsp_length = response_exception(ctx, &sft, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
                 } 
                 else 
                 {
-                    int i;
-                    int nb_bytes = nb << 1;
+                    int nb_bytes;
+
+                    if ((address + nb) > nb_image)
+                    {
+                        nb = nb_image - address;
+                    }
+                    nb_bytes = nb << 1;
                     rsp_length = ctx->backend->build_response_basis(&sft, rsp);
                     rsp[rsp_length++] = nb_bytes >> 8;
                     rsp[rsp_length++] = nb_bytes & 0xFF;
-                    for (i = address; i < address + nb; i++) 
+                    payload = modbus_referRegisters(ctx, mb_mapping, address, nb, &generation);
+                    if (payload != NULL)
+                    {
+                        payload_length = nb_bytes;
+                    }
+                    else
                     {
-                        rsp[rsp_length++] = mb_mapping->tab_input_registers[i] >> 8;
-                        rsp[rsp_length++] = mb_mapping->tab_input_registers[i] & 0xFF;
+                        modbus_copyRegisters(&rsp[rsp_length], mb_mapping, address, nb);
+                        rsp_length += nb_bytes;
                     }
                 }
             }
             break;
+        case _FC_WRITE_MULTIPLE_REGISTERS_XL: 
+            {
+                /* Like FC16 with a byte count of two bytes */
+                int nb = (req[offset + 3] << 8) + req[offset + 4];
+                int nb_bytes = (req[offset + 5] << 8) + req[offset + 6];
+                int max_nb = (MAX_REQUEST_MESSAGE_LENGTH - offset - ctx->backend->checksum_length - 7) >> 1;
+
+                if (nb < 1 || max_nb < nb || nb_bytes != (nb << 1) || req_length < (offset + 7 + nb_bytes)) 
+                {
+                    if (ctx->debug) 
+                    {
+                        fprintf(stderr, "Illegal number of values %d in write_registers_xl (max %d)\n", nb, max_nb);
+                    }
+                    rsp_length = response_exception(ctx, &sft, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE, rsp);
+                } 
+                else if ((address + nb) > mb_mapping->nb_registers) 
+                {
+                    if (ctx->debug) 
+                    {
+                        fprintf(stderr, "Illegal data address %0X in write_registers_xl\n", address + nb);
+                    }
+                    rsp_length = response_exception(ctx, &sft, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS, rsp);
+                } 
+                else 
+                {
+                    /* 7 and 8 = first value */
+                    utils_copyWordsBE(&mb_mapping->tab_registers[address], &req[offset + 7], nb);
+
+                    rsp_length = ctx->backend->build_response_basis(&sft, rsp);
+                    /* 4 to copy the address (2) and the no. of registers */
+                    memcpy(rsp + rsp_length, req + rsp_length, 4);
+                    rsp_length += 4;
+                }
+            }
+            break;
         default:
             rsp_length = response_exception(ctx, &sft, MODBUS_EXCEPTION_ILLEGAL_FUNCTION, rsp);
             break;
     }
 
-    wait_response_delay();
     if ((_MODBUS_BACKEND_TYPE_RTU == ctx->backend->backend_type) && (MODBUS_BROADCAST_ADDRESS == slave))
     { /* No response on RTU broadcasts */
         rc = 0;
     }
+    else if (payload != NULL)
+    {
+        rc = send_msgv(ctx, rsp, rsp_length, payload, payload_length, generation);
+    }
     else 
     {
         rc = send_msg(ctx, rsp, rsp_length);
@@ -569,6 +758,540 @@ int modbus_reply_offset(modbus_t *ctx, const uint8_t *req, int req_length, modbu
     return rc;
 }
 
+/**
+ * @brief Copy bits between packed bit arrays, least significant bit first
+ * @param[out] dest Destination
+ * @param[in] dest_bit First bit of the destination
+ * @param[in] src Source
+ * @param[in] src_bit First bit of the source
+ * @param[in] nb Number of bits
+ */
+static void modbus_copyBits(uint8_t *dest, int dest_bit, const uint8_t *src, int src_bit, int nb)
+{
+    int i;
+
+    for (i = 0; i < nb; i++)
+    {
+        int s = src_bit + i;
+        int d = dest_bit + i;
+
+        if (src[s / 8] & (1 << (s % 8)))
+        {
+            dest[d / 8] |= (1 << (d % 8));
+        }
+        else
+        {
+            dest[d / 8] &= ~(1 << (d % 8));
+        }
+    }
+}
+
+/**
+ * @brief Let the configuration parser of a region serve a part of a
+ * gathered request
+ * @param[in] ctx Modbus context of the request
+ * @param[in] req Gathered request, its header is reused
+ * @param[in] function Function code of the part, FC1, FC2, FC3, FC4, FC15 or FC16
+ * @param[in] region Region with a parser
+ * @param[in] address First address of the part
+ * @param[in] nb Number of values of the part
+ * @param[in,out] data Values of the whole request in the format of the PDU
+ * @param[in] index Position of the part in data
+ * @return Exception code of the parser
+ * @retval 0 on success
+ */
+static int modbus_gatherHandler(modbus_t *ctx, const uint8_t *req, int function, const modbusMap_region_t *region,
+                                uint16_t address, int nb, uint8_t *data, int index)
+{
+    int offset = ctx->backend->header_length;
+    uint8_t sub[MODBUS_TCP_MAX_ADU_LENGTH];
+    int sub_length = offset;
+    modbus_capture_t capture;
+    int nb_bytes;
+
+    //Request of the part with the header of the gathered request
+    memcpy(sub, req, offset);
+    sub[sub_length++] = function;
+    sub[sub_length++] = address >> 8;
+    sub[sub_length++] = address & 0xFF;
+    sub[sub_length++] = nb >> 8;
+    sub[sub_length++] = nb & 0xFF;
+    if (function == _FC_WRITE_MULTIPLE_REGISTERS)
+    {
+        sub[sub_length++] = nb << 1;
+        memcpy(&sub[sub_length], &data[index << 1], nb << 1);
+        sub_length += nb << 1;
+    }
+    else if (function == _FC_WRITE_MULTIPLE_COILS)
+    {
+        nb_bytes = (nb / 8) + ((nb % 8) ? 1 : 0);
+        sub[sub_length++] = nb_bytes;
+        memset(&sub[sub_length], 0, nb_bytes);
+        modbus_copyBits(&sub[sub_length], 0, data, index, nb);
+        sub_length += nb_bytes;
+    }
+
+    capture.ctx = *ctx;
+    capture.backend = *ctx->backend;
+    capture.backend.send = modbus_captureSend;
+    capture.backend.flush = modbus_captureFlush;
+    capture.ctx.backend = &capture.backend;
+    capture.rsp_length = 0;
+    region->handler(&capture.ctx, sub, sub_length);
+
+    if (capture.rsp_length <= (offset + 1))
+    {
+        return MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE;
+    }
+    if (capture.rsp[offset] & 0x80)
+    {
+        return capture.rsp[offset + 1];
+    }
+
+    switch (function)
+    {
+        case _FC_READ_HOLDING_REGISTERS:
+        case _FC_READ_INPUT_REGISTERS:
+            if ((capture.rsp[offset + 1] != (nb << 1)) || (capture.rsp_length < (offset + 2 + (nb << 1))))
+            {
+                return MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE;
+            }
+            memcpy(&data[index << 1], &capture.rsp[offset + 2], nb << 1);
+            break;
+        case _FC_READ_COILS:
+        case _FC_READ_DISCRETE_INPUTS:
+            nb_bytes = (nb / 8) + ((nb % 8) ? 1 : 0);
+            if ((capture.rsp[offset + 1] != nb_bytes) || (capture.rsp_length < (offset + 2 + nb_bytes)))
+            {
+                return MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE;
+            }
+            modbus_copyBits(data, index, &capture.rsp[offset + 2], 0, nb);
+            break;
+    }
+    return 0;
+}
+
+/**
+ * @brief Transfer a part of a gathered request from or to the mappings of
+ * a region
+ * @param[in] function Function code of the request
+ * @param[in] region Region with mappings
+ * @param[in] address First address of the part
+ * @param[in] nb Number of values of the part
+ * @param[in,out] data Values of the whole request in the format of the PDU
+ * @param[in] index Position of the part in data
+ * @param[in] apply FALSE to check the part only
+ * @return Exception code
+ * @retval 0 on success
+ */
+static int modbus_gatherMapping(int function, const modbusMap_region_t *region, uint16_t address, int nb,
+                                uint8_t *data, int index, int apply)
+{
+    modbus_mapping_t *mapping;
+    uint16_t mapping_address = address - region->base;
+    uint8_t bits[(MODBUS_MAX_READ_BITS / 8) + 1];
+    int size;
+
+    if ((function == _FC_WRITE_MULTIPLE_COILS) || (function == _FC_WRITE_MULTIPLE_REGISTERS))
+    {
+        mapping = region->write_mapping;
+    }
+    else
+    {
+        mapping = region->read_mapping;
+    }
+
+    switch (function)
+    {
+        case _FC_READ_COILS:
+        case _FC_WRITE_MULTIPLE_COILS:
+            size = mapping->nb_bits;
+            break;
+        case _FC_READ_DISCRETE_INPUTS:
+            size = mapping->nb_input_bits;
+            break;
+        case _FC_READ_INPUT_REGISTERS:
+            size = mapping->nb_input_registers;
+            break;
+        default:
+            size = mapping->nb_registers;
+            break;
+    }
+    if ((mapping_address + nb) > size)
+    {
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+    if (!apply)
+    {
+        return 0;
+    }
+
+    switch (function)
+    {
+        case _FC_READ_COILS:
+            modbus_get_bytes_from_bitmap16(mapping->tab_bits, mapping_address, nb, bits);
+            modbus_copyBits(data, index, bits, 0, nb);
+            break;
+        case _FC_READ_DISCRETE_INPUTS:
+            modbus_get_bytes_from_bitmap16(mapping->tab_input_bits, mapping_address, nb, bits);
+            modbus_copyBits(data, index, bits, 0, nb);
+            break;
+        case _FC_READ_HOLDING_REGISTERS:
+            modbus_copyRegisters(&data[index << 1], mapping, mapping_address, nb);
+            break;
+        case _FC_READ_INPUT_REGISTERS:
+            utils_copyWordsBE(&data[index << 1], &mapping->tab_input_registers[mapping_address], nb);
+            break;
+        case _FC_WRITE_MULTIPLE_COILS:
+            memset(bits, 0, sizeof(bits));
+            modbus_copyBits(bits, 0, data, index, nb);
+            modbus_set_bitmap16_from_bytes(mapping->tab_bits, mapping_address, nb, bits);
+            break;
+        case _FC_WRITE_MULTIPLE_REGISTERS:
+            utils_copyWordsBE(&mapping->tab_registers[mapping_address], &data[index << 1], nb);
+            break;
+    }
+    return 0;
+}
+
+/**
+ * @brief Walk through the regions of a gathered request
+ * @param[in] ctx Modbus context of the request
+ * @param[in] req Gathered request
+ * @param[in] function Function code, FC1, FC2, FC3, FC4, FC15 or FC16
+ * @param[in] space Address space of the request
+ * @param[in] address Start address of the request
+ * @param[in] nb Number of values of the request
+ * @param[in,out] data Values of the request in the format of the PDU
+ * @param[in] apply FALSE to check the request only, parsers are not called.
+ * A parser checks its part only while it is applied, so the check rejects
+ * a write which covers a region with a parser and any other part.
+ * @return Exception code
+ * @retval 0 on success
+ */
+static int modbus_gatherWalk(modbus_t *ctx, const uint8_t *req, int function, modbusMap_space_t space,
+                             uint16_t address, int nb, uint8_t *data, int apply)
+{
+    uint8_t access = MODBUSMAP_ACCESS_READ;
+    int index = 0;
+    int parts = 0;
+    char parser = FALSE;
+    int exception;
+
+    if ((function == _FC_WRITE_MULTIPLE_COILS) || (function == _FC_WRITE_MULTIPLE_REGISTERS))
+    {
+        access = MODBUSMAP_ACCESS_WRITE;
+    }
+
+    while (index < nb)
+    {
+        uint16_t part_address = address + index;
+        const modbusMap_region_t *region = modbusMap_lookup(space, part_address);
+        int part_nb;
+
+        if (region->access == 0)
+        {
+            //Hole up to the next mapped address, read as 0, writes are discarded
+            if (conf_modbus_hole_policy != CONF_HOLE_POLICY_ZERO)
+            {
+                return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+            }
+            part_nb = 1;
+            while (((index + part_nb) < nb) && (modbusMap_lookup(space, part_address + part_nb)->access == 0))
+            {
+                part_nb++;
+            }
+        }
+        else if ((region->access & access) == 0)
+        {
+            return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        }
+        else
+        {
+            part_nb = region->last - part_address + 1;
+            if (part_nb > (nb - index))
+            {
+                part_nb = nb - index;
+            }
+            if (region->handler != NULL)
+            {
+                //Parsers take at most a standard request, longer scatter ranges are split
+                if ((part_nb > MODBUS_MAX_READ_REGISTERS) &&
+                    ((function == _FC_READ_HOLDING_REGISTERS) || (function == _FC_READ_INPUT_REGISTERS)))
+                {
+                    part_nb = MODBUS_MAX_READ_REGISTERS;
+                }
+                exception = apply ? modbus_gatherHandler(ctx, req, function, region, part_address, part_nb, data, index) : 0;
+                parser = TRUE;
+            }
+            else
+            {
+                exception = modbus_gatherMapping(function, region, part_address, part_nb, data, index, apply);
+            }
+            if (exception != 0)
+            {
+                return exception;
+            }
+        }
+        index += part_nb;
+        parts++;
+    }
+
+    if (!apply && parser && (parts > 1))
+    {
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reply to a read or write request spanning several regions of the
+ * address map, see modbus_map.c. The response is assembled from all regions,
+ * unmapped addresses are handled according to conf_modbus_hole_policy.
+ * Handles FC1, FC2, FC3, FC4, FC15 and FC16. A write is checked against all
+ * regions before any value is written, a write to a region served by a
+ * configuration parser has to stay within this region.
+ * @param[in] ctx Modbus context
+ * @param[in] req Request
+ * @param[in] req_length Length of the request
+ * @param[in] space Address space of the request
+ * @return Length of the reply sent
+ * @retval -1 on failure
+ */
+int modbus_reply_gather(modbus_t *ctx, const uint8_t *req, int req_length, modbusMap_space_t space)
+{
+    int offset = ctx->backend->header_length;
+    int slave = req[offset - 1];
+    int function = req[offset];
+    uint16_t address = (req[offset + 1] << 8) + req[offset + 2];
+    int nb = (req[offset + 3] << 8) + req[offset + 4];
+    uint8_t data[MAX_RESPONSE_MESSAGE_LENGTH];
+    uint8_t rsp[MAX_RESPONSE_MESSAGE_LENGTH];
+    int rsp_length = 0;
+    int nb_bytes = 0;
+    int max_nb = 0;
+    int exception = 0;
+    sft_t sft;
+
+    if (ctx->backend->filter_request(ctx, slave) == 1)
+    {
+        /* Filtered */
+        return 0;
+    }
+
+    sft.slave = slave;
+    sft.function = function;
+    sft.t_id = ctx->backend->prepare_response_tid(req, &req_length);
+
+    switch (function)
+    {
+        case _FC_READ_COILS:
+        case _FC_READ_DISCRETE_INPUTS:
+            max_nb = MODBUS_MAX_READ_BITS;
+            nb_bytes = (nb / 8) + ((nb % 8) ? 1 : 0);
+            break;
+        case _FC_WRITE_MULTIPLE_COILS:
+            max_nb = MODBUS_MAX_WRITE_BITS;
+            nb_bytes = (nb / 8) + ((nb % 8) ? 1 : 0);
+            break;
+        case _FC_READ_HOLDING_REGISTERS:
+        case _FC_READ_INPUT_REGISTERS:
+            max_nb = MODBUS_MAX_READ_REGISTERS;
+            nb_bytes = nb << 1;
+            break;
+        case _FC_WRITE_MULTIPLE_REGISTERS:
+            max_nb = MODBUS_MAX_WRITE_REGISTERS;
+            nb_bytes = nb << 1;
+            break;
+        default:
+            exception = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+            break;
+    }
+
+    if (exception != 0)
+    {
+        if (ctx->debug)
+        {
+            fprintf(stderr, "Function %0X can not be gathered\n", function);
+        }
+    }
+    else if ((nb < 1) || (max_nb < nb))
+    {
+        if (ctx->debug)
+        {
+            fprintf(stderr, "Illegal nb of values %d in gathered request (max %d)\n", nb, max_nb);
+        }
+        exception = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+    }
+    else if ((address + nb) > 0x10000)
+    {
+        exception = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+    else if ((function == _FC_WRITE_MULTIPLE_COILS) || (function == _FC_WRITE_MULTIPLE_REGISTERS))
+    {
+        /* 5 = byte count, 6 = first value */
+        if ((req[offset + 5] != nb_bytes) || (req_length < (offset + 6 + nb_bytes)))
+        {
+            exception = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+        }
+        else
+        {
+            memcpy(data, &req[offset + 6], nb_bytes);
+            exception = modbus_gatherWalk(ctx, req, function, space, address, nb, data, FALSE);
+            if (exception == 0)
+            {
+                exception = modbus_gatherWalk(ctx, req, function, space, address, nb, data, TRUE);
+            }
+        }
+    }
+    else
+    {
+        memset(data, 0, nb_bytes);
+        exception = modbus_gatherWalk(ctx, req, function, space, address, nb, data, TRUE);
+    }
+
+    if (exception != 0)
+    {
+        rsp_length = response_exception(ctx, &sft, exception, rsp);
+    }
+    else if ((function == _FC_WRITE_MULTIPLE_COILS) || (function == _FC_WRITE_MULTIPLE_REGISTERS))
+    {
+        rsp_length = ctx->backend->build_response_basis(&sft, rsp);
+        /* 4 to copy the address (2) and the no. of values */
+        memcpy(rsp + rsp_length, req + rsp_length, 4);
+        rsp_length += 4;
+    }
+    else
+    {
+        rsp_length = ctx->backend->build_response_basis(&sft, rsp);
+        rsp[rsp_length++] = nb_bytes;
+        memcpy(&rsp[rsp_length], data, nb_bytes);
+        rsp_length += nb_bytes;
+    }
+
+    if ((_MODBUS_BACKEND_TYPE_RTU == ctx->backend->backend_type) && (MODBUS_BROADCAST_ADDRESS == slave))
+    { /* No response on RTU broadcasts */
+        return 0;
+    }
+    return send_msg(ctx, rsp, rsp_length);
+}
+
+/**
+ * @brief Reply to a scatter read (FC69), a list of register ranges read in
+ * one transaction. Every range is resolved by the address map like a
+ * gathered FC3 request, the values of all ranges follow each other in the
+ * response. All ranges together are bounded by the reply buffer.
+ * Request: number of ranges (1), per range address (2) and number of
+ * registers (2). Response: byte count (2), values.
+ * @param[in] ctx Modbus context
+ * @param[in] req Request
+ * @param[in] req_length Length of the request
+ * @return Length of the reply sent
+ * @retval -1 on failure
+ */
+int modbus_reply_scatter(modbus_t *ctx, const uint8_t *req, int req_length)
+{
+    int offset = ctx->backend->header_length;
+    int slave = req[offset - 1];
+    int function = req[offset];
+    int nb_ranges = req[offset + 1];
+    int max_nb = (MAX_RESPONSE_MESSAGE_LENGTH - offset - ctx->backend->checksum_length - 3) >> 1;
+    uint8_t rsp[MAX_RESPONSE_MESSAGE_LENGTH];
+    int rsp_length = 0;
+    int nb_total = 0;
+    int exception = 0;
+    int index = 0;
+    int i;
+    sft_t sft;
+
+    if (ctx->backend->filter_request(ctx, slave) == 1)
+    {
+        /* Filtered */
+        return 0;
+    }
+
+    sft.slave = slave;
+    sft.function = function;
+    sft.t_id = ctx->backend->prepare_response_tid(req, &req_length);
+
+    /* 2 = first range */
+    if ((nb_ranges < 1) || (req_length < (offset + 2 + (nb_ranges * 4))))
+    {
+        exception = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+    }
+    for (i = 0; (i < nb_ranges) && (exception == 0); i++)
+    {
+        const uint8_t *range = &req[offset + 2 + (i * 4)];
+        uint16_t address = (range[0] << 8) + range[1];
+        int nb = (range[2] << 8) + range[3];
+
+        nb_total += nb;
+        if ((nb < 1) || (nb_total > max_nb))
+        {
+            if (ctx->debug)
+            {
+                fprintf(stderr, "Illegal nb of values %d in scatter read (max %d in total)\n", nb, max_nb);
+            }
+            exception = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+        }
+        else if ((address + nb) > 0x10000)
+        {
+            exception = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+        }
+    }
+
+    if (exception == 0)
+    {
+        uint8_t *data;
+
+        rsp_length = ctx->backend->build_response_basis(&sft, rsp);
+        /* Values follow the byte count */
+        data = &rsp[rsp_length + 2];
+        memset(data, 0, nb_total << 1);
+        for (i = 0; (i < nb_ranges) && (exception == 0); i++)
+        {
+            const uint8_t *range = &req[offset + 2 + (i * 4)];
+            uint16_t address = (range[0] << 8) + range[1];
+            int nb = (range[2] << 8) + range[3];
+
+            exception = modbus_gatherWalk(ctx, req, _FC_READ_HOLDING_REGISTERS, MODBUSMAP_REGISTERS,
+                                          address, nb, &data[index << 1], TRUE);
+            index += nb;
+        }
+    }
+
+    if (exception != 0)
+    {
+        rsp_length = response_exception(ctx, &sft, exception, rsp);
+    }
+    else
+    {
+        rsp[rsp_length++] = (nb_total << 1) >> 8;
+        rsp[rsp_length++] = (nb_total << 1) & 0xFF;
+        rsp_length += nb_total << 1;
+    }
+
+    if ((_MODBUS_BACKEND_TYPE_RTU == ctx->backend->backend_type) && (MODBUS_BROADCAST_ADDRESS == slave))
+    { /* No response on RTU broadcasts */
+        return 0;
+    }
+    return send_msg(ctx, rsp, rsp_length);
+}
+
+/**
+ * @brief Register a function sending a reply given in parts, used for large
+ * register reads on TCP. The first part is the header and has to be copied,
+ * the others refer to the shadow generation passed along. If the function
+ * takes the reply it unpins this generation once these parts are sent.
+ * @param[in] sendv Function, returns -1 if it doesn't take the reply
+ * @retval 0 on success
+ */
+int modbus_replyRegisterSendv(int (*sendv)(modbus_t *ctx, const struct iovec *iov, int iovcnt, int generation))
+{
+    modbus_replySendv = sendv;
+    return 0;
+}
+
 int modbus_replyRegisterCallback( void (*callback)() )
 {
     if (callback == NULL)
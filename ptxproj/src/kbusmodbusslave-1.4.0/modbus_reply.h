@@ -1,8 +1,17 @@
 #ifndef __MODBUS_REPLY_H__
 #define __MODBUS_REPLY_H__
 
+#include <sys/uio.h>
+#include "modbus_map.h"
+
+#define MAX_RESPONSE_MESSAGE_LENGTH   1450 /**< @brief Maximum length of a reply, given by the FC66 response */
+#define MAX_REQUEST_MESSAGE_LENGTH    1450 /**< @brief Maximum length of a request, given by the FC67 request */
+
 int modbus_reply_offset(modbus_t *ctx, const uint8_t *req, int req_length, modbus_mapping_t *mb_mapping, uint16_t address_offset);
+int modbus_reply_gather(modbus_t *ctx, const uint8_t *req, int req_length, modbusMap_space_t space);
+int modbus_reply_scatter(modbus_t *ctx, const uint8_t *req, int req_length);
 
 int modbus_replyRegisterCallback( void (*callback)() );
+int modbus_replyRegisterSendv(int (*sendv)(modbus_t *ctx, const struct iovec *iov, int iovcnt, int generation));
 
 #endif /* __MODBUS_REPLY_H__ */
@@ -0,0 +1,382 @@
+//------------------------------------------------------------------------------
+/// Copyright (c) WAGO Kontakttechnik GmbH & Co. KG
+///
+/// PROPRIETARY RIGHTS are involved in the subject matter of this material.
+/// All manufacturing, reproduction, use and sales rights pertaining to this
+/// subject matter are governed by the license agreement. The recipient of this
+/// software implicitly accepts the terms of the license.
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+///
+///  \file     modbus_stats.c
+///
+///  \brief    Throughput counters of the modbus services. The counters are
+///            incremented lock free by all modbus threads and written
+///            together with their rate to a file by the main loop.
+///            Modules with detailed statistics register a writer which
+///            appends its own section to the file.
+///            System calls sending replies are counted per function code.
+///            Every thread counts them for the request it handled last,
+///            so a reply batch is counted for its last request.
+///            Replies delayed by modbus_delay_ms are counted in a histogram
+///            of the time they were sent behind their due time.
+///
+///  \author   <BrT> : WAGO Kontakttechnik GmbH & Co. KG
+//------------------------------------------------------------------------------
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "modbus_stats.h"
+#include "utils.h"
+
+#define MODBUSSTATS_FILE_NAME "/tmp/kbusmodbusslave.stats"  /**< @brief File with actual counter values */
+#define MODBUSSTATS_TMP_FILE_NAME MODBUSSTATS_FILE_NAME".tmp" /**< @brief Written first, then renamed */
+#define MODBUSSTATS_MAX_WRITERS 8                           /**< @brief Maximum number of registered writers */
+
+/**
+ * @brief Names of the counters as written to the statistics file
+ */
+static const char *modbusStats_names[MODBUSSTATS_COUNT] = {
+    "udp_rx_calls",
+    "udp_rx_datagrams",
+    "udp_rx_bytes",
+    "udp_rx_invalid",
+    "udp_tx_calls",
+    "udp_tx_datagrams",
+    "udp_tx_bytes",
+    "udp_tx_dropped",
+    "tcp_accepted",
+    "tcp_refused",
+    "tcp_evicted",
+    "tcp_idle_closed",
+    "lane_priority_requests",
+    "lane_priority_wait_us",
+    "lane_process_requests",
+    "lane_process_wait_us",
+    "subscribe_notifications",
+    "subscribe_bytes",
+    "subscribe_dropped",
+    "deadband_suppressed"
+};
+
+#define MODBUSSTATS_LANES 2     /**< @brief Number of request lanes, see modbus_lane_t */
+
+/**
+ * @brief Names of the request lanes
+ */
+static const char *modbusStats_laneNames[MODBUSSTATS_LANES] = {
+    "priority",
+    "process"
+};
+
+static uint64_t modbusStats_counters[MODBUSSTATS_COUNT];   /**< @brief Actual counter values */
+static uint64_t modbusStats_lastCounters[MODBUSSTATS_COUNT]; /**< @brief Counter values of the last write */
+static struct timespec modbusStats_lastTime;                /**< @brief Time of the last write */
+static uint32_t modbusStats_laneMax[MODBUSSTATS_LANES];     /**< @brief Maximum queue wait time per lane since the last write */
+static void (* volatile modbusStats_writers[MODBUSSTATS_MAX_WRITERS])(FILE *fp); /**< @brief Writers of detailed sections */
+
+#define MODBUSSTATS_FUNCTIONS 256 /**< @brief Number of function codes */
+
+static uint64_t modbusStats_fcRequests[MODBUSSTATS_FUNCTIONS];     /**< @brief Handled requests per function code */
+static uint64_t modbusStats_fcSyscalls[MODBUSSTATS_FUNCTIONS];     /**< @brief System calls sending replies per function code */
+static uint64_t modbusStats_fcLastRequests[MODBUSSTATS_FUNCTIONS]; /**< @brief Requests at the last write */
+static uint64_t modbusStats_fcLastSyscalls[MODBUSSTATS_FUNCTIONS]; /**< @brief System calls at the last write */
+static __thread int modbusStats_function = -1; /**< @brief Function code of the request handled last by this thread */
+
+#define MODBUSSTATS_DELAY_BUCKETS 8 /**< @brief Buckets of the delay histogram */
+
+/**
+ * @brief Upper limits of the delay histogram buckets in us, the last bucket
+ * takes everything above
+ */
+static const uint32_t modbusStats_delayLimits[MODBUSSTATS_DELAY_BUCKETS - 1] = {
+    50, 100, 250, 500, 1000, 2000, 5000
+};
+
+static uint64_t modbusStats_delayHistogram[MODBUSSTATS_DELAY_BUCKETS]; /**< @brief Delayed reply batches per lateness bucket */
+static uint32_t modbusStats_delayMax;                                   /**< @brief Maximum lateness in us since the last write */
+
+/**
+ * @brief Reset all counters
+ * @retval 0 on success
+ */
+int modbusStats_init(void)
+{
+    memset(modbusStats_counters, 0, sizeof(modbusStats_counters));
+    memset(modbusStats_lastCounters, 0, sizeof(modbusStats_lastCounters));
+    memset(modbusStats_fcRequests, 0, sizeof(modbusStats_fcRequests));
+    memset(modbusStats_fcSyscalls, 0, sizeof(modbusStats_fcSyscalls));
+    memset(modbusStats_fcLastRequests, 0, sizeof(modbusStats_fcLastRequests));
+    memset(modbusStats_fcLastSyscalls, 0, sizeof(modbusStats_fcLastSyscalls));
+    memset(modbusStats_delayHistogram, 0, sizeof(modbusStats_delayHistogram));
+    modbusStats_delayMax = 0;
+    clock_gettime(CLOCK_MONOTONIC, &modbusStats_lastTime);
+    return 0;
+}
+
+/**
+ * @brief Remove the statistics file
+ */
+void modbusStats_deInit(void)
+{
+    remove(MODBUSSTATS_FILE_NAME);
+}
+
+/**
+ * @brief Increment a counter. May be called by any thread.
+ * @param[in] counter Counter to be incremented
+ * @param[in] value Increment
+ */
+void modbusStats_add(modbusStats_counter_t counter, uint32_t value)
+{
+    __sync_fetch_and_add(&modbusStats_counters[counter], value);
+}
+
+/**
+ * @brief Count a served request of a lane and its queue wait time. May be
+ * called by any thread.
+ * @param[in] lane Lane of the request as given by modbus_classify()
+ * @param[in] wait_us Time the request waited for service in us
+ */
+void modbusStats_addLaneWait(int lane, uint32_t wait_us)
+{
+    uint32_t max;
+    int base = MODBUSSTATS_LANE_PRIORITY_REQUESTS + lane * 2;
+
+    if ((lane < 0) || (lane >= MODBUSSTATS_LANES))
+    {
+        return;
+    }
+    __sync_fetch_and_add(&modbusStats_counters[base], 1);
+    __sync_fetch_and_add(&modbusStats_counters[base + 1], wait_us);
+
+    max = modbusStats_laneMax[lane];
+    while ((wait_us > max) && !__sync_bool_compare_and_swap(&modbusStats_laneMax[lane], max, wait_us))
+    {
+        max = modbusStats_laneMax[lane];
+    }
+}
+
+/**
+ * @brief Count a request handled by the calling thread. Following system
+ * calls of the thread are counted for its function code.
+ * @param[in] function Function code of the request
+ */
+void modbusStats_beginRequest(uint8_t function)
+{
+    modbusStats_function = function;
+    __sync_fetch_and_add(&modbusStats_fcRequests[function], 1);
+}
+
+/**
+ * @brief Count system calls sending replies for the request handled last by
+ * the calling thread. Ignored if the thread did not handle a request yet.
+ * @param[in] count Number of system calls
+ */
+void modbusStats_addSyscalls(uint32_t count)
+{
+    if (modbusStats_function >= 0)
+    {
+        __sync_fetch_and_add(&modbusStats_fcSyscalls[modbusStats_function], count);
+    }
+}
+
+/**
+ * @brief Count replies sent after a response delay. May be called by any
+ * thread.
+ * @param[in] late_us Time in us the replies were sent behind their due time
+ */
+void modbusStats_addDelayLateness(uint32_t late_us)
+{
+    uint32_t max;
+    int i;
+
+    for (i = 0; i < (MODBUSSTATS_DELAY_BUCKETS - 1); i++)
+    {
+        if (late_us < modbusStats_delayLimits[i])
+        {
+            break;
+        }
+    }
+    __sync_fetch_and_add(&modbusStats_delayHistogram[i], 1);
+
+    max = modbusStats_delayMax;
+    while ((late_us > max) && !__sync_bool_compare_and_swap(&modbusStats_delayMax, max, late_us))
+    {
+        max = modbusStats_delayMax;
+    }
+}
+
+/**
+ * @brief Write the histogram of the lateness of delayed replies
+ * @param[in] fp Statistics file
+ */
+static void modbusStats_writeDelay(FILE *fp)
+{
+    char name[24];
+    int i;
+
+    fprintf(fp, "%-24s %20s\n", "delay_late_us", "replies");
+    for (i = 0; i < MODBUSSTATS_DELAY_BUCKETS; i++)
+    {
+        if (i < (MODBUSSTATS_DELAY_BUCKETS - 1))
+        {
+            snprintf(name, sizeof(name), "<%u", modbusStats_delayLimits[i]);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), ">=%u", modbusStats_delayLimits[i - 1]);
+        }
+        fprintf(fp, "%-24s %20llu\n", name, (unsigned long long)__sync_fetch_and_add(&modbusStats_delayHistogram[i], 0));
+    }
+    fprintf(fp, "%-24s %20u\n", "max", __sync_lock_test_and_set(&modbusStats_delayMax, 0));
+}
+
+/**
+ * @brief Write the requests and the system calls sending their replies per
+ * function code, with the system calls per request since the last write
+ * @param[in] fp Statistics file
+ */
+static void modbusStats_writeFunctions(FILE *fp)
+{
+    int i;
+
+    fprintf(fp, "%-24s %20s %20s %12s\n", "function", "requests", "syscalls", "per_request");
+    for (i = 0; i < MODBUSSTATS_FUNCTIONS; i++)
+    {
+        uint64_t requests = __sync_fetch_and_add(&modbusStats_fcRequests[i], 0);
+        uint64_t syscalls = __sync_fetch_and_add(&modbusStats_fcSyscalls[i], 0);
+        uint64_t interval = requests - modbusStats_fcLastRequests[i];
+
+        if (requests == 0)
+        {
+            continue;
+        }
+        fprintf(fp, "fc%-22d %20llu %20llu %12.2f\n", i, (unsigned long long)requests, (unsigned long long)syscalls,
+                (interval > 0) ? (double)(syscalls - modbusStats_fcLastSyscalls[i]) / interval : 0.0);
+        modbusStats_fcLastRequests[i] = requests;
+        modbusStats_fcLastSyscalls[i] = syscalls;
+    }
+}
+
+/**
+ * @brief Write all counters and their rate per second since the last call
+ * to the statistics file. The file is replaced atomically, so readers never
+ * see a partially written file.
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+int modbusStats_write(void)
+{
+    uint64_t previous[MODBUSSTATS_COUNT];
+    struct timespec now;
+    double elapsed;
+    FILE *fp;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - modbusStats_lastTime.tv_sec) + (now.tv_nsec - modbusStats_lastTime.tv_nsec) / 1e9;
+    if (elapsed <= 0)
+    {
+        return 0;
+    }
+
+    fp = fopen(MODBUSSTATS_TMP_FILE_NAME, "w");
+    if (fp == NULL)
+    {
+        dprintf(VERBOSE_STD, "File Create: %s failed: %s\n", MODBUSSTATS_TMP_FILE_NAME, strerror(errno));
+        return -1;
+    }
+
+    fprintf(fp, "%-24s %20s %12s\n", "counter", "total", "per_second");
+    for (i = 0; i < MODBUSSTATS_COUNT; i++)
+    {
+        uint64_t value = __sync_fetch_and_add(&modbusStats_counters[i], 0);
+
+        fprintf(fp, "%-24s %20llu %12.1f\n", modbusStats_names[i], (unsigned long long)value,
+                (value - modbusStats_lastCounters[i]) / elapsed);
+        previous[i] = modbusStats_lastCounters[i];
+        modbusStats_lastCounters[i] = value;
+    }
+    modbusStats_lastTime = now;
+
+    //Queue wait times of the request lanes since the last write
+    fprintf(fp, "\n%-24s %12s %12s\n", "lane", "wait_avg_us", "wait_max_us");
+    for (i = 0; i < MODBUSSTATS_LANES; i++)
+    {
+        int base = MODBUSSTATS_LANE_PRIORITY_REQUESTS + i * 2;
+        uint64_t requests = modbusStats_lastCounters[base] - previous[base];
+        uint64_t wait = modbusStats_lastCounters[base + 1] - previous[base + 1];
+
+        fprintf(fp, "%-24s %12llu %12u\n", modbusStats_laneNames[i],
+                (unsigned long long)((requests > 0) ? (wait / requests) : 0),
+                __sync_lock_test_and_set(&modbusStats_laneMax[i], 0));
+    }
+
+    fprintf(fp, "\n");
+    modbusStats_writeFunctions(fp);
+    fprintf(fp, "\n");
+    modbusStats_writeDelay(fp);
+
+    for (i = 0; i < MODBUSSTATS_MAX_WRITERS; i++)
+    {
+        void (*writer)(FILE *fp) = modbusStats_writers[i];
+
+        if (writer != NULL)
+        {
+            fprintf(fp, "\n");
+            writer(fp);
+        }
+    }
+
+    if (fclose(fp) != 0)
+    {
+        return -2;
+    }
+    if (rename(MODBUSSTATS_TMP_FILE_NAME, MODBUSSTATS_FILE_NAME) < 0)
+    {
+        return -3;
+    }
+    return 0;
+}
+
+/**
+ * @brief Register a writer for a detailed section of the statistics file.
+ * The writer is called by the main loop and must only read its data.
+ * @param[in] writer Function appending its section to the file
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+int modbusStats_registerWriter(void (*writer)(FILE *fp))
+{
+    int i;
+
+    if (writer == NULL)
+    {
+        return -1;
+    }
+    for (i = 0; i < MODBUSSTATS_MAX_WRITERS; i++)
+    {
+        if (__sync_bool_compare_and_swap(&modbusStats_writers[i], NULL, writer))
+        {
+            return 0;
+        }
+    }
+    return -2;
+}
+
+/**
+ * @brief Remove a registered writer
+ * @param[in] writer Function given to modbusStats_registerWriter
+ */
+void modbusStats_unregisterWriter(void (*writer)(FILE *fp))
+{
+    int i;
+
+    for (i = 0; i < MODBUSSTATS_MAX_WRITERS; i++)
+    {
+        __sync_bool_compare_and_swap(&modbusStats_writers[i], writer, NULL);
+    }
+}
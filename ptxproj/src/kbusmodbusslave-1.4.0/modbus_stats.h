@@ -0,0 +1,46 @@
+#ifndef __MODBUS_STATS_H__
+#define __MODBUS_STATS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * @brief Throughput counters of the modbus services
+ */
+typedef enum
+{
+    MODBUSSTATS_UDP_RX_CALLS,       /**< @brief recvmmsg() calls returning datagrams */
+    MODBUSSTATS_UDP_RX_DATAGRAMS,   /**< @brief Received datagrams */
+    MODBUSSTATS_UDP_RX_BYTES,       /**< @brief Received bytes */
+    MODBUSSTATS_UDP_RX_INVALID,     /**< @brief Datagrams without a valid MBAP header */
+    MODBUSSTATS_UDP_TX_CALLS,       /**< @brief sendmmsg() calls */
+    MODBUSSTATS_UDP_TX_DATAGRAMS,   /**< @brief Sent datagrams */
+    MODBUSSTATS_UDP_TX_BYTES,       /**< @brief Sent bytes */
+    MODBUSSTATS_UDP_TX_DROPPED,     /**< @brief Replies which could not be sent */
+    MODBUSSTATS_TCP_ACCEPTED,       /**< @brief Accepted TCP connections */
+    MODBUSSTATS_TCP_REFUSED,        /**< @brief Connections refused because max_tcp_connections was reached */
+    MODBUSSTATS_TCP_EVICTED,        /**< @brief Least recently used connections closed for a new one */
+    MODBUSSTATS_TCP_IDLE_CLOSED,    /**< @brief Connections closed by the idle timeout */
+    MODBUSSTATS_LANE_PRIORITY_REQUESTS, /**< @brief Requests served from the priority lane */
+    MODBUSSTATS_LANE_PRIORITY_WAIT_US,  /**< @brief Sum of queue wait times of the priority lane in us */
+    MODBUSSTATS_LANE_PROCESS_REQUESTS,  /**< @brief Requests served from the process data lane */
+    MODBUSSTATS_LANE_PROCESS_WAIT_US,   /**< @brief Sum of queue wait times of the process data lane in us */
+    MODBUSSTATS_SUBSCRIBE_NOTIFICATIONS, /**< @brief Sent change-of-state notifications */
+    MODBUSSTATS_SUBSCRIBE_BYTES,        /**< @brief Sent notification bytes */
+    MODBUSSTATS_SUBSCRIBE_DROPPED,      /**< @brief Notifications which could not be sent */
+    MODBUSSTATS_DEADBAND_SUPPRESSED,    /**< @brief Changes of analog inputs within their deadband */
+    MODBUSSTATS_COUNT
+} modbusStats_counter_t;
+
+int modbusStats_init(void);
+void modbusStats_deInit(void);
+void modbusStats_add(modbusStats_counter_t counter, uint32_t value);
+void modbusStats_addLaneWait(int lane, uint32_t wait_us);
+void modbusStats_beginRequest(uint8_t function);
+void modbusStats_addSyscalls(uint32_t count);
+void modbusStats_addDelayLateness(uint32_t late_us);
+int modbusStats_write(void);
+int modbusStats_registerWriter(void (*writer)(FILE *fp));
+void modbusStats_unregisterWriter(void (*writer)(FILE *fp));
+
+#endif /* __MODBUS_STATS_H__ */
@@ -0,0 +1,679 @@
+//------------------------------------------------------------------------------
+/// Copyright (c) WAGO Kontakttechnik GmbH & Co. KG
+///
+/// PROPRIETARY RIGHTS are involved in the subject matter of this material.
+/// All manufacturing, reproduction, use and sales rights pertaining to this
+/// subject matter are governed by the license agreement. The recipient of this
+/// software implicitly accepts the terms of the license.
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+///
+///  \file     modbus_subscribe.c
+///
+///  \brief    Change-of-state subscriptions. A master subscribes a range of
+///            input registers by writing the registers 0x1040-0x1044, instead
+///            of polling the range. Every KBUS cycle compares the subscribed
+///            ranges with the previous cycle, a notifier thread pushes the
+///            changed ranges as UDP datagrams to the subscribers.
+///
+///            Registers:
+///            0x1040  Start address of the range (0x0000-0x00FF, 0x6000-0x62FB)
+///            0x1041  Number of registers (1-125), 0 removes the subscription.
+///                    Writing it adds, renews or removes the subscription.
+///            0x1042  UDP port of the subscriber
+///            0x1043  IPv4 address of the subscriber, high word
+///            0x1044  IPv4 address of the subscriber, low word. Either
+///                    0.0.0.0 or the address of the Modbus TCP master
+///                    writing it, notifications are never sent to another
+///                    host. Subscriptions over Modbus UDP are refused.
+///            0x1045  Active subscriptions (read only)
+///            0x1046  Maximum subscriptions (read only)
+///            0x1047  Lease time in seconds, 0 never expires (read only)
+///
+///            A subscription is identified by address, port and start
+///            address. It has to be renewed within the lease time. The
+///            registers are shared by all masters, a subscription has to be
+///            written with one FC16 request.
+///
+///            Notification: MBAP header with the sequence number of the
+///            subscription as transaction identifier, unit 0xFF, function
+///            code 0x44, start address, number of registers, byte count and
+///            the register values like a read holding registers response.
+///            The first notification carries the actual values.
+///
+///  \author   <BrT> : WAGO Kontakttechnik GmbH & Co. KG
+//------------------------------------------------------------------------------
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <modbus/modbus.h>
+#include "modbus_subscribe.h"
+#include "modbus_reply.h"
+#include "modbus_stats.h"
+#include "modbus.h"
+#include "utils.h"
+#include "conffile_reader.h"
+
+#define MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS 16   /**< @brief Maximum number of subscriptions */
+#define MODBUSSUBSCRIBE_MAX_REGISTERS 125      /**< @brief Maximum registers of one subscription, like a read request */
+#define MODBUSSUBSCRIBE_FC_NOTIFY 0x44         /**< @brief Function code of a notification */
+#define MODBUSSUBSCRIBE_UNIT_ID 0xFF           /**< @brief Unit identifier of a notification */
+#define MODBUSSUBSCRIBE_HEADER_LENGTH 13       /**< @brief MBAP header, function code, start, count and byte count */
+#define MODBUSSUBSCRIBE_FRAME_LENGTH (MODBUSSUBSCRIBE_HEADER_LENGTH + (2 * MODBUSSUBSCRIBE_MAX_REGISTERS))
+#define MODBUSSUBSCRIBE_POLL_TIMEOUT_MS 1000   /**< @brief Maximum wait time for changes, checks leases afterwards */
+
+#define MODBUSSUBSCRIBE_AREA_1_COUNT 256       /**< @brief Input registers of area 1 at 0x0000 */
+#define MODBUSSUBSCRIBE_AREA_2_ADDRESS 0x6000  /**< @brief Start address of input area 2 */
+#define MODBUSSUBSCRIBE_AREA_2_COUNT 764       /**< @brief Input registers of area 2 */
+#define MODBUSSUBSCRIBE_IMAGE_WORDS (MODBUSSUBSCRIBE_AREA_1_COUNT + MODBUSSUBSCRIBE_AREA_2_COUNT)
+
+/**
+ * @name Subscription registers
+ * @brief Offsets of the registers from MODBUSSUBSCRIBE_REGISTER_START_ADDRESS
+ * @{
+ */
+#define MODBUSSUBSCRIBE_REG_START 0
+#define MODBUSSUBSCRIBE_REG_COUNT 1
+#define MODBUSSUBSCRIBE_REG_PORT 2
+#define MODBUSSUBSCRIBE_REG_IP_HIGH 3
+#define MODBUSSUBSCRIBE_REG_IP_LOW 4
+#define MODBUSSUBSCRIBE_REG_ACTIVE 5
+#define MODBUSSUBSCRIBE_REG_MAX 6
+#define MODBUSSUBSCRIBE_REG_LEASE 7
+#define MODBUSSUBSCRIBE_REG_WRITABLE 5  /**< @brief Registers a master may write */
+#define MODBUSSUBSCRIBE_REG_COUNT_ALL 8
+/**
+ * @}
+ */
+
+/**
+ * @brief One subscribed range
+ */
+typedef struct
+{
+    char active;                /**< @brief Entry is in use */
+    char initial;               /**< @brief Notify the actual values in the next KBUS cycle */
+    char pending;               /**< @brief values changed, notification not sent yet */
+    struct sockaddr_in addr;    /**< @brief Subscriber */
+    uint16_t start;             /**< @brief Modbus address of the first register */
+    uint16_t count;             /**< @brief Number of registers */
+    uint16_t first;             /**< @brief Index of the first register in the input image */
+    uint16_t seq;               /**< @brief Transaction identifier of the next notification */
+    time_t expires;             /**< @brief Monotonic time the lease ends, 0 never */
+    uint64_t stat_notifications; /**< @brief Sent notifications */
+    uint16_t values[MODBUSSUBSCRIBE_MAX_REGISTERS]; /**< @brief Values of the pending notification */
+} modbusSubscribe_entry_t;
+
+static pthread_t modbusSubscribe_thread;
+static volatile char modbusSubscribe_running = FALSE;
+static pthread_mutex_t modbusSubscribe_mutex = PTHREAD_MUTEX_INITIALIZER; /**< @brief Guards the entries and the previous image */
+static modbusSubscribe_entry_t modbusSubscribe_entries[MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS];
+static volatile int modbusSubscribe_active = 0;          /**< @brief Number of active entries */
+static uint16_t modbusSubscribe_previous[MODBUSSUBSCRIBE_IMAGE_WORDS]; /**< @brief Input image of the previous KBUS cycle */
+static size_t modbusSubscribe_previousWords = 0;         /**< @brief Valid words of modbusSubscribe_previous */
+static int modbusSubscribe_eventFd = -1;                 /**< @brief Wakes up the notifier after a change */
+static int modbusSubscribe_socket = -1;                  /**< @brief Socket all notifications are sent from */
+static modbus_mapping_t *mb_subscribe_mapping = NULL;    /**< @brief Modbus register storage */
+
+static uint8_t modbusSubscribe_frames[MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS][MODBUSSUBSCRIBE_FRAME_LENGTH]; /**< @brief Notifications of one wake up */
+static struct iovec modbusSubscribe_iovs[MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS];
+static struct sockaddr_in modbusSubscribe_addrs[MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS];
+static struct mmsghdr modbusSubscribe_msgs[MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS];
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Get the monotonic time in seconds
+ * @return Seconds
+ */
+static time_t modbusSubscribe_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Get the position of a register range in the input image given to
+ * modbusSubscribe_update(). A range must not cross the end of an area.
+ * @param[in] start Modbus address of the first register
+ * @param[in] count Number of registers
+ * @return Index of the first register
+ * @retval <0 if the range is no input register range
+ */
+static int modbusSubscribe_imageIndex(uint16_t start, uint16_t count)
+{
+    if ((count == 0) || (count > MODBUSSUBSCRIBE_MAX_REGISTERS))
+    {
+        return -1;
+    }
+    if ((start + count) <= MODBUSSUBSCRIBE_AREA_1_COUNT)
+    {
+        return start;
+    }
+    if ((start >= MODBUSSUBSCRIBE_AREA_2_ADDRESS) &&
+        ((start + count) <= (MODBUSSUBSCRIBE_AREA_2_ADDRESS + MODBUSSUBSCRIBE_AREA_2_COUNT)))
+    {
+        return MODBUSSUBSCRIBE_AREA_1_COUNT + (start - MODBUSSUBSCRIBE_AREA_2_ADDRESS);
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Add, renew or remove a subscription as given by the registers. The
+ * subscriber is always the Modbus TCP master writing the registers, so a
+ * master cannot direct notifications to another host.
+ * @param[in] ctx Modbus environment of the master writing the registers
+ * @param[in] reg Values of the writable registers
+ * @retval 0 on success
+ * @retval -1 on invalid register values, another address than the one of
+ * the master or a master not connected by TCP
+ * @retval -2 if all subscriptions are in use
+ */
+static int modbusSubscribe_commit(modbus_t *ctx, const uint16_t *reg)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    uint32_t ip = ((uint32_t)reg[MODBUSSUBSCRIBE_REG_IP_HIGH] << 16) | reg[MODBUSSUBSCRIBE_REG_IP_LOW];
+    uint16_t start = reg[MODBUSSUBSCRIBE_REG_START];
+    uint16_t count = reg[MODBUSSUBSCRIBE_REG_COUNT];
+    modbusSubscribe_entry_t *entry = NULL;
+    modbusSubscribe_entry_t *free_entry = NULL;
+    int first = 0;
+    char ip_str[INET_ADDRSTRLEN];
+    int type = 0;
+    socklen_t type_len = sizeof(type);
+    int i;
+
+    if (reg[MODBUSSUBSCRIBE_REG_PORT] == 0)
+    {
+        return -1;
+    }
+    if (count > 0)
+    {
+        first = modbusSubscribe_imageIndex(start, count);
+        if (first < 0)
+        {
+            return -1;
+        }
+    }
+
+    //Address of the master, only known on TCP connections. The source of a
+    //UDP request can be forged, it is no subscriber.
+    if ((getsockopt(modbus_get_socket(ctx), SOL_SOCKET, SO_TYPE, &type, &type_len) == -1) || (type != SOCK_STREAM) ||
+        (getpeername(modbus_get_socket(ctx), (struct sockaddr *)&addr, &addr_len) == -1) ||
+        (addr.sin_family != AF_INET))
+    {
+        return -1;
+    }
+    if ((ip != 0) && (ip != ntohl(addr.sin_addr.s_addr)))
+    {
+        dprintf(VERBOSE_STD, "Subscription refused, address differs from the master\n");
+        return -1;
+    }
+    addr.sin_port = htons(reg[MODBUSSUBSCRIBE_REG_PORT]);
+    inet_ntop(AF_INET, &addr.sin_addr, ip_str, sizeof(ip_str));
+
+    pthread_mutex_lock(&modbusSubscribe_mutex);
+    for (i = 0; i < MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS; i++)
+    {
+        modbusSubscribe_entry_t *e = &modbusSubscribe_entries[i];
+
+        if (!e->active)
+        {
+            if (free_entry == NULL)
+            {
+                free_entry = e;
+            }
+        }
+        else if ((e->addr.sin_addr.s_addr == addr.sin_addr.s_addr) && (e->addr.sin_port == addr.sin_port) &&
+                 (e->start == start))
+        {
+            entry = e;
+            break;
+        }
+    }
+
+    if (count == 0)
+    {
+        if (entry != NULL)
+        {
+            entry->active = FALSE;
+            entry->pending = FALSE;
+            modbusSubscribe_active--;
+            dprintf(VERBOSE_STD, "Subscription %s:%d 0x%04X removed\n", ip_str, ntohs(addr.sin_port), start);
+        }
+        pthread_mutex_unlock(&modbusSubscribe_mutex);
+        return 0;
+    }
+
+    if (entry == NULL)
+    {
+        if (free_entry == NULL)
+        {
+            pthread_mutex_unlock(&modbusSubscribe_mutex);
+            dprintf(VERBOSE_STD, "Subscription %s:%d 0x%04X refused, all in use\n", ip_str, ntohs(addr.sin_port), start);
+            return -2;
+        }
+        entry = free_entry;
+        memset(entry, 0, sizeof(*entry));
+        entry->addr = addr;
+        entry->start = start;
+        entry->active = TRUE;
+        modbusSubscribe_active++;
+        dprintf(VERBOSE_STD, "Subscription %s:%d 0x%04X (%d) added\n", ip_str, ntohs(addr.sin_port), start, count);
+    }
+    if (entry->count != count)
+    {
+        entry->count = count;
+        entry->first = first;
+        entry->initial = TRUE;
+    }
+    entry->expires = (conf_modbus_subscription_lease_s > 0) ? (modbusSubscribe_now() + conf_modbus_subscription_lease_s) : 0;
+    pthread_mutex_unlock(&modbusSubscribe_mutex);
+    return 0;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Remove subscriptions which were not renewed within the lease time
+ */
+static void modbusSubscribe_expire(void)
+{
+    time_t now = modbusSubscribe_now();
+    int i;
+
+    pthread_mutex_lock(&modbusSubscribe_mutex);
+    for (i = 0; i < MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS; i++)
+    {
+        modbusSubscribe_entry_t *entry = &modbusSubscribe_entries[i];
+
+        if (entry->active && (entry->expires != 0) && (now >= entry->expires))
+        {
+            entry->active = FALSE;
+            entry->pending = FALSE;
+            modbusSubscribe_active--;
+            dprintf(VERBOSE_STD, "Subscription 0x%04X expired\n", entry->start);
+        }
+    }
+    pthread_mutex_unlock(&modbusSubscribe_mutex);
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Send the notifications of all changed subscriptions. The frames are
+ * built while holding the lock, they are sent without it.
+ */
+static void modbusSubscribe_notify(void)
+{
+    unsigned int count = 0;
+    unsigned int sent = 0;
+    int i;
+    int n;
+
+    pthread_mutex_lock(&modbusSubscribe_mutex);
+    for (i = 0; i < MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS; i++)
+    {
+        modbusSubscribe_entry_t *entry = &modbusSubscribe_entries[i];
+        uint8_t *frame = modbusSubscribe_frames[count];
+        uint16_t length;
+
+        if (!entry->active || !entry->pending)
+        {
+            continue;
+        }
+        length = MODBUSSUBSCRIBE_HEADER_LENGTH + (2 * entry->count);
+
+        frame[0] = entry->seq >> 8;
+        frame[1] = entry->seq & 0xFF;
+        frame[2] = 0;
+        frame[3] = 0;
+        frame[4] = (length - 6) >> 8;
+        frame[5] = (length - 6) & 0xFF;
+        frame[6] = MODBUSSUBSCRIBE_UNIT_ID;
+        frame[7] = MODBUSSUBSCRIBE_FC_NOTIFY;
+        frame[8] = entry->start >> 8;
+        frame[9] = entry->start & 0xFF;
+        frame[10] = entry->count >> 8;
+        frame[11] = entry->count & 0xFF;
+        frame[12] = 2 * entry->count;
+        utils_copyWordsBE(&frame[MODBUSSUBSCRIBE_HEADER_LENGTH], entry->values, entry->count);
+
+        modbusSubscribe_addrs[count] = entry->addr;
+        modbusSubscribe_iovs[count].iov_base = frame;
+        modbusSubscribe_iovs[count].iov_len = length;
+        memset(&modbusSubscribe_msgs[count], 0, sizeof(modbusSubscribe_msgs[count]));
+        modbusSubscribe_msgs[count].msg_hdr.msg_name = &modbusSubscribe_addrs[count];
+        modbusSubscribe_msgs[count].msg_hdr.msg_namelen = sizeof(modbusSubscribe_addrs[count]);
+        modbusSubscribe_msgs[count].msg_hdr.msg_iov = &modbusSubscribe_iovs[count];
+        modbusSubscribe_msgs[count].msg_hdr.msg_iovlen = 1;
+
+        entry->seq++;
+        entry->pending = FALSE;
+        entry->stat_notifications++;
+        count++;
+    }
+    pthread_mutex_unlock(&modbusSubscribe_mutex);
+
+    while (sent < count)
+    {
+        n = sendmmsg(modbusSubscribe_socket, &modbusSubscribe_msgs[sent], count - sent, 0);
+        if (n <= 0)
+        {
+            if ((n < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            //Skip the datagram which failed, the others may reach their subscriber
+            dprintf(VERBOSE_DEBUG, "Subscription notification failed: %s\n", strerror(errno));
+            modbusStats_add(MODBUSSTATS_SUBSCRIBE_DROPPED, 1);
+            sent++;
+            continue;
+        }
+        for (i = 0; i < n; i++)
+        {
+            modbusStats_add(MODBUSSTATS_SUBSCRIBE_BYTES, modbusSubscribe_msgs[sent + i].msg_len);
+        }
+        modbusStats_add(MODBUSSTATS_SUBSCRIBE_NOTIFICATIONS, n);
+        sent += n;
+    }
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Notifier thread, woken up by modbusSubscribe_update()
+ * @param[in] arg unused
+ */
+static void *modbusSubscribe_task(void *arg)
+{
+    struct pollfd pfd;
+    uint64_t events;
+
+    UNUSED(arg);
+    pfd.fd = modbusSubscribe_eventFd;
+    pfd.events = POLLIN;
+
+    while (modbusSubscribe_running)
+    {
+        if (poll(&pfd, 1, MODBUSSUBSCRIBE_POLL_TIMEOUT_MS) > 0)
+        {
+            if (read(modbusSubscribe_eventFd, &events, sizeof(events)) == sizeof(events))
+            {
+                modbusSubscribe_notify();
+            }
+        }
+        modbusSubscribe_expire();
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Write the subscriptions to the statistics file
+ * @param[in] fp Statistics file
+ */
+static void modbusSubscribe_writeStats(FILE *fp)
+{
+    time_t now = modbusSubscribe_now();
+    int i;
+
+    fprintf(fp, "%-21s %7s %5s %20s %10s\n", "subscriber", "start", "count", "notifications", "expires_s");
+    pthread_mutex_lock(&modbusSubscribe_mutex);
+    for (i = 0; i < MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS; i++)
+    {
+        modbusSubscribe_entry_t *entry = &modbusSubscribe_entries[i];
+        char ip[INET_ADDRSTRLEN];
+        char addr[INET_ADDRSTRLEN + 6];
+
+        if (!entry->active)
+        {
+            continue;
+        }
+        inet_ntop(AF_INET, &entry->addr.sin_addr, ip, sizeof(ip));
+        snprintf(addr, sizeof(addr), "%s:%d", ip, ntohs(entry->addr.sin_port));
+        fprintf(fp, "%-21s  0x%04X %5d %20llu %10ld\n", addr, entry->start, entry->count,
+                (unsigned long long)entry->stat_notifications,
+                (entry->expires != 0) ? (long)(entry->expires - now) : -1L);
+    }
+    pthread_mutex_unlock(&modbusSubscribe_mutex);
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Set the read only registers
+ */
+static void modbusSubscribe_setStatus(void)
+{
+    mb_subscribe_mapping->tab_registers[MODBUSSUBSCRIBE_REG_ACTIVE] = modbusSubscribe_active;
+    mb_subscribe_mapping->tab_registers[MODBUSSUBSCRIBE_REG_MAX] = MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS;
+    mb_subscribe_mapping->tab_registers[MODBUSSUBSCRIBE_REG_LEASE] = conf_modbus_subscription_lease_s;
+}
+
+//------------------------------------------------------------------------------------
+
+/**
+ * @brief Compare the subscribed ranges with the previous KBUS cycle and wake
+ * up the notifier for changed ones. Called by the KBUS cycle, it never waits
+ * for the lock: if the lock is busy the changes are detected next cycle.
+ * @param[in] image Input registers of area 1 followed by area 2
+ * @param[in] n Number of valid registers
+ */
+void modbusSubscribe_update(const uint16_t *image, size_t n)
+{
+    uint64_t event = 1;
+    char changed = FALSE;
+    int i;
+
+    if (modbusSubscribe_active == 0)
+    {
+        modbusSubscribe_previousWords = 0;
+        return;
+    }
+    if (n > MODBUSSUBSCRIBE_IMAGE_WORDS)
+    {
+        n = MODBUSSUBSCRIBE_IMAGE_WORDS;
+    }
+    if (pthread_mutex_trylock(&modbusSubscribe_mutex) != 0)
+    {
+        return;
+    }
+
+    for (i = 0; i < MODBUSSUBSCRIBE_MAX_SUBSCRIPTIONS; i++)
+    {
+        modbusSubscribe_entry_t *entry = &modbusSubscribe_entries[i];
+        size_t words = 0;
+
+        if (!entry->active)
+        {
+            continue;
+        }
+        //Registers behind the process image are always 0
+        if (entry->first < n)
+        {
+            words = n - entry->first;
+            if (words > entry->count)
+            {
+                words = entry->count;
+            }
+        }
+        if (entry->initial ||
+            ((modbusSubscribe_previousWords == n) &&
+             (memcmp(&modbusSubscribe_previous[entry->first], &image[entry->first], words * sizeof(uint16_t)) != 0)))
+        {
+            memset(entry->values, 0, sizeof(entry->values));
+            memcpy(entry->values, &image[entry->first], words * sizeof(uint16_t));
+            entry->initial = FALSE;
+            entry->pending = TRUE;
+            changed = TRUE;
+        }
+    }
+    memcpy(modbusSubscribe_previous, image, n * sizeof(uint16_t));
+    modbusSubscribe_previousWords = n;
+    pthread_mutex_unlock(&modbusSubscribe_mutex);
+
+    if (changed)
+    {
+        if (write(modbusSubscribe_eventFd, &event, sizeof(event)) != sizeof(event))
+        {
+            dprintf(VERBOSE_DEBUG, "Subscription wake up failed: %s\n", strerror(errno));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------------
+void modbusSubscribe_parseModbusCommand(modbus_t *ctx, uint8_t *command, int command_len)
+{
+    int offset = modbus_get_header_length(ctx);
+    int function = command[offset];
+    uint16_t address = (command[offset + 1] << 8) + command[offset + 2];
+    uint16_t reg[MODBUSSUBSCRIBE_REG_WRITABLE];
+    const uint8_t *values;
+    int quantity;
+    int ret;
+    int i;
+
+    //manipulate address
+    uint16_t fakeAddress = address - MODBUSSUBSCRIBE_REGISTER_START_ADDRESS;
+
+    switch(function)
+    {
+        case _FC_READ_HOLDING_REGISTERS:
+            modbusSubscribe_setStatus();
+            modbus_reply_offset(ctx, command, command_len, mb_subscribe_mapping, MODBUSSUBSCRIBE_REGISTER_START_ADDRESS);
+            break;
+        case _FC_WRITE_SINGLE_REGISTER:
+        case _FC_WRITE_MULTIPLE_REGISTERS:
+            if (function == _FC_WRITE_SINGLE_REGISTER)
+            {
+                quantity = 1;
+                values = &command[offset + 3];
+            }
+            else
+            {
+                quantity = (command[offset + 3] << 8) + command[offset + 4];
+                values = &command[offset + 6];
+            }
+            if ((quantity == 0) || ((fakeAddress + quantity) > MODBUSSUBSCRIBE_REG_WRITABLE) ||
+                ((values + (2 * quantity)) > (command + command_len)))
+            {
+                modbus_reply_exception(ctx, command, MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+                break;
+            }
+
+            //Registers as they are after this write
+            for (i = 0; i < MODBUSSUBSCRIBE_REG_WRITABLE; i++)
+            {
+                reg[i] = mb_subscribe_mapping->tab_registers[i];
+            }
+            for (i = 0; i < quantity; i++)
+            {
+                reg[fakeAddress + i] = (values[2 * i] << 8) + values[(2 * i) + 1];
+            }
+
+            //Writing the number of registers applies the subscription
+            if ((fakeAddress <= MODBUSSUBSCRIBE_REG_COUNT) && ((fakeAddress + quantity) > MODBUSSUBSCRIBE_REG_COUNT))
+            {
+                ret = modbusSubscribe_commit(ctx, reg);
+                if (ret == -1)
+                {
+                    modbus_reply_exception(ctx, command, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+                    break;
+                }
+                else if (ret < 0)
+                {
+                    modbus_reply_exception(ctx, command, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
+                    break;
+                }
+            }
+            modbus_reply_offset(ctx, command, command_len, mb_subscribe_mapping, MODBUSSUBSCRIBE_REGISTER_START_ADDRESS);
+            break;
+        default:
+            modbus_reply_exception(ctx, command, MODBUS_EXCEPTION_ILLEGAL_FUNCTION );
+    }
+}
+
+//------------------------------------------------------------------------------------
+int modbusSubscribe_init(void)
+{
+    dprintf(VERBOSE_STD, "Subscription Init\n");
+    memset(modbusSubscribe_entries, 0, sizeof(modbusSubscribe_entries));
+    modbusSubscribe_active = 0;
+    modbusSubscribe_previousWords = 0;
+
+    mb_subscribe_mapping = modbus_mapping_new(0, 0, MODBUSSUBSCRIBE_REG_COUNT_ALL, 0);
+    if (mb_subscribe_mapping == NULL)
+    {
+        fprintf(stderr, "Failed to allocate the mapping: %s\n", modbus_strerror(errno));
+        return -1;
+    }
+    modbusSubscribe_setStatus();
+
+    modbusSubscribe_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (modbusSubscribe_eventFd == -1)
+    {
+        fprintf(stderr, "Unable to create subscription event: %s\n", strerror(errno));
+        return -2;
+    }
+
+    modbusSubscribe_socket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (modbusSubscribe_socket == -1)
+    {
+        fprintf(stderr, "Unable to create subscription socket: %s\n", strerror(errno));
+        return -3;
+    }
+
+    modbusSubscribe_running = TRUE;
+    if (pthread_create(&modbusSubscribe_thread, NULL, &modbusSubscribe_task, NULL) != 0)
+    {
+        modbusSubscribe_running = FALSE;
+        return -4;
+    }
+    modbusStats_registerWriter(modbusSubscribe_writeStats);
+    return 0;
+}
+
+//------------------------------------------------------------------------------------
+void modbusSubscribe_deInit(void)
+{
+    modbusStats_unregisterWriter(modbusSubscribe_writeStats);
+    if (modbusSubscribe_running)
+    {
+        modbusSubscribe_running = FALSE;
+        pthread_join(modbusSubscribe_thread, NULL);
+    }
+    modbusSubscribe_active = 0;
+    if (modbusSubscribe_socket != -1)
+    {
+        close(modbusSubscribe_socket);
+        modbusSubscribe_socket = -1;
+    }
+    if (modbusSubscribe_eventFd != -1)
+    {
+        close(modbusSubscribe_eventFd);
+        modbusSubscribe_eventFd = -1;
+    }
+    if (mb_subscribe_mapping != NULL)
+    {
+        modbus_mapping_free(mb_subscribe_mapping);
+        mb_subscribe_mapping = NULL;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef __MODBUS_SUBSCRIBE_H__
+#define __MODBUS_SUBSCRIBE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <modbus/modbus.h>
+
+#define MODBUSSUBSCRIBE_REGISTER_START_ADDRESS 0x1040 /**< @brief Start address of the subscription registers */
+#define MODBUSSUBSCRIBE_REGISTER_END_ADDRESS   0x1047 /**< @brief Last address of the subscription registers */
+
+int modbusSubscribe_init(void);
+void modbusSubscribe_deInit(void);
+void modbusSubscribe_update(const uint16_t *image, size_t n);
+void modbusSubscribe_parseModbusCommand(modbus_t *ctx, uint8_t *command, int command_len);
+
+#endif /* __MODBUS_SUBSCRIBE_H__ */
@@ -0,0 +1,2753 @@
+//------------------------------------------------------------------------------
+/// Copyright (c) WAGO Kontakttechnik GmbH & Co. KG
+///
+/// PROPRIETARY RIGHTS are involved in the subject matter of this material.
+/// All manufacturing, reproduction, use and sales rights pertaining to this
+/// subject matter are governed by the license agreement. The recipient of this
+/// software implicitly accepts the terms of the license.
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+///
+///  \file     modbus_tcp.c
+///
+///  \brief    Modbus TCP server: reactors with non-blocking sockets serving
+///            the connections of the Modbus TCP masters.
+///
+///  \author   <BrT> : WAGO Kontakttechnik GmbH & Co. KG
+//------------------------------------------------------------------------------
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <modbus/modbus.h>
+#include "modbus-private.h"
+#include "modbus_tcp.h"
+#include "modbus.h"
+#include "modbus_reply.h"
+#include "modbus_stats.h"
+#include "utils.h"
+#include "conffile_reader.h"
+
+#define MODBUSTCP_MAX_EVENTS 64          /**< @brief Maximum events handled per epoll_wait call */
+#define MODBUSTCP_WORKER_TIMEOUT_MS 1000 /**< @brief epoll timeout of worker threads, checks running flag afterwards */
+
+#define MODBUSTCP_MBAP_LENGTH 7                                       /**< @brief Length of the MBAP header incl. unit identifier */
+#define MODBUSTCP_RX_BUFFER_SIZE (2 * MAX_REQUEST_MESSAGE_LENGTH)    /**< @brief Receive buffer of each connection */
+#define MODBUSTCP_TX_BUFFER_SIZE (4 * MAX_RESPONSE_MESSAGE_LENGTH)   /**< @brief Initial size of the output queue of a connection */
+#define MODBUSTCP_WHEEL_SLOTS 64                                      /**< @brief Slots of the idle timer wheel, one second each, power of two */
+#define MODBUSTCP_SLOT_COUNT (conf_max_tcp_connections + 1)          /**< @brief Connection slots per reactor, one spare slot while an evicted connection is closing */
+#define MODBUSTCP_MAX_REFS 16                                         /**< @brief Replies per batch referring to the shadow, further ones are copied */
+
+#ifdef HAVE_LIBURING
+#define MODBUSTCP_URING_ENTRIES 256         /**< @brief Submission queue size of each ring */
+#define MODBUSTCP_URING_BUFFERS 64          /**< @brief Receive buffers in the provided buffer ring, power of two */
+#define MODBUSTCP_URING_BUFFER_SIZE 1024    /**< @brief Size of one receive buffer, always fits behind an incomplete request */
+#define MODBUSTCP_URING_BUFFER_GROUP 0      /**< @brief Buffer group id of the provided buffer ring */
+#define MODBUSTCP_URING_MAX_HELD 16         /**< @brief Receive buffers a connection may hold, receiving pauses when reached */
+
+/**
+ * @brief Receive buffer of the ring whose data are not handled yet
+ */
+typedef struct
+{
+    uint16_t bid;       /**< @brief Buffer id */
+    uint16_t offset;    /**< @brief Data already copied to the receive buffer of the connection */
+    uint16_t len;       /**< @brief Received bytes in the buffer */
+} modbusTcp_uringHeld_t;
+
+/**
+ * @brief Operation of a submission, stored in the low bits of its user data
+ */
+typedef enum
+{
+    MODBUSTCP_URING_ACCEPT = 0,     /**< @brief Multishot accept on the listening socket */
+    MODBUSTCP_URING_RECV = 1,       /**< @brief Receive of a connection */
+    MODBUSTCP_URING_SEND = 2,       /**< @brief Send of the output queue of a connection */
+    MODBUSTCP_URING_EVICT = 3,      /**< @brief Read of the eviction eventfd of the reactor */
+    MODBUSTCP_URING_OP_MASK = 3
+} modbusTcp_uringOp_t;
+#endif
+
+/**
+ * @brief Receive state of a connection. Requests are reassembled in the
+ * receive buffer of each connection, so a partially sent request does not
+ * block other masters.
+ */
+typedef enum
+{
+    MODBUSTCP_RX_HEADER,    /**< @brief Waiting for a complete MBAP header */
+    MODBUSTCP_RX_PDU        /**< @brief Header is valid, waiting for the rest of the request */
+} modbusTcp_rxState_t;
+
+/**
+ * @brief Part of a reply in the output queue referring to the shadow image
+ */
+typedef struct
+{
+    size_t at;              /**< @brief Offset in tx_buf the part is sent before */
+    const uint8_t *data;    /**< @brief Registers in a pinned shadow generation */
+    size_t len;             /**< @brief Length of the part */
+    int generation;         /**< @brief Pinned generation, unpinned when the part is sent or copied */
+} modbusTcp_txRef_t;
+
+typedef struct modbusTcp_reactor modbusTcp_reactor_t;
+typedef struct modbusTcp_connection modbusTcp_connection_t;
+
+/**
+ * @brief Connection slot of an accepted modbus master
+ */
+struct modbusTcp_connection
+{
+    int fd;                       /**< @brief Socket, -1 if slot is unused */
+    modbus_t *ctx;                /**< @brief Modbus context of this connection */
+    struct sockaddr_in addr;      /**< @brief Address of the master */
+    modbusTcp_reactor_t *reactor; /**< @brief Reactor which owns the connection */
+    uint8_t rx_buf[MODBUSTCP_RX_BUFFER_SIZE]; /**< @brief Received data not handled yet */
+    size_t rx_len;                /**< @brief Number of bytes in rx_buf */
+    modbusTcp_rxState_t rx_state; /**< @brief State of the request at the start of rx_buf */
+    size_t rx_frame_length;       /**< @brief Length of this request, valid in MODBUSTCP_RX_PDU */
+    uint8_t *tx_buf;              /**< @brief Output queue, replies not sent yet */
+    size_t tx_size;               /**< @brief Allocated size of tx_buf */
+    size_t tx_head;               /**< @brief Offset of the first unsent byte in tx_buf */
+    size_t tx_len;                /**< @brief Offset behind the last queued byte in tx_buf */
+    char tx_overflow;             /**< @brief Output queue limit exceeded, connection has to be closed */
+    modbusTcp_txRef_t tx_refs[MODBUSTCP_MAX_REFS]; /**< @brief Parts of the queued replies not copied into tx_buf */
+    int tx_ref_count;             /**< @brief Number of entries in tx_refs */
+    size_t tx_ref_bytes;          /**< @brief Sum of the lengths in tx_refs */
+    char tx_waiting;              /**< @brief EPOLLOUT is enabled for this connection */
+    char rx_paused;               /**< @brief EPOLLIN is disabled, replies are parked, rx_buf is full or the master has shut down sending */
+    char rx_eof;                  /**< @brief Master has shut down sending, the connection is closed when its requests are answered */
+    uint64_t tx_due;              /**< @brief Time in us when the parked replies are sent, 0 if not parked */
+    int delay_index;              /**< @brief Position in the delay heap of the reactor, -1 if not parked */
+    time_t last_active;           /**< @brief Time of the last received data */
+    uint64_t last_used;           /**< @brief Time in us of the last received data, orders the LRU lists of all reactors */
+    time_t expire;                /**< @brief Tick at which the timer wheel checks this connection again */
+    char linked;                  /**< @brief Connection is in the timer wheel and the LRU list */
+    modbusTcp_connection_t *wheel_next; /**< @brief Next connection in the same wheel slot */
+    modbusTcp_connection_t *wheel_prev; /**< @brief Previous connection in the same wheel slot */
+    modbusTcp_connection_t *lru_next;   /**< @brief Next more recently used connection */
+    modbusTcp_connection_t *lru_prev;   /**< @brief Next less recently used connection */
+    char ready;                   /**< @brief Connection is in a ready list of the scheduler */
+    int lane;                     /**< @brief Ready list of the connection, lane of its next request */
+    int deficit;                  /**< @brief Requests the connection may still be served in this round */
+    uint64_t ready_since;         /**< @brief Time in us when the connection joined the ready list */
+    modbusTcp_connection_t *ready_next; /**< @brief Next connection in the ready list */
+    modbusTcp_connection_t *ready_prev; /**< @brief Previous connection in the ready list */
+    uint64_t stat_requests;       /**< @brief Served requests */
+    uint64_t stat_wait_sum;       /**< @brief Sum of queue wait times in us */
+    uint64_t stat_wait_max;       /**< @brief Maximum queue wait time in us */
+#ifdef HAVE_LIBURING
+    size_t tx_inflight;           /**< @brief Bytes of tx_buf handed over to io_uring */
+    int uring_pending;            /**< @brief Submissions which will still complete */
+    modbusTcp_uringHeld_t rx_held[MODBUSTCP_URING_MAX_HELD]; /**< @brief Received buffers in arrival order */
+    int rx_held_first;            /**< @brief Index of the oldest held buffer */
+    int rx_held_count;            /**< @brief Number of held buffers */
+    char rx_rearm;                /**< @brief Receive has to be submitted again when held buffers are returned */
+    char closing;                 /**< @brief Socket is shut down, slot is released when uring_pending is 0 */
+#endif
+};
+
+/**
+ * @brief Event loop with its own listening socket and connections. The first
+ * reactor is driven by the modbus thread, all others run in their own worker
+ * thread.
+ */
+struct modbusTcp_reactor
+{
+    int id;                                 /**< @brief Reactor number */
+    pthread_t thread;                       /**< @brief Worker thread, unused for reactor 0 */
+    char thread_started;                    /**< @brief Flag if worker thread was created */
+    int server_socket;                      /**< @brief Listening socket */
+    int epoll_fd;                           /**< @brief epoll instance for all sockets */
+    modbusTcp_connection_t *connections;    /**< @brief Connection table */
+    modbusTcp_connection_t *wheel[MODBUSTCP_WHEEL_SLOTS]; /**< @brief Idle timer wheel, one list per second */
+    time_t wheel_time;                      /**< @brief Last tick handled by the timer wheel */
+    uint64_t spin_until;                    /**< @brief Time in us until the low latency profile polls without blocking */
+    modbusTcp_connection_t *lru_first;      /**< @brief Least recently used connection */
+    modbusTcp_connection_t *lru_last;       /**< @brief Most recently used connection */
+    uint64_t lru_oldest;                    /**< @brief last_used of lru_first, UINT64_MAX without connections, read by other reactors */
+    int evict_requests;                     /**< @brief Connections other reactors asked this one to close */
+    int evict_fd;                           /**< @brief eventfd waking the reactor for evict_requests */
+    modbusTcp_connection_t *ready_first[MODBUS_LANE_COUNT]; /**< @brief Next connection served by the scheduler per lane */
+    modbusTcp_connection_t *ready_last[MODBUS_LANE_COUNT];  /**< @brief Last connection in the ready list per lane */
+    int ready_count[MODBUS_LANE_COUNT];     /**< @brief Number of connections in the ready list per lane */
+    int ready_total;                        /**< @brief Number of connections in all ready lists */
+    modbusTcp_connection_t **delay_heap;    /**< @brief Connections with parked replies, min-heap by due time */
+    int delay_count;                        /**< @brief Number of connections in the delay heap */
+    int delay_fd;                           /**< @brief timerfd armed for the first due connection, -1 with io_uring */
+    pthread_mutex_t stats_mutex;            /**< @brief Protects socket, address and counters of the slots against the statistics writer */
+#ifdef HAVE_LIBURING
+    char uring;                             /**< @brief io_uring is used instead of epoll */
+    struct io_uring ring;                   /**< @brief Submission and completion queues */
+    struct io_uring_buf_ring *buf_ring;     /**< @brief Provided buffers for receives */
+    uint8_t *buffers;                       /**< @brief Memory of the provided buffers */
+    uint64_t evict_value;                   /**< @brief Counter read from evict_fd */
+#endif
+};
+
+static modbusTcp_reactor_t *reactors;   /**< @brief Reactor table */
+static int reactor_count;               /**< @brief Number of reactors */
+static volatile char modbusTcp_running; /**< @brief Run flag for worker threads */
+static int connection_count;            /**< @brief Number of active connections of all reactors */
+static void (*modbusTcp_worker)(modbus_t *ctx, uint8_t *query, int rc) = NULL; /**< @brief Request handler */
+static int (*modbusTcp_classify)(const uint8_t *pdu, int length) = NULL;         /**< @brief Lane of a request */
+static modbus_backend_t modbusTcp_backend;  /**< @brief TCP backend of libmodbus with send and flush replaced */
+static ssize_t (*modbusTcp_backendSend)(modbus_t *ctx, const uint8_t *req, int req_length); /**< @brief Original send of the backend */
+static __thread modbusTcp_connection_t *current_connection; /**< @brief Connection whose requests are handled by this thread */
+
+/**
+ * @brief Replacement for the send function of the libmodbus backend.
+ * Replies of the connection actually handled are appended to its output
+ * queue instead of being sent directly. If the queue limit is exceeded the
+ * reply is dropped and the connection is marked to be closed. The reply is
+ * reported as sent anyway, so libmodbus does not start its error recovery.
+ * @param[in] ctx Modbus context
+ * @param[in] msg Reply
+ * @param[in] msg_length Length of the reply
+ * @return Number of bytes queued
+ * @retval -1 on failure
+ */
+static ssize_t modbusTcp_queueReply(modbus_t *ctx, const uint8_t *msg, int msg_length)
+{
+    modbusTcp_connection_t *conn = current_connection;
+    size_t needed;
+
+    if ((conn == NULL) || (conn->ctx != ctx))
+    {
+        modbusStats_addSyscalls(1);
+        return modbusTcp_backendSend(ctx, msg, msg_length);
+    }
+
+    if (conn->tx_overflow)
+    {
+        return msg_length;
+    }
+
+    needed = conn->tx_len - conn->tx_head + msg_length;
+    if ((needed + conn->tx_ref_bytes) > (size_t)conf_modbus_output_queue_bytes)
+    {
+        dprintf(VERBOSE_STD, "Output queue limit of %d bytes exceeded on socket %d\n",
+                conf_modbus_output_queue_bytes, conn->fd);
+        conn->tx_overflow = TRUE;
+        return msg_length;
+    }
+
+    if ((conn->tx_len + msg_length) > conn->tx_size)
+    {
+        //Move unsent data to the start of the queue, grow it if that's not enough
+        if (conn->tx_head > 0)
+        {
+            int i;
+
+            memmove(conn->tx_buf, &conn->tx_buf[conn->tx_head], conn->tx_len - conn->tx_head);
+            for (i = 0; i < conn->tx_ref_count; i++)
+            {
+                conn->tx_refs[i].at -= conn->tx_head;
+            }
+            conn->tx_len -= conn->tx_head;
+            conn->tx_head = 0;
+        }
+        if (needed > conn->tx_size)
+        {
+            size_t size = conn->tx_size * 2;
+            uint8_t *buf;
+
+            if (size < needed)
+            {
+                size = needed;
+            }
+            if (size > (size_t)conf_modbus_output_queue_bytes)
+            {
+                size = conf_modbus_output_queue_bytes;
+            }
+            buf = realloc(conn->tx_buf, size);
+            if (buf == NULL)
+            {
+                conn->tx_overflow = TRUE;
+                return msg_length;
+            }
+            conn->tx_buf = buf;
+            conn->tx_size = size;
+        }
+    }
+
+    memcpy(&conn->tx_buf[conn->tx_len], msg, msg_length);
+    conn->tx_len += msg_length;
+    return msg_length;
+}
+
+/**
+ * @brief Queue a reply given in parts without copying its registers. The
+ * header is copied into the output queue, the registers are referred to in
+ * the pinned shadow generation and sent together with the queue by
+ * modbusTcp_sendReplies() at the end of the batch. Not taken with a response
+ * delay, the generation would stay pinned too long, nor while the socket
+ * buffer is full, the registers would be copied anyway.
+ * @param[in] ctx Modbus context
+ * @param[in] iov Header and registers of the reply
+ * @param[in] iovcnt Number of parts
+ * @param[in] generation Pinned generation, taken over with the reply
+ * @return Number of bytes queued
+ * @retval -1 if not taken, the reply has to be sent by the send function
+ */
+static int modbusTcp_sendReplyv(modbus_t *ctx, const struct iovec *iov, int iovcnt, int generation)
+{
+    modbusTcp_connection_t *conn = current_connection;
+    modbusTcp_txRef_t *ref;
+    int total = 0;
+    int i;
+
+    if ((conn == NULL) || (conn->ctx != ctx) || conn->tx_overflow || conn->tx_waiting ||
+        (conf_modbus_delay_ms > 0) || ((conn->tx_ref_count + iovcnt - 1) > MODBUSTCP_MAX_REFS))
+    {
+        return -1;
+    }
+#ifdef HAVE_LIBURING
+    if (conn->tx_inflight > 0)
+    {
+        return -1;
+    }
+#endif
+    for (i = 0; i < iovcnt; i++)
+    {
+        total += iov[i].iov_len;
+    }
+    if ((conn->tx_len - conn->tx_head + conn->tx_ref_bytes + total) > (size_t)conf_modbus_output_queue_bytes)
+    {
+        return -1;
+    }
+
+    modbusTcp_queueReply(ctx, iov[0].iov_base, iov[0].iov_len);
+    if (conn->tx_overflow)
+    {
+        return -1;
+    }
+    for (i = 1; i < iovcnt; i++)
+    {
+        ref = &conn->tx_refs[conn->tx_ref_count++];
+        ref->at = conn->tx_len;
+        ref->data = iov[i].iov_base;
+        ref->len = iov[i].iov_len;
+        //The generation is unpinned once with the last part
+        ref->generation = (i == (iovcnt - 1)) ? generation : -1;
+        conn->tx_ref_bytes += ref->len;
+    }
+    return total;
+}
+
+/**
+ * @brief Release the parts of the output queue referring to the shadow
+ * @param[in] conn Connection
+ */
+static void modbusTcp_releaseRefs(modbusTcp_connection_t *conn)
+{
+    int i;
+
+    for (i = 0; i < conn->tx_ref_count; i++)
+    {
+        if (conn->tx_refs[i].generation >= 0)
+        {
+            modbus_unpinReadShadow(conn->tx_refs[i].generation);
+        }
+    }
+    conn->tx_ref_count = 0;
+    conn->tx_ref_bytes = 0;
+}
+
+/**
+ * @brief Send the output queue together with its parts referring to the
+ * shadow with one sendmsg. What the socket does not take is copied into a
+ * new output queue, so the shadow generations can be unpinned in any case.
+ * @param[in] conn Connection with parts referring to the shadow
+ * @retval 0 on success
+ * @retval <0 on failure, connection has to be closed
+ */
+static int modbusTcp_sendRefs(modbusTcp_connection_t *conn)
+{
+    struct iovec iov[2 * MODBUSTCP_MAX_REFS + 1];
+    struct msghdr msg;
+    size_t pos = conn->tx_head;
+    size_t total = 0;
+    size_t sent;
+    ssize_t rc;
+    int iovcnt = 0;
+    int i;
+
+    for (i = 0; i < conn->tx_ref_count; i++)
+    {
+        modbusTcp_txRef_t *ref = &conn->tx_refs[i];
+
+        if (ref->at > pos)
+        {
+            iov[iovcnt].iov_base = &conn->tx_buf[pos];
+            iov[iovcnt++].iov_len = ref->at - pos;
+            pos = ref->at;
+        }
+        iov[iovcnt].iov_base = (void *)ref->data;
+        iov[iovcnt++].iov_len = ref->len;
+    }
+    if (conn->tx_len > pos)
+    {
+        iov[iovcnt].iov_base = &conn->tx_buf[pos];
+        iov[iovcnt++].iov_len = conn->tx_len - pos;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    do
+    {
+        rc = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        modbusStats_addSyscalls(1);
+    } while ((rc < 0) && (errno == EINTR));
+    if ((rc < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+    {
+        dprintf(VERBOSE_STD, "Send failed on socket %d: %s\n", conn->fd, strerror(errno));
+        modbusTcp_releaseRefs(conn);
+        return -2;
+    }
+    sent = (rc > 0) ? (size_t)rc : 0;
+
+    for (i = 0; i < iovcnt; i++)
+    {
+        total += iov[i].iov_len;
+    }
+    if (sent < total)
+    {
+        //Socket buffer is full, queue the rest in order
+        size_t size = (conn->tx_size > (total - sent)) ? conn->tx_size : (total - sent);
+        uint8_t *buf = malloc(size);
+        size_t len = 0;
+
+        if (buf == NULL)
+        {
+            modbusTcp_releaseRefs(conn);
+            return -1;
+        }
+        for (i = 0; i < iovcnt; i++)
+        {
+            if (sent >= iov[i].iov_len)
+            {
+                sent -= iov[i].iov_len;
+                continue;
+            }
+            memcpy(&buf[len], (const uint8_t *)iov[i].iov_base + sent, iov[i].iov_len - sent);
+            len += iov[i].iov_len - sent;
+            sent = 0;
+        }
+        free(conn->tx_buf);
+        conn->tx_buf = buf;
+        conn->tx_size = size;
+        conn->tx_head = 0;
+        conn->tx_len = len;
+    }
+    else
+    {
+        conn->tx_head = 0;
+        conn->tx_len = 0;
+    }
+    modbusTcp_releaseRefs(conn);
+    return 0;
+}
+
+/**
+ * @brief Replacement for the flush function of the libmodbus backend.
+ * Pending data on the socket are pipelined requests and must not be
+ * discarded.
+ * @param[in] ctx Modbus context
+ * @return Always 0
+ */
+static int modbusTcp_flush(modbus_t *ctx)
+{
+    UNUSED(ctx);
+    return 0;
+}
+
+#ifdef HAVE_LIBURING
+/**
+ * @brief Get a free submission queue entry, submits pending entries if the
+ * queue is full
+ * @param[in] r Reactor
+ * @param[in] data Connection or NULL for the listening socket
+ * @param[in] op Operation, stored in the user data together with data
+ * @return Submission queue entry
+ * @retval NULL on failure
+ */
+static struct io_uring_sqe *modbusTcp_uringGetSqe(modbusTcp_reactor_t *r, void *data, modbusTcp_uringOp_t op)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = io_uring_get_sqe(&r->ring);
+    if (sqe == NULL)
+    {
+        io_uring_submit(&r->ring);
+        sqe = io_uring_get_sqe(&r->ring);
+        if (sqe == NULL)
+        {
+            return NULL;
+        }
+    }
+    io_uring_sqe_set_data(sqe, (void *)((uintptr_t)data | op));
+    return sqe;
+}
+
+/**
+ * @brief Submit a receive for a connection. Received data are placed in a
+ * buffer of the provided buffer ring. Only one receive is submitted at a
+ * time, so a connection never holds more buffers than it can take and the
+ * master is slowed down by TCP flow control while its requests wait.
+ * @param[in] conn Connection
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+static int modbusTcp_uringRecv(modbusTcp_connection_t *conn)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = modbusTcp_uringGetSqe(conn->reactor, conn, MODBUSTCP_URING_RECV);
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+    io_uring_prep_recv(sqe, conn->fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = MODBUSTCP_URING_BUFFER_GROUP;
+    conn->uring_pending++;
+    return 0;
+}
+
+/**
+ * @brief Submit a send of the output queue. Only one send per connection is
+ * in flight, replies queued meanwhile are sent after its completion.
+ * @param[in] conn Connection with queued replies
+ * @retval 0 on success
+ * @retval <0 on failure, connection has to be closed
+ */
+static int modbusTcp_uringSend(modbusTcp_connection_t *conn)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((conn->tx_inflight > 0) || (conn->tx_head == conn->tx_len))
+    {
+        return 0;
+    }
+
+    sqe = modbusTcp_uringGetSqe(conn->reactor, conn, MODBUSTCP_URING_SEND);
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+    conn->tx_inflight = conn->tx_len - conn->tx_head;
+    io_uring_prep_send(sqe, conn->fd, &conn->tx_buf[conn->tx_head], conn->tx_inflight, MSG_NOSIGNAL);
+    conn->uring_pending++;
+    return 0;
+}
+/**
+ * @brief Return a receive buffer to the provided buffer ring
+ * @param[in] r Reactor
+ * @param[in] bid Buffer id
+ */
+static void modbusTcp_uringRecycle(modbusTcp_reactor_t *r, unsigned short bid)
+{
+    io_uring_buf_ring_add(r->buf_ring, &r->buffers[bid * MODBUSTCP_URING_BUFFER_SIZE], MODBUSTCP_URING_BUFFER_SIZE,
+                          bid, io_uring_buf_ring_mask(MODBUSTCP_URING_BUFFERS), 0);
+    io_uring_buf_ring_advance(r->buf_ring, 1);
+}
+
+/**
+ * @brief Return all receive buffers held by a connection to the ring
+ * @param[in] conn Connection
+ */
+static void modbusTcp_uringReleaseHeld(modbusTcp_connection_t *conn)
+{
+    while (conn->rx_held_count > 0)
+    {
+        modbusTcp_uringRecycle(conn->reactor, conn->rx_held[conn->rx_held_first].bid);
+        conn->rx_held_first = (conn->rx_held_first + 1) % MODBUSTCP_URING_MAX_HELD;
+        conn->rx_held_count--;
+    }
+}
+
+#endif
+
+/**
+ * @brief Monotonic time in seconds, the tick of the timer wheel
+ * @return Actual time
+ */
+static time_t modbusTcp_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/**
+ * @brief Monotonic time in microseconds for queue wait times
+ * @return Actual time
+ */
+static uint64_t modbusTcp_nowUs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Put a connection into the timer wheel slot of its expiry tick
+ * @param[in] conn Connection
+ * @param[in] expire Tick at which the connection is checked
+ */
+static void modbusTcp_wheelInsert(modbusTcp_connection_t *conn, time_t expire)
+{
+    modbusTcp_connection_t **slot = &conn->reactor->wheel[expire & (MODBUSTCP_WHEEL_SLOTS - 1)];
+
+    conn->expire = expire;
+    conn->wheel_prev = NULL;
+    conn->wheel_next = *slot;
+    if (*slot != NULL)
+    {
+        (*slot)->wheel_prev = conn;
+    }
+    *slot = conn;
+}
+
+/**
+ * @brief Remove a connection from its timer wheel slot
+ * @param[in] conn Connection
+ */
+static void modbusTcp_wheelRemove(modbusTcp_connection_t *conn)
+{
+    if (conn->wheel_prev != NULL)
+    {
+        conn->wheel_prev->wheel_next = conn->wheel_next;
+    }
+    else
+    {
+        conn->reactor->wheel[conn->expire & (MODBUSTCP_WHEEL_SLOTS - 1)] = conn->wheel_next;
+    }
+    if (conn->wheel_next != NULL)
+    {
+        conn->wheel_next->wheel_prev = conn->wheel_prev;
+    }
+    conn->wheel_next = NULL;
+    conn->wheel_prev = NULL;
+}
+
+/**
+ * @brief Append a connection to the LRU list as most recently used
+ * @param[in] conn Connection
+ */
+static void modbusTcp_lruAppend(modbusTcp_connection_t *conn)
+{
+    modbusTcp_reactor_t *r = conn->reactor;
+
+    conn->lru_next = NULL;
+    conn->lru_prev = r->lru_last;
+    if (r->lru_last != NULL)
+    {
+        r->lru_last->lru_next = conn;
+    }
+    else
+    {
+        r->lru_first = conn;
+        __atomic_store_n(&r->lru_oldest, conn->last_used, __ATOMIC_RELAXED);
+    }
+    r->lru_last = conn;
+}
+
+/**
+ * @brief Remove a connection from the LRU list
+ * @param[in] conn Connection
+ */
+static void modbusTcp_lruRemove(modbusTcp_connection_t *conn)
+{
+    modbusTcp_reactor_t *r = conn->reactor;
+
+    if (conn->lru_prev != NULL)
+    {
+        conn->lru_prev->lru_next = conn->lru_next;
+    }
+    else
+    {
+        r->lru_first = conn->lru_next;
+        __atomic_store_n(&r->lru_oldest, (r->lru_first != NULL) ? r->lru_first->last_used : UINT64_MAX,
+                         __ATOMIC_RELAXED);
+    }
+    if (conn->lru_next != NULL)
+    {
+        conn->lru_next->lru_prev = conn->lru_prev;
+    }
+    else
+    {
+        r->lru_last = conn->lru_prev;
+    }
+    conn->lru_next = NULL;
+    conn->lru_prev = NULL;
+}
+
+/**
+ * @brief Mark a connection as active. The timer wheel is not touched, a
+ * connection found in its slot is moved on when it was active meanwhile.
+ * @param[in] conn Connection which received data
+ */
+static void modbusTcp_touch(modbusTcp_connection_t *conn)
+{
+    if (!conn->linked)
+    {
+        return;
+    }
+    conn->last_used = modbusTcp_nowUs();
+    conn->last_active = (time_t)(conn->last_used / 1000000);
+    if (conn->reactor->lru_last != conn)
+    {
+        modbusTcp_lruRemove(conn);
+        modbusTcp_lruAppend(conn);
+    }
+    else if (conn->reactor->lru_first == conn)
+    {
+        __atomic_store_n(&conn->reactor->lru_oldest, conn->last_used, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Append a connection to a ready list of the scheduler
+ * @param[in] conn Connection with complete requests
+ * @param[in] lane Lane of the next request of the connection
+ */
+static void modbusTcp_readyAppend(modbusTcp_connection_t *conn, int lane)
+{
+    modbusTcp_reactor_t *r = conn->reactor;
+
+    conn->ready = TRUE;
+    conn->lane = lane;
+    conn->ready_since = modbusTcp_nowUs();
+    conn->ready_next = NULL;
+    conn->ready_prev = r->ready_last[lane];
+    if (r->ready_last[lane] != NULL)
+    {
+        r->ready_last[lane]->ready_next = conn;
+    }
+    else
+    {
+        r->ready_first[lane] = conn;
+    }
+    r->ready_last[lane] = conn;
+    r->ready_count[lane]++;
+    r->ready_total++;
+}
+
+/**
+ * @brief Remove a connection from its ready list
+ * @param[in] conn Connection
+ */
+static void modbusTcp_readyRemove(modbusTcp_connection_t *conn)
+{
+    modbusTcp_reactor_t *r = conn->reactor;
+    int lane = conn->lane;
+
+    if (conn->ready_prev != NULL)
+    {
+        conn->ready_prev->ready_next = conn->ready_next;
+    }
+    else
+    {
+        r->ready_first[lane] = conn->ready_next;
+    }
+    if (conn->ready_next != NULL)
+    {
+        conn->ready_next->ready_prev = conn->ready_prev;
+    }
+    else
+    {
+        r->ready_last[lane] = conn->ready_prev;
+    }
+    conn->ready_next = NULL;
+    conn->ready_prev = NULL;
+    conn->ready = FALSE;
+    r->ready_count[lane]--;
+    r->ready_total--;
+}
+
+/**
+ * @brief Classify the request at the start of the receive buffer. A buffer
+ * with an invalid header counts as complete process data request, the error
+ * is detected when the request is handled.
+ * @param[in] conn Connection
+ * @return Lane of the request
+ * @retval <0 if no request is complete
+ */
+static int modbusTcp_requestLane(modbusTcp_connection_t *conn)
+{
+    size_t length;
+
+    if (conn->rx_state == MODBUSTCP_RX_PDU)
+    {
+        length = conn->rx_frame_length;
+    }
+    else
+    {
+        if (conn->rx_len < MODBUSTCP_MBAP_LENGTH)
+        {
+            return -1;
+        }
+        length = (conn->rx_buf[4] << 8) + conn->rx_buf[5];
+        if ((conn->rx_buf[2] != 0) || (conn->rx_buf[3] != 0) || (length < 2) ||
+            ((length + MODBUSTCP_MBAP_LENGTH - 1) > MAX_REQUEST_MESSAGE_LENGTH))
+        {
+            return MODBUS_LANE_PROCESS;
+        }
+        length += MODBUSTCP_MBAP_LENGTH - 1;
+    }
+    if (conn->rx_len < length)
+    {
+        return -1;
+    }
+    return modbusTcp_classify(&conn->rx_buf[MODBUSTCP_MBAP_LENGTH], length - MODBUSTCP_MBAP_LENGTH);
+}
+
+/**
+ * @brief Check if a connection whose master has shut down sending is done.
+ * All complete requests are answered and all replies are sent then, an
+ * incomplete request left in the receive buffer is dropped.
+ * @param[in] conn Connection
+ * @retval TRUE if the connection can be closed
+ * @retval FALSE otherwise
+ */
+static char modbusTcp_finished(modbusTcp_connection_t *conn)
+{
+    if (!conn->rx_eof || conn->ready || (conn->tx_due != 0) || (conn->tx_len != conn->tx_head) ||
+        (modbusTcp_requestLane(conn) >= 0))
+    {
+        return FALSE;
+    }
+#ifdef HAVE_LIBURING
+    if ((conn->tx_inflight != 0) || (conn->rx_held_count > 0))
+    {
+        return FALSE;
+    }
+#endif
+    return TRUE;
+}
+
+/**
+ * @brief Put a connection into the ready list of the lane of its next
+ * request if this request is complete. The deficit of a connection without
+ * requests is dropped.
+ * @param[in] conn Connection
+ */
+static void modbusTcp_schedule(modbusTcp_connection_t *conn)
+{
+    int lane;
+
+    if (conn->ready)
+    {
+        return;
+    }
+    //With a response delay the next request waits until all replies are sent
+    if ((conf_modbus_delay_ms > 0) && ((conn->tx_due != 0) || (conn->tx_len != conn->tx_head)))
+    {
+        return;
+    }
+    lane = modbusTcp_requestLane(conn);
+    if (lane >= 0)
+    {
+        modbusTcp_readyAppend(conn, lane);
+    }
+    else
+    {
+        conn->deficit = 0;
+    }
+}
+
+/**
+ * @brief Put a connection to its position in the delay heap
+ * @param[in] r Reactor
+ * @param[in] conn Connection
+ * @param[in] index Position
+ */
+static void modbusTcp_delaySet(modbusTcp_reactor_t *r, modbusTcp_connection_t *conn, int index)
+{
+    r->delay_heap[index] = conn;
+    conn->delay_index = index;
+}
+
+/**
+ * @brief Restore the heap order for a connection due earlier or later than
+ * before, moving it up or down
+ * @param[in] r Reactor
+ * @param[in] index Position of the connection
+ */
+static void modbusTcp_delaySift(modbusTcp_reactor_t *r, int index)
+{
+    modbusTcp_connection_t *conn = r->delay_heap[index];
+
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+
+        if (r->delay_heap[parent]->tx_due <= conn->tx_due)
+        {
+            break;
+        }
+        modbusTcp_delaySet(r, r->delay_heap[parent], index);
+        index = parent;
+    }
+    while (1)
+    {
+        int child = 2 * index + 1;
+
+        if (child >= r->delay_count)
+        {
+            break;
+        }
+        if (((child + 1) < r->delay_count) && (r->delay_heap[child + 1]->tx_due < r->delay_heap[child]->tx_due))
+        {
+            child++;
+        }
+        if (conn->tx_due <= r->delay_heap[child]->tx_due)
+        {
+            break;
+        }
+        modbusTcp_delaySet(r, r->delay_heap[child], index);
+        index = child;
+    }
+    modbusTcp_delaySet(r, conn, index);
+}
+
+/**
+ * @brief Arm the delay timer for the first due connection or disarm it.
+ * With io_uring the reactor waits until then instead.
+ * @param[in] r Reactor
+ */
+static void modbusTcp_delayArm(modbusTcp_reactor_t *r)
+{
+    struct itimerspec its;
+    uint64_t due;
+
+    if (r->delay_fd == -1)
+    {
+        return;
+    }
+    memset(&its, 0, sizeof(its));
+    if (r->delay_count > 0)
+    {
+        due = r->delay_heap[0]->tx_due;
+        its.it_value.tv_sec = due / 1000000;
+        its.it_value.tv_nsec = (due % 1000000) * 1000;
+    }
+    modbusStats_addSyscalls(1);
+    if (timerfd_settime(r->delay_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+    {
+        fprintf(stderr, "Unable to arm delay timer: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * @brief Park the queued replies of a connection until they are due
+ * @param[in] conn Connection with queued replies
+ * @param[in] due Time in us when the replies are sent
+ */
+static void modbusTcp_delayPush(modbusTcp_connection_t *conn, uint64_t due)
+{
+    modbusTcp_reactor_t *r = conn->reactor;
+
+    conn->tx_due = due;
+    if (conn->delay_index < 0)
+    {
+        modbusTcp_delaySet(r, conn, r->delay_count++);
+    }
+    modbusTcp_delaySift(r, conn->delay_index);
+    //Timer only changes if the connection became the first due one
+    if (conn->delay_index == 0)
+    {
+        modbusTcp_delayArm(r);
+    }
+}
+
+/**
+ * @brief Remove a connection from the delay heap, its replies are no
+ * longer parked
+ * @param[in] conn Connection in the delay heap
+ */
+static void modbusTcp_delayRemove(modbusTcp_connection_t *conn)
+{
+    modbusTcp_reactor_t *r = conn->reactor;
+    int index = conn->delay_index;
+
+    conn->delay_index = -1;
+    conn->tx_due = 0;
+    r->delay_count--;
+    if (index < r->delay_count)
+    {
+        modbusTcp_delaySet(r, r->delay_heap[r->delay_count], index);
+        modbusTcp_delaySift(r, index);
+    }
+    if (index == 0)
+    {
+        modbusTcp_delayArm(r);
+    }
+}
+
+/**
+ * @brief Close connection and release its slot
+ * @param[in] conn Connection to be closed
+ */
+static void modbusTcp_closeConnection(modbusTcp_connection_t *conn)
+{
+    if (conn->linked)
+    {
+        modbusTcp_wheelRemove(conn);
+        modbusTcp_lruRemove(conn);
+        conn->linked = FALSE;
+    }
+    if (conn->ready)
+    {
+        modbusTcp_readyRemove(conn);
+    }
+    if (conn->delay_index >= 0)
+    {
+        modbusTcp_delayRemove(conn);
+    }
+    modbusTcp_releaseRefs(conn);
+
+#ifdef HAVE_LIBURING
+    //Pending submissions still refer to socket and output queue, shutdown
+    //lets them complete and the last completion closes the connection
+    if (conn->uring_pending > 0)
+    {
+        if (!conn->closing)
+        {
+            shutdown(conn->fd, SHUT_RDWR);
+            conn->closing = TRUE;
+        }
+        return;
+    }
+    if (conn->reactor->uring)
+    {
+        modbusTcp_uringReleaseHeld(conn);
+    }
+#endif
+    dprintf(VERBOSE_STD, "Connection closed on socket %d\n", conn->fd);
+    if (conn->reactor->epoll_fd != -1)
+    {
+        epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    }
+    close(conn->fd);
+    modbus_free(conn->ctx);
+    conn->ctx = NULL;
+    pthread_mutex_lock(&conn->reactor->stats_mutex);
+    conn->fd = -1;
+    pthread_mutex_unlock(&conn->reactor->stats_mutex);
+    free(conn->tx_buf);
+    conn->tx_buf = NULL;
+    __sync_fetch_and_sub(&connection_count, 1);
+}
+
+/**
+ * @brief Acknowledge received data immediately. The kernel falls back to
+ * delayed ACKs by itself, so this is repeated after every receive.
+ * @param[in] fd Socket of the connection
+ */
+static void modbusTcp_quickAck(int fd)
+{
+    int enable = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &enable, sizeof(enable));
+}
+
+/**
+ * @brief Set the socket options of the low latency profile on an accepted
+ * socket. Replies are sent without Nagle delay and received data are
+ * acknowledged immediately. SO_BUSY_POLL lets the kernel poll the device
+ * queue instead of waiting for an interrupt, it needs CAP_NET_ADMIN and
+ * a failure only costs latency.
+ * @param[in] fd Socket of the connection
+ */
+static void modbusTcp_tuneSocket(int fd)
+{
+    int enable = 1;
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) == -1)
+    {
+        dprintf(VERBOSE_DEBUG, "TCP_NODELAY failed on socket %d: %s\n", fd, strerror(errno));
+    }
+    modbusTcp_quickAck(fd);
+#ifdef SO_BUSY_POLL
+    if ((conf_modbus_busy_poll_us > 0) &&
+        (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &conf_modbus_busy_poll_us, sizeof(conf_modbus_busy_poll_us)) == -1))
+    {
+        dprintf(VERBOSE_DEBUG, "SO_BUSY_POLL failed on socket %d: %s\n", fd, strerror(errno));
+    }
+#endif
+}
+
+/**
+ * @brief Find the reactor owning the least recently used connection of all
+ * reactors. The oldest connection of each reactor is published by its
+ * owner, so this does not touch the connection lists of other threads.
+ * @return Reactor of the least recently used connection
+ * @retval NULL if no reactor has a connection
+ */
+static modbusTcp_reactor_t *modbusTcp_evictTarget(void)
+{
+    modbusTcp_reactor_t *target = NULL;
+    uint64_t oldest = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < reactor_count; i++)
+    {
+        uint64_t used = __atomic_load_n(&reactors[i].lru_oldest, __ATOMIC_RELAXED);
+
+        if (used < oldest)
+        {
+            oldest = used;
+            target = &reactors[i];
+        }
+    }
+    return target;
+}
+
+/**
+ * @brief Close the least recently used connections other reactors asked
+ * for. A request is dropped if the connection limit is not exceeded any
+ * more, e.g. because a master has disconnected meanwhile.
+ * @param[in] r Reactor which owns the connections
+ */
+static void modbusTcp_evictRequested(modbusTcp_reactor_t *r)
+{
+    int requests = __atomic_exchange_n(&r->evict_requests, 0, __ATOMIC_ACQ_REL);
+
+    while ((requests > 0) && (r->lru_first != NULL) &&
+           (__atomic_load_n(&connection_count, __ATOMIC_RELAXED) > conf_max_tcp_connections))
+    {
+        dprintf(VERBOSE_STD, "Maximum of %d connections reached, closing least recently used socket %d\n",
+                conf_max_tcp_connections, r->lru_first->fd);
+        modbusStats_add(MODBUSSTATS_TCP_EVICTED, 1);
+        modbusTcp_closeConnection(r->lru_first);
+        requests--;
+    }
+}
+
+/**
+ * @brief Take over an accepted master connection. If max_tcp_connections is
+ * reached the connection is closed immediately, or with the LRU policy the
+ * least recently used connection of all reactors is closed for it. A
+ * connection of another reactor is closed by its owner, the new master is
+ * accepted meanwhile.
+ * @param[in] r Reactor which accepted the connection
+ * @param[in] newfd Non-blocking socket of the connection
+ * @param[in] clientaddr Address of the master
+ */
+static void modbusTcp_addConnection(modbusTcp_reactor_t *r, int newfd, struct sockaddr_in *clientaddr)
+{
+    modbusTcp_connection_t *conn = NULL;
+    size_t tx_size = MODBUSTCP_TX_BUFFER_SIZE;
+    int i;
+
+    if (__sync_add_and_fetch(&connection_count, 1) > conf_max_tcp_connections)
+    {
+        modbusTcp_reactor_t *target = NULL;
+
+        if (conf_modbus_connection_policy == CONF_CONNECTION_POLICY_EVICT_LRU)
+        {
+            target = modbusTcp_evictTarget();
+        }
+
+        if (target == r)
+        {
+            __sync_add_and_fetch(&r->evict_requests, 1);
+            modbusTcp_evictRequested(r);
+        }
+        else if (target != NULL)
+        {
+            uint64_t one = 1;
+
+            __sync_add_and_fetch(&target->evict_requests, 1);
+            if (write(target->evict_fd, &one, sizeof(one)) < 0)
+            {
+                dprintf(VERBOSE_DEBUG, "Wakeup of reactor %d for eviction failed: %s\n", target->id, strerror(errno));
+            }
+        }
+        else
+        {
+            __sync_fetch_and_sub(&connection_count, 1);
+            dprintf(VERBOSE_STD, "Modbus connection from %s:%d refused, maximum of %d connections reached\n",
+                    inet_ntoa(clientaddr->sin_addr), ntohs(clientaddr->sin_port), conf_max_tcp_connections);
+            modbusStats_add(MODBUSSTATS_TCP_REFUSED, 1);
+            close(newfd);
+            return;
+        }
+    }
+
+    for (i = 0; i < MODBUSTCP_SLOT_COUNT; i++)
+    {
+        if (r->connections[i].fd == -1)
+        {
+            conn = &r->connections[i];
+            break;
+        }
+    }
+    if (conn == NULL)
+    {
+        //All slots of this reactor are still closing
+        __sync_fetch_and_sub(&connection_count, 1);
+        close(newfd);
+        return;
+    }
+
+    //Each connection gets its own context, the address is not used for accepted sockets
+    conn->ctx = modbus_new_tcp("127.0.0.1", conf_modbus_port);
+    if (conn->ctx == NULL)
+    {
+        fprintf(stderr, "Unable to allocate libmodbus context\n");
+        __sync_fetch_and_sub(&connection_count, 1);
+        close(newfd);
+        return;
+    }
+    modbus_set_socket(conn->ctx, newfd);
+    conn->ctx->backend = &modbusTcp_backend;
+
+#ifdef HAVE_LIBURING
+    //A submitted send refers to the output queue, so it must never be moved
+    if (r->uring)
+    {
+        tx_size = conf_modbus_output_queue_bytes;
+    }
+#endif
+    conn->tx_buf = malloc(tx_size);
+    if (conn->tx_buf == NULL)
+    {
+        fprintf(stderr, "Unable to allocate output queue\n");
+        modbus_free(conn->ctx);
+        conn->ctx = NULL;
+        __sync_fetch_and_sub(&connection_count, 1);
+        close(newfd);
+        return;
+    }
+
+    if (conf_modbus_latency_profile == CONF_LATENCY_PROFILE_LOW)
+    {
+        modbusTcp_tuneSocket(newfd);
+    }
+
+    //The statistics writer sees the slot either free or with its new master
+    pthread_mutex_lock(&r->stats_mutex);
+    conn->fd = newfd;
+    conn->addr = *clientaddr;
+    conn->stat_requests = 0;
+    conn->stat_wait_sum = 0;
+    conn->stat_wait_max = 0;
+    pthread_mutex_unlock(&r->stats_mutex);
+    conn->rx_len = 0;
+    conn->rx_state = MODBUSTCP_RX_HEADER;
+    conn->tx_size = tx_size;
+    conn->tx_head = 0;
+    conn->tx_len = 0;
+    conn->tx_overflow = FALSE;
+    conn->tx_waiting = FALSE;
+    conn->rx_paused = FALSE;
+    conn->rx_eof = FALSE;
+    conn->tx_due = 0;
+    conn->delay_index = -1;
+    conn->deficit = 0;
+    conn->last_used = modbusTcp_nowUs();
+    conn->last_active = (time_t)(conn->last_used / 1000000);
+    conn->linked = TRUE;
+    modbusTcp_wheelInsert(conn, conn->last_active + conf_modbus_idle_timeout_s);
+    modbusTcp_lruAppend(conn);
+#ifdef HAVE_LIBURING
+    conn->tx_inflight = 0;
+    conn->uring_pending = 0;
+    conn->rx_held_first = 0;
+    conn->rx_held_count = 0;
+    conn->rx_rearm = FALSE;
+    conn->closing = FALSE;
+    if (r->uring)
+    {
+        if (modbusTcp_uringRecv(conn) < 0)
+        {
+            modbusTcp_closeConnection(conn);
+            return;
+        }
+    }
+    else
+#endif
+    {
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = conn;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, newfd, &ev) == -1)
+        {
+            fprintf(stderr, "Unable to add socket %d to epoll: %s\n", newfd, strerror(errno));
+            modbusTcp_closeConnection(conn);
+            return;
+        }
+    }
+
+    modbusStats_add(MODBUSSTATS_TCP_ACCEPTED, 1);
+    dprintf(VERBOSE_STD, "New Modbus connection from %s:%d on socket %d (reactor %d)\n",
+            inet_ntoa(clientaddr->sin_addr), ntohs(clientaddr->sin_port), newfd, r->id);
+}
+
+/**
+ * @brief Accept a new master connection
+ * @param[in] r Reactor with pending connection
+ */
+static void modbusTcp_accept(modbusTcp_reactor_t *r)
+{
+    socklen_t addrlen;
+    struct sockaddr_in clientaddr;
+    int newfd;
+
+    addrlen = sizeof(clientaddr);
+    memset(&clientaddr, 0, sizeof(clientaddr));
+    newfd = accept4(r->server_socket, (struct sockaddr *) &clientaddr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (newfd == -1)
+    {
+        //Nothing to do if the connection was already reset by the master
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+        {
+            fprintf(stderr, "Server accept error\n");
+        }
+        return;
+    }
+
+    modbusTcp_addConnection(r, newfd, &clientaddr);
+}
+
+/**
+ * @brief Update the epoll events of a connection. Receiving is paused while
+ * the replies of the connection are parked or its receive buffer is full,
+ * epoll is level-triggered and would report the unread data again and again.
+ * After the master has shut down sending receiving stays paused, the end of
+ * stream would be reported again and again as well.
+ * The master is slowed down by TCP flow control meanwhile. Nothing is done
+ * for an io_uring reactor.
+ * @param[in] conn Connection
+ * @param[in] waiting EPOLLOUT is needed for unsent data
+ * @retval 0 on success
+ * @retval -3 on failure, connection has to be closed
+ */
+static int modbusTcp_watch(modbusTcp_connection_t *conn, char waiting)
+{
+    struct epoll_event ev;
+    char paused = (conn->tx_due != 0) || (conn->rx_len == sizeof(conn->rx_buf)) || conn->rx_eof;
+
+    if ((conn->reactor->epoll_fd == -1) || ((waiting == conn->tx_waiting) && (paused == conn->rx_paused)))
+    {
+        return 0;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (paused ? 0 : (EPOLLIN | EPOLLRDHUP)) | (waiting ? EPOLLOUT : 0);
+    ev.data.ptr = conn;
+    modbusStats_addSyscalls(1);
+    if (epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) == -1)
+    {
+        fprintf(stderr, "Unable to modify socket %d in epoll: %s\n", conn->fd, strerror(errno));
+        return -3;
+    }
+    conn->tx_waiting = waiting;
+    conn->rx_paused = paused;
+    return 0;
+}
+
+/**
+ * @brief Send as much of the output queue as the socket takes without
+ * blocking. EPOLLOUT is enabled as long as unsent data are left. Replies
+ * referring to the shadow are sent with the queue in one sendmsg first.
+ * @param[in] conn Connection with queued replies
+ * @retval 0 on success
+ * @retval <0 on failure, connection has to be closed
+ */
+static int modbusTcp_sendReplies(modbusTcp_connection_t *conn)
+{
+    ssize_t rc;
+    char full = FALSE;
+
+    if (conn->tx_overflow)
+    {
+        modbusTcp_releaseRefs(conn);
+        return -1;
+    }
+
+    if (conn->tx_ref_count > 0)
+    {
+        if (modbusTcp_sendRefs(conn) < 0)
+        {
+            return -2;
+        }
+        //A short send means a full socket buffer, don't ask again for EAGAIN
+        full = (conn->tx_len > 0);
+    }
+
+#ifdef HAVE_LIBURING
+    if (conn->reactor->uring)
+    {
+        return modbusTcp_uringSend(conn);
+    }
+#endif
+
+    while (!full && (conn->tx_head < conn->tx_len))
+    {
+        size_t pending = conn->tx_len - conn->tx_head;
+
+        rc = send(conn->fd, &conn->tx_buf[conn->tx_head], pending, MSG_NOSIGNAL);
+        modbusStats_addSyscalls(1);
+        if (rc >= 0)
+        {
+            conn->tx_head += rc;
+            //A short send means a full socket buffer, don't ask again for EAGAIN
+            if ((size_t)rc < pending)
+            {
+                break;
+            }
+        }
+        else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            dprintf(VERBOSE_STD, "Send failed on socket %d: %s\n", conn->fd, strerror(errno));
+            return -2;
+        }
+    }
+
+    if (conn->tx_head == conn->tx_len)
+    {
+        conn->tx_head = 0;
+        conn->tx_len = 0;
+    }
+
+    //Socket buffer is full, wait until the master takes the rest
+    return modbusTcp_watch(conn, (conn->tx_len > 0));
+}
+
+/**
+ * @brief Handle complete requests in the receive buffer of a connection in
+ * their order. Incomplete data and requests beyond the quota stay in the
+ * buffer. Served from the priority lane, handling stops at the first
+ * process data request.
+ * @param[in] conn Connection with received data
+ * @param[in] quota Maximum number of requests to be handled
+ * @param[in] lane Lane the connection is served from
+ * @return Number of handled requests
+ * @retval <0 on protocol or send failure, connection has to be closed
+ */
+static int modbusTcp_handleRequests(modbusTcp_connection_t *conn, int quota, int lane)
+{
+    size_t pos = 0;
+    int served = 0;
+    int rc = 0;
+
+    current_connection = conn;
+    while (served < quota)
+    {
+        uint8_t *frame = &conn->rx_buf[pos];
+        uint64_t wait;
+        int request_lane;
+        size_t available = conn->rx_len - pos;
+
+        if (conn->rx_state == MODBUSTCP_RX_HEADER)
+        {
+            size_t length;
+
+            if (available < MODBUSTCP_MBAP_LENGTH)
+            {
+                break;
+            }
+
+            //Check header as soon as it is complete, don't wait for the rest
+            //Length field counts unit identifier and PDU
+            length = (frame[4] << 8) + frame[5];
+            if ((frame[2] != 0) || (frame[3] != 0))
+            {
+                dprintf(VERBOSE_STD, "Invalid MBAP protocol identifier on socket %d\n", conn->fd);
+                rc = -1;
+                break;
+            }
+            if ((length < 2) || ((length + MODBUSTCP_MBAP_LENGTH - 1) > MAX_REQUEST_MESSAGE_LENGTH))
+            {
+                dprintf(VERBOSE_STD, "Invalid MBAP length %zu on socket %d\n", length, conn->fd);
+                rc = -1;
+                break;
+            }
+            conn->rx_frame_length = length + MODBUSTCP_MBAP_LENGTH - 1;
+            conn->rx_state = MODBUSTCP_RX_PDU;
+        }
+
+        if (available < conn->rx_frame_length)
+        {
+            break;
+        }
+
+        request_lane = modbusTcp_classify(&frame[MODBUSTCP_MBAP_LENGTH], conn->rx_frame_length - MODBUSTCP_MBAP_LENGTH);
+        if ((lane == MODBUS_LANE_PRIORITY) && (request_lane != MODBUS_LANE_PRIORITY))
+        {
+            break;
+        }
+
+        wait = modbusTcp_nowUs() - conn->ready_since;
+        modbusStats_addLaneWait(request_lane, (wait > UINT32_MAX) ? UINT32_MAX : (uint32_t)wait);
+        //Statistics are read by the main loop
+        __sync_fetch_and_add(&conn->stat_requests, 1);
+        __sync_fetch_and_add(&conn->stat_wait_sum, wait);
+        if (wait > conn->stat_wait_max)
+        {
+            __sync_lock_test_and_set(&conn->stat_wait_max, wait);
+        }
+
+        modbusTcp_worker(conn->ctx, frame, conn->rx_frame_length);
+        pos += conn->rx_frame_length;
+        conn->rx_state = MODBUSTCP_RX_HEADER;
+        served++;
+
+        //Don't handle further requests of a master which doesn't take its replies
+        if (conn->tx_overflow)
+        {
+            break;
+        }
+    }
+    current_connection = NULL;
+
+    if ((rc == 0) && (conf_modbus_delay_ms > 0) && (conn->tx_len != conn->tx_head) && !conn->tx_overflow)
+    {
+        modbusTcp_delayPush(conn, modbusTcp_nowUs() + (uint64_t)conf_modbus_delay_ms * 1000);
+    }
+    else if ((rc == 0) && (modbusTcp_sendReplies(conn) < 0))
+    {
+        rc = -2;
+    }
+
+    //Move incomplete request to the start of the buffer
+    if (pos > 0)
+    {
+        conn->rx_len -= pos;
+        memmove(conn->rx_buf, &conn->rx_buf[pos], conn->rx_len);
+    }
+
+    return (rc < 0) ? rc : served;
+}
+
+/**
+ * @brief Receive data of an already connected master. The connection is
+ * handed to the scheduler as soon as a request is complete. When the master
+ * shuts down sending, the requests already received are still answered and
+ * the connection is closed after their replies are sent.
+ * @param[in] conn Connection with pending data
+ */
+static void modbusTcp_receive(modbusTcp_connection_t *conn)
+{
+    ssize_t rc;
+
+    //Read until the socket is empty or the buffer is full
+    while (conn->rx_len < sizeof(conn->rx_buf))
+    {
+        rc = recv(conn->fd, &conn->rx_buf[conn->rx_len], sizeof(conn->rx_buf) - conn->rx_len, 0);
+        if (rc > 0)
+        {
+            conn->rx_len += rc;
+            modbusTcp_touch(conn);
+        }
+        else if (rc == 0)
+        {
+            //Master has shut down sending, answer what is received
+            conn->rx_eof = TRUE;
+            break;
+        }
+        else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            dprintf(VERBOSE_STD, "Receive failed on socket %d: %s\n", conn->fd, strerror(errno));
+            modbusTcp_closeConnection(conn);
+            return;
+        }
+    }
+
+    if (conf_modbus_latency_profile == CONF_LATENCY_PROFILE_LOW)
+    {
+        modbusTcp_quickAck(conn->fd);
+    }
+    if (modbusTcp_watch(conn, conn->tx_waiting) < 0)
+    {
+        modbusTcp_closeConnection(conn);
+        return;
+    }
+    modbusTcp_schedule(conn);
+    if (modbusTcp_finished(conn))
+    {
+        modbusTcp_closeConnection(conn);
+    }
+}
+
+#ifdef HAVE_LIBURING
+/**
+ * @brief Submit the multishot accept of the listening socket
+ * @param[in] r Reactor
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+static int modbusTcp_uringAccept(modbusTcp_reactor_t *r)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = modbusTcp_uringGetSqe(r, NULL, MODBUSTCP_URING_ACCEPT);
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+    io_uring_prep_multishot_accept(sqe, r->server_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    return 0;
+}
+
+/**
+ * @brief Submit a read of the eviction eventfd, its completion wakes the
+ * reactor when another reactor asks for its least recently used connection
+ * @param[in] r Reactor
+ * @retval 0 on success
+ * @retval -1 if the submission queue is full
+ */
+static int modbusTcp_uringEvictRead(modbusTcp_reactor_t *r)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = modbusTcp_uringGetSqe(r, NULL, MODBUSTCP_URING_EVICT);
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+    io_uring_prep_read(sqe, r->evict_fd, &r->evict_value, sizeof(r->evict_value), 0);
+    return 0;
+}
+
+/**
+ * @brief Handle a completed accept. The multishot accept is submitted again
+ * if the kernel has terminated it.
+ * @param[in] r Reactor
+ * @param[in] cqe Completion
+ */
+static void modbusTcp_uringAccepted(modbusTcp_reactor_t *r, struct io_uring_cqe *cqe)
+{
+    if (cqe->res >= 0)
+    {
+        struct sockaddr_in clientaddr;
+        socklen_t addrlen = sizeof(clientaddr);
+
+        memset(&clientaddr, 0, sizeof(clientaddr));
+        getpeername(cqe->res, (struct sockaddr *)&clientaddr, &addrlen);
+        modbusTcp_addConnection(r, cqe->res, &clientaddr);
+    }
+    else if (cqe->res != -EAGAIN)
+    {
+        fprintf(stderr, "Server accept error: %s\n", strerror(-cqe->res));
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && modbusTcp_running)
+    {
+        modbusTcp_uringAccept(r);
+    }
+}
+
+/**
+ * @brief Move held receive buffers into the receive buffer and hand the
+ * connection to the scheduler. Like the epoll path only one receive buffer
+ * of requests is handled per send, the receive buffer is refilled when the
+ * send has completed. Buffers go back to the ring as soon as they are
+ * copied.
+ * @param[in] conn Connection
+ * @retval 0 on success
+ * @retval <0 on failure or if the master has shut down sending and all its
+ * requests are answered, connection has to be closed
+ */
+static int modbusTcp_uringProcess(modbusTcp_connection_t *conn)
+{
+    modbusTcp_reactor_t *r = conn->reactor;
+
+    while ((conn->rx_held_count > 0) && (conn->tx_inflight == 0) && (conn->rx_len < sizeof(conn->rx_buf)))
+    {
+        modbusTcp_uringHeld_t *held = &conn->rx_held[conn->rx_held_first];
+        size_t n = held->len - held->offset;
+
+        if (n > (sizeof(conn->rx_buf) - conn->rx_len))
+        {
+            n = sizeof(conn->rx_buf) - conn->rx_len;
+        }
+        memcpy(&conn->rx_buf[conn->rx_len], &r->buffers[held->bid * MODBUSTCP_URING_BUFFER_SIZE + held->offset], n);
+        conn->rx_len += n;
+        held->offset += n;
+        if (held->offset == held->len)
+        {
+            modbusTcp_uringRecycle(r, held->bid);
+            conn->rx_held_first = (conn->rx_held_first + 1) % MODBUSTCP_URING_MAX_HELD;
+            conn->rx_held_count--;
+        }
+    }
+    modbusTcp_schedule(conn);
+
+    //Receive was paused because of missing buffers, continue now unless
+    //replies are parked or the receive buffer is still full
+    if ((conn->rx_held_count < MODBUSTCP_URING_MAX_HELD) && conn->rx_rearm && (conn->tx_due == 0) &&
+        (conn->rx_len < sizeof(conn->rx_buf)) && !conn->rx_eof)
+    {
+        conn->rx_rearm = FALSE;
+        if (modbusTcp_uringRecv(conn) < 0)
+        {
+            return -2;
+        }
+    }
+    //Master has shut down sending and everything is answered
+    if (modbusTcp_finished(conn))
+    {
+        return -3;
+    }
+    return 0;
+}
+
+/**
+ * @brief Handle a completed receive. The buffer is held by the connection
+ * until its data are copied to the receive buffer.
+ * @param[in] conn Connection
+ * @param[in] cqe Completion
+ */
+static void modbusTcp_uringReceived(modbusTcp_connection_t *conn, struct io_uring_cqe *cqe)
+{
+    modbusTcp_reactor_t *r = conn->reactor;
+    int error = 0;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if ((cqe->res > 0) && !conn->closing && (conn->rx_held_count < MODBUSTCP_URING_MAX_HELD))
+        {
+            modbusTcp_uringHeld_t *held;
+
+            held = &conn->rx_held[(conn->rx_held_first + conn->rx_held_count) % MODBUSTCP_URING_MAX_HELD];
+            held->bid = bid;
+            held->offset = 0;
+            held->len = cqe->res;
+            conn->rx_held_count++;
+            modbusTcp_touch(conn);
+            if (conf_modbus_latency_profile == CONF_LATENCY_PROFILE_LOW)
+            {
+                modbusTcp_quickAck(conn->fd);
+            }
+        }
+        else
+        {
+            //A master which keeps sending but does not take its replies
+            if ((cqe->res > 0) && !conn->closing)
+            {
+                dprintf(VERBOSE_STD, "Too many unhandled requests on socket %d\n", conn->fd);
+                error = -1;
+            }
+            modbusTcp_uringRecycle(r, bid);
+        }
+    }
+
+    if (cqe->res == 0)
+    {
+        //Master has shut down sending, answer what is received
+        conn->rx_eof = TRUE;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        conn->uring_pending--;
+        if (!conn->closing && !conn->rx_eof && (((cqe->res == -ENOBUFS) && (conn->rx_held_count > 0)) ||
+                               (conn->rx_held_count >= MODBUSTCP_URING_MAX_HELD) ||
+                               (conn->tx_due != 0) || (conn->rx_len == sizeof(conn->rx_buf))))
+        {
+            //Ring ran out of buffers, the connection holds enough requests,
+            //its replies are parked or its receive buffer is full, continue
+            //when held buffers are returned
+            conn->rx_rearm = TRUE;
+        }
+        else if (!conn->closing && ((cqe->res > 0) || (cqe->res == -ENOBUFS)))
+        {
+            if (modbusTcp_uringRecv(conn) < 0)
+            {
+                error = -2;
+            }
+        }
+    }
+
+    if (conn->closing)
+    {
+        modbusTcp_closeConnection(conn);
+    }
+    else if (((cqe->res < 0) && (cqe->res != -ENOBUFS)) || (error < 0))
+    {
+        //Connection failed
+        modbusTcp_closeConnection(conn);
+    }
+    else if (modbusTcp_uringProcess(conn) < 0)
+    {
+        modbusTcp_closeConnection(conn);
+    }
+}
+
+/**
+ * @brief Handle a completed send. Unsent data are moved to the start of the
+ * output queue, which is safe now because nothing refers to it.
+ * @param[in] conn Connection
+ * @param[in] cqe Completion
+ */
+static void modbusTcp_uringSent(modbusTcp_connection_t *conn, struct io_uring_cqe *cqe)
+{
+    conn->uring_pending--;
+    conn->tx_inflight = 0;
+
+    if (conn->closing)
+    {
+        modbusTcp_closeConnection(conn);
+        return;
+    }
+    if (cqe->res < 0)
+    {
+        dprintf(VERBOSE_STD, "Send failed on socket %d: %s\n", conn->fd, strerror(-cqe->res));
+        modbusTcp_closeConnection(conn);
+        return;
+    }
+
+    conn->tx_head += cqe->res;
+    if (conn->tx_head > 0)
+    {
+        memmove(conn->tx_buf, &conn->tx_buf[conn->tx_head], conn->tx_len - conn->tx_head);
+        conn->tx_len -= conn->tx_head;
+        conn->tx_head = 0;
+    }
+    if ((modbusTcp_sendReplies(conn) < 0) || (modbusTcp_uringProcess(conn) < 0))
+    {
+        modbusTcp_closeConnection(conn);
+    }
+}
+
+/**
+ * @brief Submit pending entries, wait for completions and handle them
+ * @param[in] r Reactor to be polled
+ * @param[in] timeout_ms Maximum time to wait for a completion
+ * @return Number of handled completions
+ * @retval <0 on failure
+ */
+static int modbusTcp_uringPoll(modbusTcp_reactor_t *r, int timeout_ms)
+{
+    struct __kernel_timespec ts;
+    struct io_uring_cqe *cqe;
+    unsigned head;
+    int count = 0;
+    int rc;
+
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    //Wake up when the first parked replies are due
+    if (r->delay_count > 0)
+    {
+        uint64_t now = modbusTcp_nowUs();
+        uint64_t due = r->delay_heap[0]->tx_due;
+        uint64_t wait = (due > now) ? (due - now) : 0;
+
+        if (wait < ((uint64_t)timeout_ms * 1000))
+        {
+            ts.tv_sec = wait / 1000000;
+            ts.tv_nsec = (wait % 1000000) * 1000LL;
+        }
+    }
+    rc = io_uring_submit_and_wait_timeout(&r->ring, &cqe, 1, &ts, NULL);
+    if ((rc < 0) && (rc != -ETIME) && (rc != -EINTR))
+    {
+        fprintf(stderr, "Server io_uring failure: %s\n", strerror(-rc));
+        return -1;
+    }
+
+    io_uring_for_each_cqe(&r->ring, head, cqe)
+    {
+        uintptr_t data = (uintptr_t)io_uring_cqe_get_data(cqe);
+        modbusTcp_connection_t *conn = (modbusTcp_connection_t *)(data & ~(uintptr_t)MODBUSTCP_URING_OP_MASK);
+
+        switch (data & MODBUSTCP_URING_OP_MASK)
+        {
+            case MODBUSTCP_URING_ACCEPT:
+                modbusTcp_uringAccepted(r, cqe);
+                break;
+            case MODBUSTCP_URING_RECV:
+                modbusTcp_uringReceived(conn, cqe);
+                break;
+            case MODBUSTCP_URING_SEND:
+                modbusTcp_uringSent(conn, cqe);
+                break;
+            case MODBUSTCP_URING_EVICT:
+                //Requests are handled after the poll
+                if (modbusTcp_running)
+                {
+                    modbusTcp_uringEvictRead(r);
+                }
+                break;
+        }
+        count++;
+    }
+    io_uring_cq_advance(&r->ring, count);
+
+    //Hand over sends and receives of the handled completions immediately
+    io_uring_submit(&r->ring);
+    return count;
+}
+
+/**
+ * @brief Check if a receive into a buffer of the provided buffer ring works
+ * like modbusTcp_uringRecv submits it, one byte is received from a socket
+ * pair. Provided buffer rings came with the same kernel as multishot accept,
+ * so accept needs no check of its own.
+ * @param[in] r Reactor with initialized ring and buffer ring
+ * @retval 0 if supported
+ * @retval <0 if not supported
+ */
+static int modbusTcp_uringProbe(modbusTcp_reactor_t *r)
+{
+    struct __kernel_timespec ts = {1, 0};
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe = NULL;
+    int sv[2];
+    int error = -1;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+    {
+        return -1;
+    }
+
+    sqe = io_uring_get_sqe(&r->ring);
+    io_uring_prep_recv(sqe, sv[0], NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = MODBUSTCP_URING_BUFFER_GROUP;
+    io_uring_sqe_set_data(sqe, NULL);
+    if ((write(sv[1], "", 1) == 1) && (io_uring_submit_and_wait_timeout(&r->ring, &cqe, 1, &ts, NULL) >= 0))
+    {
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+        {
+            modbusTcp_uringRecycle(r, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            if (cqe->res == 1)
+            {
+                error = 0;
+            }
+        }
+        io_uring_cqe_seen(&r->ring, cqe);
+    }
+
+    close(sv[1]);
+    close(sv[0]);
+    return error;
+}
+
+/**
+ * @brief Set up ring and provided buffer ring of a reactor and submit the
+ * multishot accept
+ * @param[in] r Reactor with listening socket
+ * @retval 0 on success
+ * @retval <0 if io_uring is not available, the reactor has to use epoll
+ */
+static int modbusTcp_uringInit(modbusTcp_reactor_t *r)
+{
+    int rc;
+    int i;
+
+    rc = io_uring_queue_init(MODBUSTCP_URING_ENTRIES, &r->ring, 0);
+    if (rc < 0)
+    {
+        dprintf(VERBOSE_STD, "ModbusTcp: io_uring not available: %s\n", strerror(-rc));
+        return -1;
+    }
+
+    r->buffers = malloc(MODBUSTCP_URING_BUFFERS * MODBUSTCP_URING_BUFFER_SIZE);
+    r->buf_ring = io_uring_setup_buf_ring(&r->ring, MODBUSTCP_URING_BUFFERS, MODBUSTCP_URING_BUFFER_GROUP, 0, &rc);
+    if ((r->buffers == NULL) || (r->buf_ring == NULL))
+    {
+        dprintf(VERBOSE_STD, "ModbusTcp: io_uring provided buffers not available: %s\n", strerror(-rc));
+        free(r->buffers);
+        r->buffers = NULL;
+        r->buf_ring = NULL;
+        io_uring_queue_exit(&r->ring);
+        return -2;
+    }
+    for (i = 0; i < MODBUSTCP_URING_BUFFERS; i++)
+    {
+        modbusTcp_uringRecycle(r, i);
+    }
+
+    rc = modbusTcp_uringProbe(r);
+    if (rc < 0)
+    {
+        dprintf(VERBOSE_STD, "ModbusTcp: io_uring receive with provided buffers not supported by the kernel\n");
+    }
+    else if ((modbusTcp_uringAccept(r) < 0) || (modbusTcp_uringEvictRead(r) < 0))
+    {
+        dprintf(VERBOSE_STD, "ModbusTcp: io_uring submission queue full\n");
+        rc = -1;
+    }
+    if (rc < 0)
+    {
+        io_uring_free_buf_ring(&r->ring, r->buf_ring, MODBUSTCP_URING_BUFFERS, MODBUSTCP_URING_BUFFER_GROUP);
+        r->buf_ring = NULL;
+        free(r->buffers);
+        r->buffers = NULL;
+        io_uring_queue_exit(&r->ring);
+        return -3;
+    }
+
+    r->uring = TRUE;
+    return 0;
+}
+
+/**
+ * @brief Tear down the ring of a reactor. All submissions are cancelled, so
+ * the connections can be closed afterwards.
+ * @param[in] r Reactor
+ */
+static void modbusTcp_uringDeInit(modbusTcp_reactor_t *r)
+{
+    int i;
+
+    io_uring_free_buf_ring(&r->ring, r->buf_ring, MODBUSTCP_URING_BUFFERS, MODBUSTCP_URING_BUFFER_GROUP);
+    io_uring_queue_exit(&r->ring);
+    free(r->buffers);
+    r->buffers = NULL;
+    r->buf_ring = NULL;
+    r->uring = FALSE;
+
+    for (i = 0; i < MODBUSTCP_SLOT_COUNT; i++)
+    {
+        r->connections[i].uring_pending = 0;
+        r->connections[i].rx_held_count = 0;
+        r->connections[i].tx_inflight = 0;
+    }
+}
+#endif
+
+/**
+ * @brief Advance the timer wheel to the actual time and close all
+ * connections which were idle for modbus_idle_timeout_s. Only the slots of
+ * the elapsed ticks are visited. A connection which was active meanwhile is
+ * moved to the slot of its new expiry tick.
+ * @param[in] r Reactor
+ */
+static void modbusTcp_expireIdle(modbusTcp_reactor_t *r)
+{
+    time_t now = modbusTcp_now();
+
+    while (r->wheel_time < now)
+    {
+        modbusTcp_connection_t *conn;
+        modbusTcp_connection_t *next;
+
+        r->wheel_time++;
+        for (conn = r->wheel[r->wheel_time & (MODBUSTCP_WHEEL_SLOTS - 1)]; conn != NULL; conn = next)
+        {
+            next = conn->wheel_next;
+            //Connection belongs to a later round of the wheel
+            if (conn->expire > r->wheel_time)
+            {
+                continue;
+            }
+            if ((conn->last_active + conf_modbus_idle_timeout_s) <= r->wheel_time)
+            {
+                dprintf(VERBOSE_STD, "Idle timeout on socket %d\n", conn->fd);
+                modbusStats_add(MODBUSSTATS_TCP_IDLE_CLOSED, 1);
+                modbusTcp_closeConnection(conn);
+            }
+            else
+            {
+                modbusTcp_wheelRemove(conn);
+                modbusTcp_wheelInsert(conn, conn->last_active + conf_modbus_idle_timeout_s);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Reschedule a connection after it was served or its parked replies
+ * were sent. Receiving is paused or continued as the connection needs.
+ * @param[in] conn Connection
+ */
+static void modbusTcp_reschedule(modbusTcp_connection_t *conn)
+{
+#ifdef HAVE_LIBURING
+    if (conn->reactor->uring)
+    {
+        if (modbusTcp_uringProcess(conn) < 0)
+        {
+            modbusTcp_closeConnection(conn);
+        }
+        return;
+    }
+#endif
+    if (modbusTcp_watch(conn, conn->tx_waiting) < 0)
+    {
+        modbusTcp_closeConnection(conn);
+        return;
+    }
+    modbusTcp_schedule(conn);
+    if (modbusTcp_finished(conn))
+    {
+        modbusTcp_closeConnection(conn);
+    }
+}
+
+/**
+ * @brief Send the parked replies of all due connections and serve their
+ * further requests again. The time the replies were sent behind their due
+ * time is counted in the delay histogram.
+ * @param[in] r Reactor
+ */
+static void modbusTcp_delayExpire(modbusTcp_reactor_t *r)
+{
+    uint64_t now = modbusTcp_nowUs();
+    char expired = FALSE;
+
+    while ((r->delay_count > 0) && (r->delay_heap[0]->tx_due <= now))
+    {
+        modbusTcp_connection_t *conn = r->delay_heap[0];
+
+        modbusStats_addDelayLateness((uint32_t)(((now - conn->tx_due) > UINT32_MAX) ? UINT32_MAX : (now - conn->tx_due)));
+        //Removed without arming the timer, that's done once for all
+        conn->delay_index = -1;
+        conn->tx_due = 0;
+        r->delay_count--;
+        if (r->delay_count > 0)
+        {
+            modbusTcp_delaySet(r, r->delay_heap[r->delay_count], 0);
+            modbusTcp_delaySift(r, 0);
+        }
+        expired = TRUE;
+
+        if (modbusTcp_sendReplies(conn) < 0)
+        {
+            modbusTcp_closeConnection(conn);
+            continue;
+        }
+        modbusTcp_reschedule(conn);
+    }
+    if (expired)
+    {
+        modbusTcp_delayArm(r);
+    }
+}
+
+/**
+ * @brief Serve one round of the scheduler. First every connection of the
+ * priority lane is served up to modbus_request_quota requests, as long as
+ * its requests are priority requests. Then the process data lane is served
+ * by deficit round robin: every connection gets modbus_request_quota
+ * requests added to its deficit and is served up to its deficit.
+ * Connections with remaining requests join the lane of their next request
+ * for the next round.
+ * @param[in] r Reactor
+ */
+static void modbusTcp_serveReady(modbusTcp_reactor_t *r)
+{
+    modbusTcp_connection_t *conn;
+    int count;
+    int served;
+
+    count = r->ready_count[MODBUS_LANE_PRIORITY];
+    while ((count-- > 0) && ((conn = r->ready_first[MODBUS_LANE_PRIORITY]) != NULL))
+    {
+        modbusTcp_readyRemove(conn);
+        served = modbusTcp_handleRequests(conn, conf_modbus_request_quota, MODBUS_LANE_PRIORITY);
+        if (served < 0)
+        {
+            modbusTcp_closeConnection(conn);
+            continue;
+        }
+        modbusTcp_reschedule(conn);
+    }
+
+    count = r->ready_count[MODBUS_LANE_PROCESS];
+    while ((count-- > 0) && ((conn = r->ready_first[MODBUS_LANE_PROCESS]) != NULL))
+    {
+        modbusTcp_readyRemove(conn);
+        conn->deficit += conf_modbus_request_quota;
+        served = modbusTcp_handleRequests(conn, conn->deficit, MODBUS_LANE_PROCESS);
+        if (served < 0)
+        {
+            modbusTcp_closeConnection(conn);
+            continue;
+        }
+        conn->deficit -= served;
+        modbusTcp_reschedule(conn);
+    }
+}
+
+/**
+ * @brief Wait for socket events of an epoll reactor and handle them. Only
+ * sockets with pending events are visited.
+ * @param[in] r Reactor to be polled
+ * @param[in] timeout_ms Maximum time to wait for an event
+ * @return Number of handled events
+ * @retval <0 on failure
+ */
+static int modbusTcp_epollPoll(modbusTcp_reactor_t *r, int timeout_ms)
+{
+    struct epoll_event events[MODBUSTCP_MAX_EVENTS];
+    int nfds;
+    int n;
+
+    nfds = epoll_wait(r->epoll_fd, events, MODBUSTCP_MAX_EVENTS, timeout_ms);
+    if (nfds == -1)
+    {
+        if (errno != EINTR)
+        {
+            fprintf(stderr, "Server epoll_wait() failure: %s\n", strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    for (n = 0; n < nfds; n++)
+    {
+        modbusTcp_connection_t *conn = events[n].data.ptr;
+
+        //A client is asking a new connection
+        if (conn == NULL)
+        {
+            modbusTcp_accept(r);
+        }
+        //Parked replies are due, they are sent after the poll
+        else if (events[n].data.ptr == (void *)r)
+        {
+            uint64_t expirations;
+
+            if (read(r->delay_fd, &expirations, sizeof(expirations)) < 0)
+            {
+                dprintf(VERBOSE_DEBUG, "Read of delay timer failed: %s\n", strerror(errno));
+            }
+        }
+        //Another reactor asks for its least recently used connection,
+        //it is closed after the poll
+        else if (events[n].data.ptr == (void *)&r->evict_fd)
+        {
+            uint64_t wakeups;
+
+            if (read(r->evict_fd, &wakeups, sizeof(wakeups)) < 0)
+            {
+                dprintf(VERBOSE_DEBUG, "Read of eviction eventfd failed: %s\n", strerror(errno));
+            }
+        }
+        //Connection is gone
+        else if (events[n].events & (EPOLLERR | EPOLLHUP))
+        {
+            modbusTcp_closeConnection(conn);
+        }
+        else
+        {
+            //Master is able to take more of its replies
+            if (events[n].events & EPOLLOUT)
+            {
+                if (modbusTcp_sendReplies(conn) < 0)
+                {
+                    modbusTcp_closeConnection(conn);
+                    continue;
+                }
+                //Requests held back by a response delay may be served now
+                modbusTcp_schedule(conn);
+                if (modbusTcp_finished(conn))
+                {
+                    modbusTcp_closeConnection(conn);
+                    continue;
+                }
+            }
+            //An already connected master has sent a new query
+            if (events[n].events & (EPOLLIN | EPOLLRDHUP))
+            {
+                modbusTcp_receive(conn);
+            }
+        }
+    }
+
+    return nfds;
+}
+
+/**
+ * @brief Wait for events of one reactor, handle them and serve one round
+ * of requests. While requests are waiting the reactor does not block, so
+ * new requests of other masters join the next round. In the low latency
+ * profile the reactor does not block for modbus_busy_poll_us after an
+ * event either, the next request is taken without a wakeup.
+ * @param[in] r Reactor to be polled
+ * @param[in] timeout_ms Maximum time to wait for an event
+ * @return Number of handled events
+ * @retval <0 on failure
+ */
+static int modbusTcp_pollReactor(modbusTcp_reactor_t *r, int timeout_ms)
+{
+    int rc;
+
+    if (conf_modbus_idle_timeout_s > 0)
+    {
+        modbusTcp_expireIdle(r);
+    }
+
+    if ((r->ready_total > 0) ||
+        ((conf_modbus_latency_profile == CONF_LATENCY_PROFILE_LOW) && (modbusTcp_nowUs() < r->spin_until)))
+    {
+        timeout_ms = 0;
+    }
+
+#ifdef HAVE_LIBURING
+    if (r->uring)
+    {
+        rc = modbusTcp_uringPoll(r, timeout_ms);
+    }
+    else
+#endif
+    {
+        rc = modbusTcp_epollPoll(r, timeout_ms);
+    }
+
+    if (r->delay_count > 0)
+    {
+        modbusTcp_delayExpire(r);
+    }
+    if (__atomic_load_n(&r->evict_requests, __ATOMIC_ACQUIRE) > 0)
+    {
+        modbusTcp_evictRequested(r);
+    }
+    if (rc >= 0)
+    {
+        modbusTcp_serveReady(r);
+    }
+    if ((rc > 0) && (conf_modbus_latency_profile == CONF_LATENCY_PROFILE_LOW))
+    {
+        r->spin_until = modbusTcp_nowUs() + conf_modbus_busy_poll_us;
+    }
+    return rc;
+}
+
+/**
+ * @brief Worker thread task for all reactors except the first one
+ * @param[in] arg Reactor to be served
+ */
+static void *modbusTcp_task(void *arg)
+{
+    modbusTcp_reactor_t *r = arg;
+
+    if ((conf_modbus_latency_profile == CONF_LATENCY_PROFILE_LOW) && (conf_modbus_cpu >= 0))
+    {
+        utils_setCpuAffinity(conf_modbus_cpu + r->id);
+    }
+
+    while (modbusTcp_running)
+    {
+        if (modbusTcp_pollReactor(r, MODBUSTCP_WORKER_TIMEOUT_MS) < 0)
+        {
+            continue;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Create a listening socket on conf_modbus_port. SO_REUSEPORT allows
+ * each reactor to bind its own socket, the kernel balances new connections.
+ * @param[in] reuseport Set SO_REUSEPORT on the socket
+ * @return Socket
+ * @retval <0 on failure
+ */
+static int modbusTcp_listen(int reuseport)
+{
+    struct sockaddr_in addr;
+    int enable = 1;
+    int s;
+
+    s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (s == -1)
+    {
+        return -1;
+    }
+
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1)
+    {
+        close(s);
+        return -2;
+    }
+
+    if (reuseport)
+    {
+#ifdef SO_REUSEPORT
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1)
+#endif
+        {
+            close(s);
+            return -3;
+        }
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(conf_modbus_port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(s);
+        return -4;
+    }
+
+    if (listen(s, conf_max_tcp_connections) == -1)
+    {
+        close(s);
+        return -5;
+    }
+
+    return s;
+}
+
+/**
+ * @brief Setting up listening socket, epoll instance and connection table of
+ * one reactor.
+ * @param[in] r Reactor to be initialized
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+static int modbusTcp_initReactor(modbusTcp_reactor_t *r)
+{
+    struct epoll_event ev;
+    int i;
+
+    r->server_socket = -1;
+    r->epoll_fd = -1;
+    r->delay_fd = -1;
+    r->evict_fd = -1;
+    r->lru_oldest = UINT64_MAX;
+    pthread_mutex_init(&r->stats_mutex, NULL);
+    r->wheel_time = modbusTcp_now();
+
+    r->connections = calloc(MODBUSTCP_SLOT_COUNT, sizeof(modbusTcp_connection_t));
+    if (r->connections == NULL)
+    {
+        fprintf(stderr, "Unable to allocate connection table\n");
+        return -1;
+    }
+    for (i = 0; i < MODBUSTCP_SLOT_COUNT; i++)
+    {
+        r->connections[i].fd = -1;
+        r->connections[i].reactor = r;
+        r->connections[i].delay_index = -1;
+    }
+    r->delay_heap = calloc(MODBUSTCP_SLOT_COUNT, sizeof(modbusTcp_connection_t *));
+    if (r->delay_heap == NULL)
+    {
+        fprintf(stderr, "Unable to allocate delay heap\n");
+        return -1;
+    }
+    r->delay_count = 0;
+
+    r->server_socket = modbusTcp_listen(reactor_count > 1);
+    if (r->server_socket < 0)
+    {
+        fprintf(stderr, "Unable to listen on port %d: %s\n", conf_modbus_port, strerror(errno));
+        return -2;
+    }
+
+    r->evict_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->evict_fd == -1)
+    {
+        fprintf(stderr, "Unable to create eviction eventfd: %s\n", strerror(errno));
+        return -2;
+    }
+
+#ifdef HAVE_LIBURING
+    if (conf_modbus_io_engine == CONF_IO_ENGINE_URING)
+    {
+        if (modbusTcp_uringInit(r) == 0)
+        {
+            return 0;
+        }
+        dprintf(VERBOSE_STD, "ModbusTcp: reactor %d falls back to epoll\n", r->id);
+    }
+#else
+    if (conf_modbus_io_engine == CONF_IO_ENGINE_URING)
+    {
+        dprintf(VERBOSE_STD, "ModbusTcp: built without io_uring support, using epoll\n");
+    }
+#endif
+
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd == -1)
+    {
+        fprintf(stderr, "Unable to create epoll instance: %s\n", strerror(errno));
+        return -3;
+    }
+
+    //Listening socket is marked by a NULL pointer
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->server_socket, &ev) == -1)
+    {
+        fprintf(stderr, "Unable to add server socket to epoll: %s\n", strerror(errno));
+        return -4;
+    }
+
+    //Eviction requests of other reactors are marked by the eventfd pointer
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &r->evict_fd;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->evict_fd, &ev) == -1)
+    {
+        fprintf(stderr, "Unable to add eviction eventfd to epoll: %s\n", strerror(errno));
+        return -4;
+    }
+
+    //Delay timer is marked by the reactor pointer
+    if (conf_modbus_delay_ms > 0)
+    {
+        r->delay_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (r->delay_fd == -1)
+        {
+            fprintf(stderr, "Unable to create delay timer: %s\n", strerror(errno));
+            return -5;
+        }
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = r;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->delay_fd, &ev) == -1)
+        {
+            fprintf(stderr, "Unable to add delay timer to epoll: %s\n", strerror(errno));
+            return -6;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Close all connections and sockets of one reactor
+ * @param[in] r Reactor to be closed
+ */
+static void modbusTcp_deInitReactor(modbusTcp_reactor_t *r)
+{
+    int i;
+
+#ifdef HAVE_LIBURING
+    if (r->uring)
+    {
+        modbusTcp_uringDeInit(r);
+    }
+#endif
+
+    if (r->connections != NULL)
+    {
+        for (i = 0; i < MODBUSTCP_SLOT_COUNT; i++)
+        {
+            if (r->connections[i].fd != -1)
+            {
+                modbusTcp_closeConnection(&r->connections[i]);
+            }
+        }
+        free(r->connections);
+        r->connections = NULL;
+    }
+    free(r->delay_heap);
+    r->delay_heap = NULL;
+
+    if (r->delay_fd != -1)
+    {
+        close(r->delay_fd);
+        r->delay_fd = -1;
+    }
+
+    if (r->evict_fd != -1)
+    {
+        close(r->evict_fd);
+        r->evict_fd = -1;
+    }
+
+    if (r->epoll_fd != -1)
+    {
+        close(r->epoll_fd);
+        r->epoll_fd = -1;
+    }
+
+    if (r->server_socket != -1)
+    {
+        close(r->server_socket);
+        r->server_socket = -1;
+    }
+    pthread_mutex_destroy(&r->stats_mutex);
+}
+
+/**
+ * @brief Append the requests and queue wait times of all connections to
+ * the statistics file. The queue wait time of a request is the time from
+ * the connection becoming ready until the request is handled.
+ * @param[in] fp Statistics file
+ */
+static void modbusTcp_writeStats(FILE *fp)
+{
+    int i;
+    int n;
+
+    fprintf(fp, "%-21s %7s %20s %12s %12s\n", "connection", "reactor", "requests", "wait_avg_us", "wait_max_us");
+    for (i = 0; i < reactor_count; i++)
+    {
+        for (n = 0; n < MODBUSTCP_SLOT_COUNT; n++)
+        {
+            modbusTcp_connection_t *conn = &reactors[i].connections[n];
+            struct sockaddr_in peer;
+            uint64_t requests;
+            uint64_t wait_sum;
+            uint64_t wait_max;
+            char ip[INET_ADDRSTRLEN];
+            char addr[INET_ADDRSTRLEN + 6];
+            int fd;
+
+            //Copy the slot consistently, the reactor may accept or close meanwhile
+            pthread_mutex_lock(&reactors[i].stats_mutex);
+            fd = conn->fd;
+            peer = conn->addr;
+            requests = __sync_fetch_and_add(&conn->stat_requests, 0);
+            wait_sum = __sync_fetch_and_add(&conn->stat_wait_sum, 0);
+            wait_max = __sync_fetch_and_add(&conn->stat_wait_max, 0);
+            pthread_mutex_unlock(&reactors[i].stats_mutex);
+            if (fd == -1)
+            {
+                continue;
+            }
+            inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip));
+            snprintf(addr, sizeof(addr), "%s:%d", ip, ntohs(peer.sin_port));
+            fprintf(fp, "%-21s %7d %20llu %12llu %12llu\n", addr, i, (unsigned long long)requests,
+                    (unsigned long long)((requests > 0) ? (wait_sum / requests) : 0),
+                    (unsigned long long)wait_max);
+        }
+    }
+}
+
+/**
+ * @brief Setting up all reactors and starting the worker threads. The number
+ * of reactors is given by modbus_worker_threads.
+ * @param[in] worker Handler function for every received modbus query. It has
+ * to be thread safe if more than one reactor is used.
+ * @param[in] classify Function giving the lane of a request
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+int modbusTcp_init(void (*worker)(modbus_t *ctx, uint8_t *query, int rc),
+                   int (*classify)(const uint8_t *pdu, int length))
+{
+    modbus_t *ctx;
+    int i;
+
+    if ((worker == NULL) || (classify == NULL))
+    {
+        return -1;
+    }
+    modbusTcp_worker = worker;
+    modbusTcp_classify = classify;
+
+    //Take over the libmodbus TCP backend, replies are queued by the reactor
+    ctx = modbus_new_tcp("127.0.0.1", conf_modbus_port);
+    if (ctx == NULL)
+    {
+        fprintf(stderr, "Unable to allocate libmodbus context\n");
+        return -1;
+    }
+    modbusTcp_backend = *ctx->backend;
+    modbusTcp_backendSend = ctx->backend->send;
+    modbusTcp_backend.send = modbusTcp_queueReply;
+    modbusTcp_backend.flush = modbusTcp_flush;
+    modbus_replyRegisterSendv(modbusTcp_sendReplyv);
+    modbus_free(ctx);
+    connection_count = 0;
+    modbusTcp_running = TRUE;
+
+    reactor_count = conf_modbus_worker_threads;
+    reactors = calloc(reactor_count, sizeof(modbusTcp_reactor_t));
+    if (reactors == NULL)
+    {
+        fprintf(stderr, "Unable to allocate reactor table\n");
+        return -2;
+    }
+
+    for (i = 0; i < reactor_count; i++)
+    {
+        reactors[i].id = i;
+        if (modbusTcp_initReactor(&reactors[i]) < 0)
+        {
+            return -3;
+        }
+    }
+
+    for (i = 1; i < reactor_count; i++)
+    {
+        if (pthread_create(&reactors[i].thread, NULL, &modbusTcp_task, &reactors[i]) != 0)
+        {
+            return -4;
+        }
+        reactors[i].thread_started = TRUE;
+    }
+
+    modbusStats_registerWriter(modbusTcp_writeStats);
+    dprintf(VERBOSE_STD, "ModbusTcp: %d reactor(s) listening on port %d\n", reactor_count, conf_modbus_port);
+    return 0;
+}
+
+/**
+ * @brief Stop worker threads and close all connections and sockets
+ */
+void modbusTcp_deInit(void)
+{
+    int i;
+
+    if (reactors == NULL)
+    {
+        return;
+    }
+
+    modbusStats_unregisterWriter(modbusTcp_writeStats);
+    modbusTcp_running = FALSE;
+    for (i = 1; i < reactor_count; i++)
+    {
+        if (reactors[i].thread_started)
+        {
+            pthread_join(reactors[i].thread, NULL);
+        }
+    }
+
+    for (i = 0; i < reactor_count; i++)
+    {
+        modbusTcp_deInitReactor(&reactors[i]);
+    }
+    free(reactors);
+    reactors = NULL;
+}
+
+/**
+ * @brief Wait for socket events of the first reactor and handle them.
+ * Has to be called cyclic by the modbus thread.
+ * @param[in] timeout_ms Maximum time to wait for an event
+ * @return Number of handled events
+ * @retval <0 on failure
+ */
+int modbusTcp_poll(int timeout_ms)
+{
+    return modbusTcp_pollReactor(&reactors[0], timeout_ms);
+}
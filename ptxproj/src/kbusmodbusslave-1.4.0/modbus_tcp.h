@@ -0,0 +1,11 @@
+#ifndef __MODBUS_TCP_H__
+#define __MODBUS_TCP_H__
+
+#include <modbus/modbus.h>
+
+int modbusTcp_init(void (*worker)(modbus_t *ctx, uint8_t *query, int rc),
+                   int (*classify)(const uint8_t *pdu, int length));
+void modbusTcp_deInit(void);
+int modbusTcp_poll(int timeout_ms);
+
+#endif /* __MODBUS_TCP_H__ */
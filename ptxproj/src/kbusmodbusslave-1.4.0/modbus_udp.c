@@ -0,0 +1,618 @@
+//------------------------------------------------------------------------------
+/// Copyright (c) WAGO Kontakttechnik GmbH & Co. KG
+///
+/// PROPRIETARY RIGHTS are involved in the subject matter of this material.
+/// All manufacturing, reproduction, use and sales rights pertaining to this
+/// subject matter are governed by the license agreement. The recipient of this
+/// software implicitly accepts the terms of the license.
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+///
+///  \file     modbus_udp.c
+///
+///  \brief    Modbus UDP server. One socket is bound to each address of
+///            modbus_udp_address. Bursts of requests are received with one
+///            recvmmsg() and all replies are sent with one sendmmsg().
+///            Watchdog and configuration requests of a batch are handled
+///            before its process data requests.
+///            With modbus_delay_ms the replies of a batch are parked with
+///            their own buffers in a queue ordered by due time, a timerfd
+///            wakes the UDP thread when the first batch is due. The sockets
+///            are polled meanwhile, only if all batch buffers are parked
+///            further requests wait in the socket buffers.
+///
+///  \author   <BrT> : WAGO Kontakttechnik GmbH & Co. KG
+//------------------------------------------------------------------------------
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <modbus/modbus.h>
+#include "modbus-private.h"
+#include "modbus_udp.h"
+#include "modbus.h"
+#include "modbus_reply.h"
+#include "modbus_stats.h"
+#include "utils.h"
+#include "conffile_reader.h"
+
+#define MODBUSUDP_MAX_SOCKETS 8     /**< @brief Maximum number of bind addresses */
+#define MODBUSUDP_MAX_BATCH 64      /**< @brief Maximum datagrams per recvmmsg() */
+#define MODBUSUDP_MBAP_LENGTH 7     /**< @brief Length of the MBAP header incl. unit identifier */
+#define MODBUSUDP_MAX_PARKED 8      /**< @brief Batches whose replies may be parked with modbus_delay_ms */
+
+/**
+ * @brief Receive and reply buffers of one datagram of a batch
+ */
+typedef struct
+{
+    uint8_t query[MAX_REQUEST_MESSAGE_LENGTH];      /**< @brief Received request */
+    uint8_t reply[MAX_RESPONSE_MESSAGE_LENGTH];     /**< @brief Reply to the request */
+    struct sockaddr_in addr;                        /**< @brief Address of the master */
+    int lane;                                       /**< @brief Lane of the request, <0 if invalid */
+    struct iovec rx_iov;                            /**< @brief Receive vector pointing to query */
+    struct iovec tx_iov;                            /**< @brief Send vector pointing to reply */
+} modbusUdp_slot_t;
+
+/**
+ * @brief Buffers of one batch, parked with its replies until they are due
+ */
+typedef struct
+{
+    modbusUdp_slot_t *slots;        /**< @brief One slot per datagram of the batch */
+    struct mmsghdr *rx_msgs;        /**< @brief recvmmsg() headers */
+    struct mmsghdr *tx_msgs;        /**< @brief sendmmsg() headers */
+    int socket;                     /**< @brief Socket the batch was received on */
+    int replies;                    /**< @brief Number of replies in tx_msgs */
+    uint64_t due;                   /**< @brief Time in us when the replies are sent */
+} modbusUdp_batch_t;
+
+static int modbusUdp_sockets[MODBUSUDP_MAX_SOCKETS];    /**< @brief Bound sockets */
+static int modbusUdp_socketCount;                       /**< @brief Number of bound sockets */
+static modbus_t *modbusUdp_ctx;                         /**< @brief libmodbus UDP context used for all replies */
+static modbus_backend_t modbusUdp_backend;              /**< @brief UDP backend of libmodbus with send and flush replaced */
+static void (*modbusUdp_worker)(modbus_t *ctx, uint8_t *query, int rc) = NULL; /**< @brief Request handler */
+static int (*modbusUdp_classify)(const uint8_t *pdu, int length) = NULL;         /**< @brief Lane of a request */
+static modbusUdp_batch_t modbusUdp_batches[MODBUSUDP_MAX_PARKED]; /**< @brief Batch buffers, a ring of parked batches and free ones */
+static int modbusUdp_batchCount;                        /**< @brief Allocated batch buffers, one without modbus_delay_ms */
+static int modbusUdp_parkedFirst;                       /**< @brief Parked batch due first */
+static int modbusUdp_parkedCount;                       /**< @brief Number of parked batches */
+static int modbusUdp_delayFd = -1;                      /**< @brief timerfd armed for the first parked batch */
+static modbusUdp_slot_t *modbusUdp_currentSlot;         /**< @brief Slot of the request actually handled */
+
+/**
+ * @brief Replacement for the send function of the libmodbus backend.
+ * The reply is stored in the slot of the request actually handled and sent
+ * together with the other replies of the batch.
+ * @param[in] ctx Modbus context
+ * @param[in] msg Reply
+ * @param[in] msg_length Length of the reply
+ * @return Number of bytes stored
+ * @retval -1 on failure
+ */
+static ssize_t modbusUdp_queueReply(modbus_t *ctx, const uint8_t *msg, int msg_length)
+{
+    modbusUdp_slot_t *slot = modbusUdp_currentSlot;
+
+    UNUSED(ctx);
+    if ((slot == NULL) || (slot->tx_iov.iov_len > 0) || ((size_t)msg_length > sizeof(slot->reply)))
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    memcpy(slot->reply, msg, msg_length);
+    slot->tx_iov.iov_len = msg_length;
+    return msg_length;
+}
+
+/**
+ * @brief Replacement for the flush function of the libmodbus backend.
+ * Further datagrams in the socket are requests and must not be discarded.
+ * @param[in] ctx Modbus context
+ * @return Always 0
+ */
+static int modbusUdp_flush(modbus_t *ctx)
+{
+    UNUSED(ctx);
+    return 0;
+}
+
+/**
+ * @brief Check the MBAP header of a received datagram
+ * @param[in] query Received datagram
+ * @param[in] length Length of the datagram
+ * @retval 0 if the header is valid
+ * @retval <0 on failure
+ */
+static int modbusUdp_checkHeader(const uint8_t *query, size_t length)
+{
+    if (length < (MODBUSUDP_MBAP_LENGTH + 1))
+    {
+        return -1;
+    }
+    //Protocol identifier
+    if ((query[2] != 0) || (query[3] != 0))
+    {
+        return -2;
+    }
+    //Length field counts unit identifier and PDU
+    if ((size_t)((query[4] << 8) + query[5]) != (length - MODBUSUDP_MBAP_LENGTH + 1))
+    {
+        return -3;
+    }
+    return 0;
+}
+
+/**
+ * @brief Handle the requests of a batch belonging to one lane and add their
+ * replies to the send headers
+ * @param[in] batch Batch
+ * @param[in] received Number of datagrams in the batch
+ * @param[in] lane Lane to be handled
+ * @param[in] arrival Time in us when the batch was received
+ */
+static void modbusUdp_handleLane(modbusUdp_batch_t *batch, int received, int lane, uint64_t arrival)
+{
+    int i;
+
+    for (i = 0; i < received; i++)
+    {
+        modbusUdp_slot_t *slot = &batch->slots[i];
+        struct timespec ts;
+        uint64_t wait;
+
+        if (slot->lane != lane)
+        {
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        wait = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - arrival;
+        modbusStats_addLaneWait(lane, (wait > UINT32_MAX) ? UINT32_MAX : (uint32_t)wait);
+
+        slot->tx_iov.iov_len = 0;
+        modbusUdp_currentSlot = slot;
+        modbusUdp_worker(modbusUdp_ctx, slot->query, batch->rx_msgs[i].msg_len);
+        modbusUdp_currentSlot = NULL;
+
+        if (slot->tx_iov.iov_len > 0)
+        {
+            struct msghdr *hdr = &batch->tx_msgs[batch->replies].msg_hdr;
+
+            hdr->msg_name = &slot->addr;
+            hdr->msg_namelen = batch->rx_msgs[i].msg_hdr.msg_namelen;
+            hdr->msg_iov = &slot->tx_iov;
+            hdr->msg_iovlen = 1;
+            modbusStats_add(MODBUSSTATS_UDP_TX_BYTES, slot->tx_iov.iov_len);
+            batch->replies++;
+        }
+    }
+}
+
+/**
+ * @brief Monotonic time in microseconds
+ * @return Actual time
+ */
+static uint64_t modbusUdp_nowUs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Send the replies of a batch with one sendmmsg()
+ * @param[in] batch Batch with replies
+ */
+static void modbusUdp_send(modbusUdp_batch_t *batch)
+{
+    int sent = 0;
+
+    //sendmmsg() may send only a part of the batch
+    while (sent < batch->replies)
+    {
+        int rc = sendmmsg(batch->socket, &batch->tx_msgs[sent], batch->replies - sent, MSG_DONTWAIT);
+
+        modbusStats_add(MODBUSSTATS_UDP_TX_CALLS, 1);
+        modbusStats_addSyscalls(1);
+        if (rc > 0)
+        {
+            sent += rc;
+            modbusStats_add(MODBUSSTATS_UDP_TX_DATAGRAMS, rc);
+        }
+        else if ((rc < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            //Socket buffer is full, UDP masters have to repeat the request
+            dprintf(VERBOSE_STD, "UDP send failed: %s\n", strerror(errno));
+            modbusStats_add(MODBUSSTATS_UDP_TX_DROPPED, batch->replies - sent);
+            break;
+        }
+    }
+    batch->replies = 0;
+}
+
+/**
+ * @brief Arm the delay timer for the first parked batch or disarm it
+ */
+static void modbusUdp_delayArm(void)
+{
+    struct itimerspec its;
+    uint64_t due;
+
+    memset(&its, 0, sizeof(its));
+    if (modbusUdp_parkedCount > 0)
+    {
+        due = modbusUdp_batches[modbusUdp_parkedFirst].due;
+        its.it_value.tv_sec = due / 1000000;
+        its.it_value.tv_nsec = (due % 1000000) * 1000;
+    }
+    modbusStats_addSyscalls(1);
+    if (timerfd_settime(modbusUdp_delayFd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+    {
+        fprintf(stderr, "Unable to arm UDP delay timer: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * @brief Send the replies of all due batches and release their buffers.
+ * Batches are parked in the order they are due, the delay is the same for
+ * all of them. The time they are sent behind their due time is counted in
+ * the delay histogram.
+ */
+static void modbusUdp_delayExpire(void)
+{
+    uint64_t now = modbusUdp_nowUs();
+    char expired = FALSE;
+
+    while ((modbusUdp_parkedCount > 0) && (modbusUdp_batches[modbusUdp_parkedFirst].due <= now))
+    {
+        modbusUdp_batch_t *batch = &modbusUdp_batches[modbusUdp_parkedFirst];
+
+        modbusStats_addDelayLateness((uint32_t)(((now - batch->due) > UINT32_MAX) ? UINT32_MAX : (now - batch->due)));
+        modbusUdp_send(batch);
+        modbusUdp_parkedFirst = (modbusUdp_parkedFirst + 1) % modbusUdp_batchCount;
+        modbusUdp_parkedCount--;
+        expired = TRUE;
+    }
+    if (expired)
+    {
+        modbusUdp_delayArm();
+    }
+}
+
+/**
+ * @brief Receive all pending requests of one socket in batches, handle them
+ * lane by lane and send the replies of each batch with one sendmmsg(). With
+ * modbus_delay_ms the replies are parked instead, receiving stops when all
+ * batch buffers are parked.
+ * @param[in] s Socket with pending datagrams
+ */
+static void modbusUdp_receive(int s)
+{
+    modbusUdp_batch_t *batch;
+    uint64_t arrival;
+    int received;
+    int lane;
+    int i;
+
+    do
+    {
+        if (modbusUdp_parkedCount == modbusUdp_batchCount)
+        {
+            return;
+        }
+        batch = &modbusUdp_batches[(modbusUdp_parkedFirst + modbusUdp_parkedCount) % modbusUdp_batchCount];
+
+        for (i = 0; i < conf_modbus_udp_batch; i++)
+        {
+            batch->rx_msgs[i].msg_hdr.msg_namelen = sizeof(batch->slots[i].addr);
+            batch->rx_msgs[i].msg_len = 0;
+        }
+
+        received = recvmmsg(s, batch->rx_msgs, conf_modbus_udp_batch, MSG_DONTWAIT, NULL);
+        if (received <= 0)
+        {
+            if ((received < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            {
+                dprintf(VERBOSE_STD, "UDP receive failed: %s\n", strerror(errno));
+            }
+            return;
+        }
+        modbusStats_add(MODBUSSTATS_UDP_RX_CALLS, 1);
+        modbusStats_add(MODBUSSTATS_UDP_RX_DATAGRAMS, received);
+        arrival = modbusUdp_nowUs();
+
+        //Classify all requests of the batch on arrival
+        for (i = 0; i < received; i++)
+        {
+            modbusUdp_slot_t *slot = &batch->slots[i];
+            size_t length = batch->rx_msgs[i].msg_len;
+
+            modbusStats_add(MODBUSSTATS_UDP_RX_BYTES, length);
+            if (modbusUdp_checkHeader(slot->query, length) < 0)
+            {
+                modbusStats_add(MODBUSSTATS_UDP_RX_INVALID, 1);
+                slot->lane = -1;
+                continue;
+            }
+            slot->lane = modbusUdp_classify(&slot->query[MODBUSUDP_MBAP_LENGTH], length - MODBUSUDP_MBAP_LENGTH);
+        }
+
+        batch->socket = s;
+        batch->replies = 0;
+        for (lane = 0; lane < MODBUS_LANE_COUNT; lane++)
+        {
+            modbusUdp_handleLane(batch, received, lane, arrival);
+        }
+
+        if ((conf_modbus_delay_ms > 0) && (batch->replies > 0))
+        {
+            batch->due = modbusUdp_nowUs() + (uint64_t)conf_modbus_delay_ms * 1000;
+            modbusUdp_parkedCount++;
+            if (modbusUdp_parkedCount == 1)
+            {
+                modbusUdp_delayArm();
+            }
+        }
+        else
+        {
+            modbusUdp_send(batch);
+        }
+    } while (received == conf_modbus_udp_batch);
+}
+
+/**
+ * @brief Create and bind a UDP socket on conf_modbus_port
+ * @param[in] address Local IPv4 address
+ * @return Socket
+ * @retval <0 on failure
+ */
+static int modbusUdp_bind(const char *address)
+{
+    struct sockaddr_in addr;
+    int enable = 1;
+    int s;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(conf_modbus_port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "Invalid Modbus UDP address %s\n", address);
+        return -1;
+    }
+
+    s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (s == -1)
+    {
+        return -2;
+    }
+
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1)
+    {
+        close(s);
+        return -3;
+    }
+
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        fprintf(stderr, "Unable to bind Modbus UDP to %s:%d: %s\n", address, conf_modbus_port, strerror(errno));
+        close(s);
+        return -4;
+    }
+
+    return s;
+}
+
+/**
+ * @brief Bind the sockets and allocate the batch buffers
+ * @param[in] worker Handler function for every received modbus query
+ * @param[in] classify Function giving the lane of a request
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+int modbusUdp_init(void (*worker)(modbus_t *ctx, uint8_t *query, int rc),
+                   int (*classify)(const uint8_t *pdu, int length))
+{
+    char addresses[CONF_MAX_STRING_LENGTH];
+    char *saveptr = NULL;
+    char *address;
+    int b;
+    int i;
+
+    if ((worker == NULL) || (classify == NULL))
+    {
+        return -1;
+    }
+    modbusUdp_worker = worker;
+    modbusUdp_classify = classify;
+
+    //Take over the libmodbus UDP backend, replies are collected per batch
+    modbusUdp_ctx = modbus_new_udp("127.0.0.1", conf_modbus_port);
+    if (modbusUdp_ctx == NULL)
+    {
+        fprintf(stderr, "Unable to allocate libmodbus UDP context\n");
+        return -1;
+    }
+    modbusUdp_backend = *modbusUdp_ctx->backend;
+    modbusUdp_backend.send = modbusUdp_queueReply;
+    modbusUdp_backend.flush = modbusUdp_flush;
+    modbusUdp_ctx->backend = &modbusUdp_backend;
+
+    //Parked batches keep their buffers, the next batch is received into another one
+    modbusUdp_batchCount = (conf_modbus_delay_ms > 0) ? MODBUSUDP_MAX_PARKED : 1;
+    modbusUdp_parkedFirst = 0;
+    modbusUdp_parkedCount = 0;
+    for (b = 0; b < modbusUdp_batchCount; b++)
+    {
+        modbusUdp_batch_t *batch = &modbusUdp_batches[b];
+
+        batch->slots = calloc(conf_modbus_udp_batch, sizeof(modbusUdp_slot_t));
+        batch->rx_msgs = calloc(conf_modbus_udp_batch, sizeof(struct mmsghdr));
+        batch->tx_msgs = calloc(conf_modbus_udp_batch, sizeof(struct mmsghdr));
+        if ((batch->slots == NULL) || (batch->rx_msgs == NULL) || (batch->tx_msgs == NULL))
+        {
+            fprintf(stderr, "Unable to allocate UDP batch buffers\n");
+            return -2;
+        }
+        for (i = 0; i < conf_modbus_udp_batch; i++)
+        {
+            batch->slots[i].rx_iov.iov_base = batch->slots[i].query;
+            batch->slots[i].rx_iov.iov_len = sizeof(batch->slots[i].query);
+            batch->slots[i].tx_iov.iov_base = batch->slots[i].reply;
+            batch->rx_msgs[i].msg_hdr.msg_name = &batch->slots[i].addr;
+            batch->rx_msgs[i].msg_hdr.msg_iov = &batch->slots[i].rx_iov;
+            batch->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    if (conf_modbus_delay_ms > 0)
+    {
+        modbusUdp_delayFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (modbusUdp_delayFd == -1)
+        {
+            fprintf(stderr, "Unable to create UDP delay timer: %s\n", strerror(errno));
+            return -2;
+        }
+    }
+
+    modbusUdp_socketCount = 0;
+    strcpy(addresses, conf_modbus_udp_address);
+    for (address = strtok_r(addresses, ", ", &saveptr); address != NULL; address = strtok_r(NULL, ", ", &saveptr))
+    {
+        int s;
+
+        if (modbusUdp_socketCount >= MODBUSUDP_MAX_SOCKETS)
+        {
+            fprintf(stderr, "Too many Modbus UDP addresses, maximum is %d\n", MODBUSUDP_MAX_SOCKETS);
+            return -3;
+        }
+        s = modbusUdp_bind(address);
+        if (s < 0)
+        {
+            return -4;
+        }
+        modbusUdp_sockets[modbusUdp_socketCount++] = s;
+        dprintf(VERBOSE_STD, "ModbusUdp: listening on %s:%d\n", address, conf_modbus_port);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Close all sockets and free the batch buffers
+ */
+void modbusUdp_deInit(void)
+{
+    int i;
+
+    for (i = 0; i < modbusUdp_socketCount; i++)
+    {
+        close(modbusUdp_sockets[i]);
+    }
+    modbusUdp_socketCount = 0;
+
+    //Parked replies are dropped, UDP masters have to repeat the request
+    for (i = 0; i < MODBUSUDP_MAX_PARKED; i++)
+    {
+        free(modbusUdp_batches[i].slots);
+        modbusUdp_batches[i].slots = NULL;
+        free(modbusUdp_batches[i].rx_msgs);
+        modbusUdp_batches[i].rx_msgs = NULL;
+        free(modbusUdp_batches[i].tx_msgs);
+        modbusUdp_batches[i].tx_msgs = NULL;
+    }
+    modbusUdp_batchCount = 0;
+    modbusUdp_parkedCount = 0;
+
+    if (modbusUdp_delayFd != -1)
+    {
+        close(modbusUdp_delayFd);
+        modbusUdp_delayFd = -1;
+    }
+
+    if (modbusUdp_ctx != NULL)
+    {
+        modbus_free(modbusUdp_ctx);
+        modbusUdp_ctx = NULL;
+    }
+}
+
+/**
+ * @brief Wait for requests on all UDP sockets and handle them. Parked
+ * replies are sent when the delay timer expires. While all batch buffers
+ * are parked the sockets are not polled.
+ * Has to be called cyclic by the UDP thread.
+ * @param[in] timeout_ms Maximum time to wait for a request
+ * @return Number of sockets with pending requests and the expired timer
+ * @retval <0 on failure
+ */
+int modbusUdp_poll(int timeout_ms)
+{
+    struct pollfd fds[MODBUSUDP_MAX_SOCKETS + 1];
+    int nfds = modbusUdp_socketCount;
+    int rc;
+    int i;
+
+    for (i = 0; i < modbusUdp_socketCount; i++)
+    {
+        fds[i].fd = modbusUdp_sockets[i];
+        fds[i].events = (modbusUdp_parkedCount < modbusUdp_batchCount) ? POLLIN : 0;
+        fds[i].revents = 0;
+    }
+    //Delay timer is the last entry
+    if (modbusUdp_delayFd != -1)
+    {
+        fds[nfds].fd = modbusUdp_delayFd;
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+    }
+
+    rc = poll(fds, nfds, timeout_ms);
+    if (rc < 0)
+    {
+        if (errno != EINTR)
+        {
+            fprintf(stderr, "UDP poll() failure: %s\n", strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    if ((modbusUdp_delayFd != -1) && (fds[modbusUdp_socketCount].revents & POLLIN))
+    {
+        uint64_t expirations;
+
+        if (read(modbusUdp_delayFd, &expirations, sizeof(expirations)) < 0)
+        {
+            dprintf(VERBOSE_DEBUG, "Read of UDP delay timer failed: %s\n", strerror(errno));
+        }
+    }
+    if (modbusUdp_parkedCount > 0)
+    {
+        modbusUdp_delayExpire();
+    }
+
+    for (i = 0; i < modbusUdp_socketCount; i++)
+    {
+        if (fds[i].revents & POLLIN)
+        {
+            modbusUdp_receive(fds[i].fd);
+        }
+    }
+    return rc;
+}
@@ -0,0 +1,11 @@
+#ifndef __MODBUS_UDP_H__
+#define __MODBUS_UDP_H__
+
+#include <modbus/modbus.h>
+
+int modbusUdp_init(void (*worker)(modbus_t *ctx, uint8_t *query, int rc),
+                   int (*classify)(const uint8_t *pdu, int length));
+void modbusUdp_deInit(void);
+int modbusUdp_poll(int timeout_ms);
+
+#endif /* __MODBUS_UDP_H__ */
@@ -208,7 +208,7 @@ void modbusWatchdog_setStatus(void)
  *
  * We have to manipulate the given register address and substract the MODBUSWATCHDOG_REGISTER_START_ADDRESS from it.
  */
-int modbusWatchdog_parseModbusCommand(modbus_t *ctx, uint8_t *command, int command_len)
+void modbusWatchdog_parseModbusCommand(modbus_t *ctx, uint8_t *command, int command_len)
 {
     int offset = modbus_get_header_length(ctx);
     int function = command[offset];
@@ -289,6 +289,4 @@ int modbusWatchdog_parseModbusCommand(modbus_t *ctx, uint8_t *command, int comma
         default:
             modbus_reply_exception(ctx, command, MODBUS_EXCEPTION_ILLEGAL_FUNCTION );
     }
-
-    return 0;
 }
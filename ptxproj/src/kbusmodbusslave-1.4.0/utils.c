@@ -20,7 +20,15 @@
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
 #include "utils.h"
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /*
  * Convert string s to int out.
@@ -77,3 +85,79 @@ void utils_hexdump(uint8_t *memptr, size_t len)
     printf("\n");
 }
 
+/**
+ * @brief Pin the calling thread to one CPU
+ *
+ * @param[in] cpu Number of the CPU
+ * @retval 0 on success
+ * @retval <0 on failure
+ */
+int utils_setCpuAffinity(int cpu)
+{
+    cpu_set_t cpuset;
+    int rc;
+
+    if ((cpu < 0) || (cpu >= CPU_SETSIZE))
+    {
+        return -1;
+    }
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    rc = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (rc != 0)
+    {
+        dprintf(VERBOSE_STD, "Pinning thread to CPU %d failed: %s\n", cpu, strerror(rc));
+        return -2;
+    }
+    dprintf(VERBOSE_DEBUG, "Thread pinned to CPU %d\n", cpu);
+    return 0;
+}
+
+
+/**
+ * @brief Copy 16 bit words between the host byte order and the big-endian
+ * byte order of the Modbus PDU. The conversion is its own inverse, so it
+ * serializes registers into a reply as well as it parses the values of a
+ * write request. Neither pointer has to be aligned, dest and src may be equal
+ * but must not overlap otherwise.
+ * Uses NEON on ARM and SSE2 on x86 for 8 words at a time.
+ *
+ * @param[out] dest Destination of n words
+ * @param[in] src Source of n words
+ * @param[in] n Number of words
+ */
+void utils_copyWordsBE(void *dest, const void *src, size_t n)
+{
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    if (d != s)
+    {
+        memcpy(d, s, n * sizeof(uint16_t));
+    }
+    return;
+#else
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; n >= 8; n -= 8, s += 16, d += 16)
+    {
+        vst1q_u8(d, vrev16q_u8(vld1q_u8(s)));
+    }
+#elif defined(__SSE2__)
+    for (; n >= 8; n -= 8, s += 16, d += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)s);
+
+        _mm_storeu_si128((__m128i *)d, _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+#endif
+    for (; n > 0; n--, s += 2, d += 2)
+    {
+        uint8_t low = s[0];
+
+        d[0] = s[1];
+        d[1] = low;
+    }
+#endif
+}
@@ -56,6 +56,8 @@ typedef enum
 
 str2int_errno str2int(int *out, char *s, int base);
 void utils_hexdump(uint8_t *memptr, size_t len);
+int utils_setCpuAffinity(int cpu);
+void utils_copyWordsBE(void *dest, const void *src, size_t n);
 
 /**
  * @brief Returns full bytes on given bit count